@@ -31,4 +31,123 @@ double sigmoid(double x);
  */
 double sigmoid_prime(double sigmoid_x);
 
+/**
+ * A fast approximation of the sigmoid, built out of tanh_fast.
+ * The absolute error is at most 5e-5.
+ * @param x the input
+ * @return about sigmoid(x)
+ */
+double sigmoid_fast(double x);
+
+/**
+ * A fast approximation of the sigmoid, interpolating linearly between
+ * values in a table.
+ * The absolute error is at most 2e-5.
+ * @param x the input
+ * @return about sigmoid(x)
+ */
+double sigmoid_table(double x);
+
+/**
+ * The derivative of tanh as a function of tanh(x). Use this with libm's
+ * tanh (or an approximation of it) as the activation.
+ * @param tanh_x tanh(x)
+ * @return the derivative of tanh
+ */
+double tanh_prime(double tanh_x);
+
+/**
+ * A fast approximation of tanh: a [7/6] Pade approximant, clamped where it
+ * would run past +-1.
+ * The absolute error is at most 1e-4.
+ * @param x the input
+ * @return about tanh(x)
+ */
+double tanh_fast(double x);
+
+/**
+ * A fast approximation of tanh, out of the sigmoid_table table.
+ * The absolute error is at most 3e-5.
+ * @param x the input
+ * @return about tanh(x)
+ */
+double tanh_table(double x);
+
+/**
+ * The sigmoid of every element of an array. in and out may be the same.
+ * @param in the inputs
+ * @param out where to put the sigmoids
+ * @param count how many elements there are
+ */
+void sigmoid_array(const double *in, double *out, int count);
+
+/**
+ * sigmoid_fast of every element of an array. Free of branches, so it
+ * vectorizes. in and out may be the same.
+ * @param in the inputs
+ * @param out where to put the results
+ * @param count how many elements there are
+ */
+void sigmoid_fast_array(const double *in, double *out, int count);
+
+/**
+ * sigmoid_table of every element of an array. in and out may be the same.
+ * @param in the inputs
+ * @param out where to put the results
+ * @param count how many elements there are
+ */
+void sigmoid_table_array(const double *in, double *out, int count);
+
+/**
+ * tanh of every element of an array. in and out may be the same.
+ * @param in the inputs
+ * @param out where to put the results
+ * @param count how many elements there are
+ */
+void tanh_array(const double *in, double *out, int count);
+
+/**
+ * tanh_fast of every element of an array. Free of branches, so it
+ * vectorizes. in and out may be the same.
+ * @param in the inputs
+ * @param out where to put the results
+ * @param count how many elements there are
+ */
+void tanh_fast_array(const double *in, double *out, int count);
+
+/**
+ * tanh_table of every element of an array. in and out may be the same.
+ * @param in the inputs
+ * @param out where to put the results
+ * @param count how many elements there are
+ */
+void tanh_table_array(const double *in, double *out, int count);
+
+/**
+ * Describes one of the activation functions we know about, so that nets
+ * using it can be saved, loaded and compiled ahead of time.
+ */
+typedef struct _activation_info {
+  const char *name; /* The name the activation is saved under */
+  double (*func)(double); /* The activation function */
+  double (*prime)(double); /* Its derivative, as a function of its output */
+  void (*array)(const double *, double *, int); /* Its array form */
+  const char *source; /* The C body of a function computing the activation
+                       * of x, or NULL if it can't be exported to C */
+} activation_info;
+
+/**
+ * Find the info for the activation function given.
+ * @param func the activation function
+ * @return the info, or NULL if we don't know about this function
+ */
+const activation_info *activation_find(double (*func)(double));
+
+/**
+ * Find the info for the activation function with the name given.
+ * @param name the name
+ * @return the info, or NULL if there is no such activation
+ */
+const activation_info *activation_find_name(const char *name);
+
 #endif /* __HELIOS_ACTIVATIONS__ */
@@ -0,0 +1,65 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __HELIOS_CHECKPOINT__
+#define __HELIOS_CHECKPOINT__
+#include "neuralnet.h"
+
+/**
+ * Checkpoints a net without stopping its training for long.
+ * Taking a checkpoint only copies the net's weights into a spare buffer;
+ * a background thread then saves them (in neuralnet_save's format), fsyncs
+ * them, renames them over the previous checkpoint and fsyncs the directory,
+ * so a crash mid-write never leaves a broken checkpoint behind, and once a
+ * checkpoint has been written it stays written.
+ */
+typedef struct _checkpointer checkpointer;
+
+/**
+ * Create a checkpointer for the net given.
+ * @param c the return checkpointer
+ * @param net the net to checkpoint. Must outlive the checkpointer
+ * @param path where to save the checkpoints to
+ * @return did it succeed?
+ */
+int checkpointer_create(checkpointer **c, neuralnet *net, const char *path);
+
+/**
+ * Snapshot the net's weights and have them written out in the background.
+ * Call this between calls to neuralnet_train, so the snapshot is
+ * consistent. If the previous checkpoint is still being written this
+ * doesn't wait for it; the new snapshot just replaces any other one still
+ * waiting its turn.
+ * @param c the checkpointer
+ * @return did it succeed?
+ */
+int checkpointer_save(checkpointer *c);
+
+/**
+ * Wait until every snapshot taken so far is safely on disk.
+ * @param c the checkpointer
+ * @return whether the last checkpoint written succeeded
+ */
+int checkpointer_wait(checkpointer *c);
+
+/**
+ * Finish writing any outstanding checkpoint and destroy the checkpointer.
+ * @param c the checkpointer
+ * @return whether the last checkpoint written succeeded
+ */
+int checkpointer_destroy(checkpointer *c);
+
+#endif /* __HELIOS_CHECKPOINT__ */
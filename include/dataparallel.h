@@ -0,0 +1,51 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __HELIOS_DATAPARALLEL__
+#define __HELIOS_DATAPARALLEL__
+#include "neuralnet.h"
+#include "transport.h"
+
+/**
+ * Data parallel training: every process holds a replica of the same net,
+ * trains it on its own shard of the data, and every so often the replicas'
+ * weights get averaged through a transport.
+ */
+
+/**
+ * Average the net's weights with those of every other process.
+ * @param net the net
+ * @param t the transport
+ * @return did it succeed?
+ */
+int dataparallel_sync(neuralnet *net, transport *t);
+
+/**
+ * Train the net on this process' shard of the data, averaging the weights
+ * with every other process before starting and after every sync_every
+ * inputs. The shards don't need to be the same size.
+ * @param net the net
+ * @param t the transport
+ * @param inputs this process' inputs
+ * @param labels the correct labels for the inputs
+ * @param input_count the number of inputs
+ * @param sync_every how many inputs to train on between averages
+ * @return did it succeed?
+ */
+int dataparallel_train(neuralnet *net, transport *t, const double *inputs,
+                       const double *labels, int input_count, int sync_every);
+
+#endif /* __HELIOS_DATAPARALLEL__ */
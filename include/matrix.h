@@ -0,0 +1,67 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __HELIOS_MATRIX__
+#define __HELIOS_MATRIX__
+
+/**
+ * Dense matrix kernels. Matrices are row major, and each one comes with a
+ * leading dimension (the distance between the starts of its rows), so they
+ * can be blocks of bigger matrices.
+ */
+
+/**
+ * C = alpha * op(A) * op(B) + beta * C, where op(X) is X, or X transposed
+ * if the matching trans flag is set. The work is blocked so the bits of A,
+ * B and C in use stay in cache.
+ * @param trans_a whether to transpose A
+ * @param trans_b whether to transpose B
+ * @param m the rows of op(A) and C
+ * @param n the columns of op(B) and C
+ * @param k the columns of op(A) and rows of op(B)
+ * @param alpha what to scale the product by
+ * @param a A
+ * @param lda A's leading dimension
+ * @param b B
+ * @param ldb B's leading dimension
+ * @param beta what to scale C by first. If it's 0 C doesn't have to be
+ *        initialized
+ * @param c C
+ * @param ldc C's leading dimension
+ */
+void matrix_gemm(int trans_a, int trans_b, int m, int n, int k, double alpha,
+                 const double *a, int lda, const double *b, int ldb,
+                 double beta, double *c, int ldc);
+
+/**
+ * Singular value decomposition, A = U * S * V^T, by one-sided Jacobi
+ * rotations: columns of A get rotated in pairs until they're all
+ * orthogonal, at which point they're the columns of U * S. The singular
+ * values come out largest first.
+ * @param m the rows of A
+ * @param n the columns of A
+ * @param a A, overwritten with U * S (m by n)
+ * @param lda A's leading dimension
+ * @param s where to put the n singular values
+ * @param v where to put V (n by n, the right singular vectors in its
+ *        columns)
+ * @param ldv V's leading dimension
+ * @return whether it converged
+ */
+int matrix_svd(int m, int n, double *a, int lda, double *s, double *v,
+               int ldv);
+
+#endif /* __HELIOS_MATRIX__ */
@@ -17,14 +17,45 @@
 #ifndef __HELIOS_NEURALNET__
 #define __HELIOS_NEURALNET__
 #include <stdio.h>
+#include "threadpool.h"
 
 /**
  * An activation function.
  */
 typedef double (*activation_func)(double);
 
+/**
+ * How a new net's weights are initialized.
+ */
+typedef enum _weight_init {
+  INIT_UNIFORM = 0, /* Everything, biases included, uniform in [0, 1) */
+  INIT_XAVIER, /* Uniform in +-sqrt(6 / (fan in + fan out)), biases at 0 */
+  INIT_HE, /* Uniform in +-sqrt(6 / fan in), biases at 0 */
+} weight_init;
+
+/**
+ * A 2D convolutional layer. Its inputs are taken as channels x height x
+ * width images (flattened in that order), each filter is slid over them
+ * and the results go through the activation and are then max pooled. Its
+ * outputs are laid out the same way, filters x pooled height x pooled
+ * width, which is what its entry in layer_sizes has to be.
+ */
+typedef struct _conv_spec {
+  int filters; /* How many filters, ie output channels. 0 for a dense layer */
+  int channels; /* The input's channels */
+  int height; /* The input's height */
+  int width; /* The input's width */
+  int kernel; /* The side of the (square) filters */
+  int stride; /* How far apart filters are applied. 0 means 1 */
+  int padding; /* How many zeros to pad the input with on every side */
+  int pool; /* The side of the (square, non-overlapping) max pooling
+             * windows. 0 or 1 means no pooling */
+} conv_spec;
+
 /**
  * An intial configuration for a neural net.
+ * Zero it before filling it in (eg netconfig conf = { 0 };) so that any
+ * fields you don't care about get their defaults.
  */
 typedef struct _netconfig {
   int layers; /* The number of layers in the network (excluding input layer) */
@@ -34,12 +65,72 @@ typedef struct _netconfig {
   activation_func activation_prime; /* Derivative of the activation function
                                      * AS A FUNCTION OF THE ACTIVATION FUNCTION
                                      * (eg x(1 - x) for a sigmoid) */
-  int threads; /* How many threads to give to this net */
+  int threads; /* How many threads to give to this net. 0 means the net
+                * gets no thread pool and does everything on the calling
+                * thread. With a shared pool, how many jobs to split each
+                * layer into instead (0 for one per pool thread) */
   double alpha; /* The learning rate for the network */
   double iscale; /* The input scale */
-  int max_width; /* Upper bound on layer width (>= dimensionality too). */
+  int max_width; /* Upper bound on layer width (>= dimensionality too, and
+                  * for conv layers >= filters and channels * kernel^2). */
+  unsigned long seed; /* The seed for the initial weights. The same seed
+                       * always gives the same weights, however many
+                       * threads there are. */
+  weight_init init; /* How to initialize the weights */
+  const conv_spec *conv; /* NULL if every layer is dense; otherwise one spec
+                          * per layer, with 0 filters for the dense ones.
+                          * The last layer has to be dense. */
+  int inference_only; /* Leave out everything only training needs, so the
+                       * net can classify and evaluate but not train */
+  threadpool *pool; /* If not NULL, run on this pool instead of creating
+                     * one. The caller owns it, and it has to outlive
+                     * the net; any number of nets may share it. */
+  const int *layer_jobs; /* NULL to split every layer into as many jobs as
+                          * there are threads. Otherwise how many to split
+                          * each layer into, at most that many; a layer
+                          * with one job runs on the calling thread. See
+                          * tuner.h for working these out. */
+  int output_samples; /* 0 to train every output on every input. Otherwise
+                       * training only works out and adjusts the outputs
+                       * whose labels aren't 0, plus this many others
+                       * picked at random for each input (negative
+                       * sampling), which pays off for wide output layers
+                       * with one-hot labels. Classifying still works out
+                       * every output. */
 } netconfig;
 
+/**
+ * How well a net does on a set of labelled inputs.
+ */
+typedef struct _netmetrics {
+  double mse; /* Mean squared error, per output */
+  double cross_entropy; /* Mean (binary, per output) cross entropy per input */
+  double accuracy; /* The fraction of inputs classified correctly */
+  int count; /* How many inputs were evaluated */
+} netmetrics;
+
+/**
+ * How a call to neuralnet_train_stats went. The errors are those of each
+ * input's forward pass, just before training on it adjusted the weights.
+ */
+typedef struct _trainstats {
+  double loss; /* Sum of the squared errors at the outputs (just the ones
+                * trained on, with output_samples) */
+  double mse; /* Mean squared error, per output trained on */
+  int count; /* How many inputs were trained on */
+} trainstats;
+
+/**
+ * How factoring a layer at some rank goes, from neuralnet_factor_report.
+ */
+typedef struct _factor_report {
+  int rank; /* The rank */
+  double reconstruction; /* Relative (Frobenius) error of the weights */
+  double mse_delta; /* Change in the mean squared error */
+  double accuracy_delta; /* Change in the accuracy */
+  double cost; /* Multiply-adds per input, relative to the dense layer */
+} factor_report;
+
 /**
  * A neural network
  */
@@ -67,11 +158,26 @@ int neuralnet_destroy(neuralnet *net);
  * @param input the inputs
  * @param labels the correct labels for the inputs
  * @param input_count the number of inputs
- * @return did it succeed?
+ * @return did it succeed? Always fails for inference only nets
  */
 int neuralnet_train(neuralnet *net, const double *inputs, const double *labels,
                     int input_count);
 
+/**
+ * Train the neural network given like neuralnet_train, keeping track of the
+ * loss as it goes. That comes out of the errors back propagation works out
+ * anyway, so it's much cheaper than classifying the inputs again.
+ * @param net the net
+ * @param input the inputs
+ * @param labels the correct labels for the inputs
+ * @param input_count the number of inputs
+ * @param stats where to put the loss, or NULL to not bother
+ * @return did it succeed? Always fails for inference only nets
+ */
+int neuralnet_train_stats(neuralnet *net, const double *inputs,
+                          const double *labels, int input_count,
+                          trainstats *stats);
+
 /**
  * Classify the inputs given.
  * @param net the net
@@ -83,6 +189,83 @@ int neuralnet_train(neuralnet *net, const double *inputs, const double *labels,
 int neuralnet_classify(neuralnet *net, const double *inputs, double *results,
                        int input_count);
 
+/**
+ * Evaluate how well the net does on the labelled inputs given.
+ * The inputs are split across the net's threads, and each thread feeds its
+ * share forward and adds up its own metrics as it goes, so the outputs are
+ * never all stored. An input counts as classified correctly if its largest
+ * output is where its label's largest value is, or, for nets with a single
+ * output, if the output and the label are on the same side of 0.5.
+ * @param net the net
+ * @param inputs the inputs
+ * @param labels the correct labels for the inputs
+ * @param input_count the number of inputs
+ * @param metrics where to put the results
+ * @return did it succeed?
+ */
+int neuralnet_evaluate(neuralnet *net, const double *inputs,
+                       const double *labels, int input_count,
+                       netmetrics *metrics);
+
+/**
+ * Classify the inputs given, pipelining them through the layers.
+ * The layers are split into stages of about the same amount of work, each
+ * stage runs on its own thread, and samples flow from one stage to the next
+ * through lock-free queues, so several samples are in flight at once.
+ * Throughput then tracks the slowest stage rather than the whole net, which
+ * pays off for deep nets and long streams of inputs. This doesn't use the
+ * net's threadpool, and doesn't disturb the state neuralnet_train uses.
+ * @param net the net
+ * @param input the inputs
+ * @param results the network's results
+ * @param input_count the number of inputs
+ * @param stages how many stages (and threads) to use. Clamped to the number
+ *        of layers.
+ * @return did it succeed?
+ */
+int neuralnet_classify_pipelined(neuralnet *net, const double *inputs,
+                                 double *results, int input_count,
+                                 int stages);
+
+/**
+ * Get the dimensionality of the inputs to the net given.
+ * @param net the net
+ * @return how many doubles make up one input
+ */
+int neuralnet_input_size(neuralnet *net);
+
+/**
+ * Get the dimensionality of the outputs of the net given.
+ * @param net the net
+ * @return how many doubles make up one output (or one label)
+ */
+int neuralnet_output_size(neuralnet *net);
+
+/**
+ * Get how many trainable parameters (weights and biases) the net has.
+ * @param net the net
+ * @return the parameter count
+ */
+int neuralnet_param_count(neuralnet *net);
+
+/**
+ * Copy all the net's parameters out into a flat array, layer by layer and
+ * neuron by neuron, each neuron's weights followed by its bias.
+ * @param net the net
+ * @param params where to put them. Must fit neuralnet_param_count doubles
+ */
+void neuralnet_get_params(neuralnet *net, double *params);
+
+/**
+ * Overwrite all the net's parameters with the ones given, in the order
+ * neuralnet_get_params uses. Factored layers go back to being dense.
+ * @param net the net
+ * @param params the new parameters
+ * @return did it succeed? It can only fail for a net with factored layers,
+ *         which is left as it was
+ */
+int neuralnet_set_params(neuralnet *net, const double *params);
+
 /**
  * Dump out a debug log of the neural net given.
  * @param net the net
@@ -90,4 +273,119 @@ int neuralnet_classify(neuralnet *net, const double *inputs, double *results,
  */
 void neuralnet_dump(neuralnet *net, FILE *stream);
 
+/**
+ * Save the neural net given in helios' binary model format.
+ * The format stores ints and doubles in native byte order, so models
+ * are only portable across machines of the same architecture.
+ * The net's activation function has to be one of the ones in activations.h.
+ * Factored layers (see neuralnet_factorize) are saved as their factors,
+ * which take up less room than their dense weights would.
+ * @param net the net
+ * @param stream where to save it to
+ * @return did it succeed?
+ */
+int neuralnet_save(neuralnet *net, FILE *stream);
+
+/**
+ * Save the neural net given like neuralnet_save does, but with the
+ * parameters given (as laid out by neuralnet_get_params) instead of the
+ * net's current ones. Handy to save a snapshot while the net keeps training.
+ * Every layer is saved dense.
+ * @param net the net
+ * @param params the parameters to save
+ * @param stream where to save it to
+ * @return did it succeed?
+ */
+int neuralnet_save_params(neuralnet *net, const double *params, FILE *stream);
+
+/**
+ * Load a neural net previously saved with neuralnet_save.
+ * @param net pointer to the neural net to initialize
+ * @param stream where to load it from
+ * @param threads how many threads to give to the loaded net
+ * @return did it succeed?
+ */
+int neuralnet_load(neuralnet **net, FILE *stream, int threads);
+
+/**
+ * Load a neural net previously saved with neuralnet_save, for inference
+ * only (see netconfig's inference_only).
+ * @param net pointer to the neural net to initialize
+ * @param stream where to load it from
+ * @param threads how many threads to give to the loaded net, or 0 for none
+ * @return did it succeed?
+ */
+int neuralnet_load_inference(neuralnet **net, FILE *stream, int threads);
+
+/**
+ * Load a neural net previously saved with neuralnet_save onto a shared
+ * thread pool (see netconfig's pool).
+ * @param net pointer to the neural net to initialize
+ * @param stream where to load it from
+ * @param pool the pool to run on
+ * @param threads how many jobs to split each layer into, or 0 for one per
+ *        pool thread
+ * @param inference_only whether to load it for inference only
+ * @return did it succeed?
+ */
+int neuralnet_load_shared(neuralnet **net, FILE *stream, threadpool *pool,
+                          int threads, int inference_only);
+
+/**
+ * Generate a self-contained C source file that classifies inputs exactly
+ * like the net given does right now. Layer sizes become compile time
+ * constants and the weights become static const arrays, so the generated
+ * code needs neither libhelios nor any of the net's runtime configuration.
+ * The file defines
+ *   void <prefix>_classify(const double *input, double *output);
+ * which classifies a single input.
+ * The net's activation function has to be one of the ones in activations.h,
+ * and all of its layers have to be dense.
+ * @param net the net
+ * @param stream where to write the source to
+ * @param prefix the prefix for every symbol in the generated code. Must be a
+ *        valid C identifier
+ * @return did it succeed?
+ */
+int neuralnet_export_c(neuralnet *net, FILE *stream, const char *prefix);
+
+/**
+ * Factor a trained dense layer into two thinner ones by its SVD,
+ * W ~= A * B, where A has rank columns and B rank rows. Feeding an input
+ * forward through it then takes rank * (inputs + neurons) multiply-adds
+ * rather than inputs * neurons. The layer's dense weights are freed, and
+ * neuralnet_save keeps just A and B, so the net takes up less memory and
+ * less room on disk too. neuralnet_export_c and neuralnet_get_params work
+ * the weights out as A * B, which is what the net now computes.
+ * A net with factored layers can't be trained; neuralnet_set_params goes
+ * back to dense layers.
+ * @param net the net
+ * @param layer the layer, which has to be dense
+ * @param rank the rank, from 1 up to the smaller of the layer's inputs and
+ *        neurons. The full rank reproduces the layer to rounding error
+ * @param reconstruction if not NULL, where to put the relative error of the
+ *        layer's new weights
+ * @return did it succeed?
+ */
+int neuralnet_factorize(neuralnet *net, int layer, int rank,
+                        double *reconstruction);
+
+/**
+ * Find out how factoring a dense layer at each of the ranks given would go
+ * on a set of labelled inputs, without changing the net.
+ * @param net the net
+ * @param layer the layer, which has to be dense and not factored yet
+ * @param ranks the ranks to try
+ * @param count how many ranks there are
+ * @param inputs the inputs
+ * @param labels the correct labels for the inputs
+ * @param input_count the number of inputs
+ * @param reports where to put a report for each rank
+ * @return did it succeed?
+ */
+int neuralnet_factor_report(neuralnet *net, int layer, const int *ranks,
+                            int count, const double *inputs,
+                            const double *labels, int input_count,
+                            factor_report *reports);
+
 #endif /* __HELIOS_NEURALNET__ */
@@ -0,0 +1,74 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __HELIOS_RNG__
+#define __HELIOS_RNG__
+
+/**
+ * A counter based random number generator: the nth number of the stream
+ * for a seed is a pure function of the seed and n (a SplitMix64 hash of
+ * them), so any thread can generate any part of a stream on its own and
+ * the results never depend on who generated what. It carries no global
+ * state, so it's thread safe and doesn't disturb rand().
+ */
+
+/**
+ * A position in a random stream, for when the numbers are wanted in order.
+ */
+typedef struct _rng {
+  unsigned long long seed; /* Which stream this is */
+  unsigned long long counter; /* Where in the stream we are */
+} rng;
+
+/**
+ * Get the random number at the position given of the stream for a seed.
+ * @param seed the seed
+ * @param counter the position in the stream
+ * @return 64 random bits
+ */
+unsigned long long rng_at(unsigned long long seed, unsigned long long counter);
+
+/**
+ * Like rng_at, but as a double uniformly distributed in [0, 1).
+ * @param seed the seed
+ * @param counter the position in the stream
+ * @return a random double in [0, 1)
+ */
+double rng_uniform_at(unsigned long long seed, unsigned long long counter);
+
+/**
+ * Start a stream from the seed given.
+ * @param r the stream
+ * @param seed the seed
+ */
+void rng_init(rng *r, unsigned long long seed);
+
+/**
+ * Get the next number in a stream.
+ * @param r the stream
+ * @return 64 random bits
+ */
+unsigned long long rng_next(rng *r);
+
+/**
+ * Get the next number in a stream as a double uniformly distributed in
+ * [0, 1).
+ * @param r the stream
+ * @return a random double in [0, 1)
+ */
+double rng_uniform(rng *r);
+
+#endif /* __HELIOS_RNG__ */
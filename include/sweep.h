@@ -0,0 +1,82 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __HELIOS_SWEEP__
+#define __HELIOS_SWEEP__
+#include "neuralnet.h"
+
+/**
+ * Hyperparameter sweeps: train a bunch of configurations side by side in
+ * one process, on one copy of the data, and keep cutting the worse half
+ * (or whatever fraction) until the survivors have trained for the full
+ * number of epochs. Each net gets one worker to itself and no threads of
+ * its own, so the sweep uses as many cores as it has workers whatever
+ * the nets look like.
+ */
+
+/**
+ * How to run a sweep.
+ */
+typedef struct _sweepconfig {
+  int epochs; /* The most passes any configuration makes over the inputs */
+  int batch_size; /* How many examples to hand to neuralnet_train at once */
+  int rung_epochs; /* How many epochs to train between cuts */
+  double keep; /* What fraction of the survivors to keep at every cut, in
+                * (0, 1]. At least one always survives. */
+  int threads; /* How many configurations to train at once */
+  const double *val_inputs; /* What to rank the configurations on. NULL */
+  const double *val_labels; /* to use the training inputs */
+  int val_count; /* How many validation inputs there are */
+} sweepconfig;
+
+/**
+ * How one configuration did.
+ */
+typedef struct _sweepresult {
+  netmetrics metrics; /* How it did on the validation inputs last time */
+  int epochs; /* How many epochs it trained for */
+  int stopped; /* Whether it was cut before the end */
+  int ok; /* Whether it trained at all */
+} sweepresult;
+
+/**
+ * Train every configuration given on the same inputs, cutting the ones
+ * with the highest validation mse every rung_epochs epochs. The
+ * configurations' threads and pool are ignored.
+ * @param configs the configurations to try
+ * @param count how many there are
+ * @param inputs the inputs, shared by every configuration
+ * @param labels the correct labels for the inputs
+ * @param input_count the number of inputs
+ * @param config how to run the sweep
+ * @param results where to put how each configuration did
+ * @return did it succeed?
+ */
+int sweep_run(const netconfig *configs, int count, const double *inputs,
+              const double *labels, int input_count, sweepconfig config,
+              sweepresult *results);
+
+/**
+ * Write out a table of how every configuration did, best first.
+ * @param configs the configurations tried
+ * @param count how many there are
+ * @param results how they did
+ * @param stream where to write the table
+ */
+void sweep_report(const netconfig *configs, int count,
+                  const sweepresult *results, FILE *stream);
+
+#endif /* __HELIOS_SWEEP__ */
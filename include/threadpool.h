@@ -22,6 +22,8 @@
  * A very simple blocking, mapping, thread pool. Takes in a mapper and a
  * set of jobs to submit to the mapper and waits until all are done.
  * You can get super far with this kind of simple parallelism.
+ * Several threads can submit to the same pool at once (say, a few nets
+ * sharing one); the workers take jobs from each submission in turn.
  */
 typedef struct _threadpool threadpool;
 
@@ -42,11 +44,19 @@ int threadpool_create(threadpool **pool, int threadcount);
  */
 int threadpool_destroy(threadpool *pool);
 
+/**
+ * How many threads the pool has.
+ *
+ * @param pool the pool
+ * @return the thread count
+ */
+int threadpool_size(threadpool *pool);
+
 /**
  * Submit a set of jobs to this thread pool and block until they are done.
  * May optionally accept a retvals parameter; this will be offset and
  * passed to the worker in the expectation that it knows what it is and will
- * populate it accordingly.
+ * populate it accordingly. Safe to call from several threads at once.
  *
  * @param pool the pool
  * @param retvals the return values of the jobs, or NULL if you don't care
@@ -0,0 +1,79 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __HELIOS_TRACE__
+#define __HELIOS_TRACE__
+#include <stdio.h>
+
+/**
+ * An optional timeline of what every thread was doing, for finding idle
+ * gaps and stragglers. Each thread records into its own ring buffer (so
+ * recording never takes a lock), keeping only its most recent events, and
+ * the lot can be dumped as Chrome trace event JSON, which opens in
+ * chrome://tracing or ui.perfetto.dev.
+ * While tracing is off recording is just a check of a flag.
+ */
+
+/**
+ * Start tracing.
+ * @param capacity how many events each thread keeps before it starts
+ *        overwriting its oldest ones
+ * @return did it succeed?
+ */
+int trace_enable(int capacity);
+
+/**
+ * Stop tracing. Whatever was recorded is kept for trace_dump.
+ */
+void trace_disable(void);
+
+/**
+ * Is tracing on?
+ */
+int trace_enabled(void);
+
+/**
+ * Note the start of something to trace.
+ * @return the start time to hand to trace_end, or 0 if tracing is off
+ */
+unsigned long long trace_begin(void);
+
+/**
+ * Record something that started at the time given and ends now.
+ * Does nothing if start is 0, so a begin/end pair that straddles
+ * trace_enable doesn't turn up half done.
+ * @param name what it was. This is kept as is, so it has to live as long as
+ *        the trace (ie a string literal)
+ * @param arg a number to go with it, eg which layer
+ * @param start what trace_begin returned
+ */
+void trace_end(const char *name, int arg, unsigned long long start);
+
+/**
+ * Write everything recorded so far out as Chrome trace event JSON. Make
+ * sure nothing is being traced while this runs.
+ * @param stream where to write it
+ * @return did it succeed?
+ */
+int trace_dump(FILE *stream);
+
+/**
+ * Throw away everything recorded so far. Make sure nothing is being traced
+ * while this runs.
+ */
+void trace_reset(void);
+
+#endif /* __HELIOS_TRACE__ */
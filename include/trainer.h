@@ -0,0 +1,69 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __HELIOS_TRAINER__
+#define __HELIOS_TRAINER__
+#include "neuralnet.h"
+
+/**
+ * A training driver that overlaps data preparation with training.
+ * A producer thread gathers (and optionally shuffles and prepares) the next
+ * batches into spare buffers while the current batch trains, handing them
+ * over through a bounded queue. As long as preparing a batch is cheaper than
+ * training on it the net never waits for data.
+ */
+
+/**
+ * Prepares one example for training, eg to augment it or to convert it to
+ * the format the net wants. Runs on the producer thread.
+ * @param ctx the prepare_ctx from the trainconfig
+ * @param index the index of the example in the inputs
+ * @param input the example's input
+ * @param label the example's label
+ * @param input_out where to write the prepared input
+ * @param label_out where to write the prepared label
+ */
+typedef void (*trainer_prepare)(void *ctx, int index, const double *input,
+                                const double *label, double *input_out,
+                                double *label_out);
+
+/**
+ * How to run a training session.
+ */
+typedef struct _trainconfig {
+  int batch_size; /* How many examples to hand to neuralnet_train at once */
+  int depth; /* How many batches can be prepared ahead of the one training */
+  int epochs; /* How many passes to make over the inputs */
+  int shuffle; /* Whether to visit the inputs in a new order every epoch */
+  unsigned long seed; /* The seed for the shuffle */
+  trainer_prepare prepare; /* Called on every example, or NULL to just copy */
+  void *prepare_ctx; /* Passed to prepare */
+} trainconfig;
+
+/**
+ * Train the net given on the inputs given, preparing batches on a
+ * background thread.
+ * @param net the net
+ * @param inputs the inputs
+ * @param labels the correct labels for the inputs
+ * @param input_count the number of inputs
+ * @param config how to train
+ * @return did it succeed?
+ */
+int trainer_train(neuralnet *net, const double *inputs, const double *labels,
+                  int input_count, trainconfig config);
+
+#endif /* __HELIOS_TRAINER__ */
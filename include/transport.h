@@ -0,0 +1,91 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __HELIOS_TRANSPORT__
+#define __HELIOS_TRANSPORT__
+
+/**
+ * A way for several processes working on the same model to talk to each
+ * other. Every process gets a rank in [0, size) and all of them have to
+ * make the same calls in the same order.
+ * Backends fill in a transport_ops table; shared memory is the only one for
+ * now, but anything that can sum arrays across processes (eg sockets) fits.
+ */
+typedef struct _transport transport;
+
+/**
+ * The operations a transport backend has to provide.
+ */
+typedef struct _transport_ops {
+  /* Sum the values of every process, in place. Every process must end up
+   * with bit for bit the same sums. */
+  int (*allreduce)(transport *t, double *values, int count);
+  /* Wait until every process gets here */
+  int (*barrier)(transport *t);
+  /* Tear down this process' end of the transport and free it */
+  int (*destroy)(transport *t);
+} transport_ops;
+
+struct _transport {
+  const transport_ops *ops; /* The backend's operations */
+  int rank; /* Which process we are */
+  int size; /* How many processes there are */
+  void *impl; /* The backend's own state */
+};
+
+/**
+ * Sum the values given across every process, in place.
+ * @param t the transport
+ * @param values the values; on return, the sums
+ * @param count how many values there are. Must match across processes
+ * @return did it succeed?
+ */
+int transport_allreduce(transport *t, double *values, int count);
+
+/**
+ * Block until every process reaches the barrier.
+ * @param t the transport
+ * @return did it succeed?
+ */
+int transport_barrier(transport *t);
+
+/**
+ * Destroy this process' end of the transport given.
+ * @param t the transport
+ * @return did it succeed?
+ */
+int transport_destroy(transport *t);
+
+/**
+ * Create a transport over a POSIX shared memory segment, for processes on
+ * the same machine. Every process calls this with the same name, size and
+ * max_count and its own rank; it returns once all of them have joined.
+ * The name is unlinked as soon as everyone has joined, so it has to be
+ * unique to this run (eg include the parent's pid in it).
+ * All-reduces are done as a reduce-scatter, where each process sums its own
+ * slice of everyone's values, followed by an all-gather.
+ * @param t the return transport
+ * @param name the segment's name, eg "/my-model-1234"
+ * @param rank this process' rank
+ * @param size how many processes there are
+ * @param max_count the most values summed in one go; bigger all-reduces are
+ *        done in pieces. This bounds the size of the segment.
+ * @return did it succeed?
+ */
+int transport_shm_create(transport **t, const char *name, int rank, int size,
+                         int max_count);
+
+#endif /* __HELIOS_TRANSPORT__ */
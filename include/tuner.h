@@ -0,0 +1,77 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __HELIOS_TUNER__
+#define __HELIOS_TUNER__
+#include "neuralnet.h"
+
+/**
+ * Works out how many jobs to split each layer of a net into (netconfig's
+ * layer_jobs) by timing the candidates on the actual topology, on this
+ * machine. Narrow layers often do best on one job, where they skip the
+ * hand off to the pool altogether; wide ones on every thread there is.
+ * Plans can be kept in a tuning cache file, keyed by the topology, the
+ * activation, the output sampling, the thread and batch counts and the
+ * CPU model, so they only ever need working out once.
+ */
+
+/**
+ * Time training (or classifying, for inference only configs) a batch of
+ * batch_size random inputs with every candidate split of every layer, and
+ * pick the fastest. config.threads is the most jobs any layer can get.
+ * @param config the net to tune for
+ * @param batch_size how many inputs to time at once
+ * @param layer_jobs where to put the plan, one per layer
+ * @return did it succeed?
+ */
+int tuner_tune(netconfig config, int batch_size, int *layer_jobs);
+
+/**
+ * Look up a plan in a tuning cache file.
+ * @param path the cache file
+ * @param config the net the plan is for
+ * @param batch_size the batch size the plan is for
+ * @param layer_jobs where to put the plan, one per layer
+ * @return whether there was one
+ */
+int tuner_lookup(const char *path, const netconfig *config, int batch_size,
+                 int *layer_jobs);
+
+/**
+ * Add a plan to a tuning cache file, creating it if need be. Later plans
+ * replace earlier ones for the same key.
+ * @param path the cache file
+ * @param config the net the plan is for
+ * @param batch_size the batch size the plan is for
+ * @param layer_jobs the plan, one per layer
+ * @return did it succeed?
+ */
+int tuner_store(const char *path, const netconfig *config, int batch_size,
+                const int *layer_jobs);
+
+/**
+ * Look up the plan for a net in a tuning cache file, or if there isn't one
+ * tune for it and add the result to the cache.
+ * @param path the cache file, or NULL to always tune
+ * @param config the net to plan for
+ * @param batch_size how many inputs the net will be trained on at once
+ * @param layer_jobs where to put the plan, one per layer
+ * @return did it succeed?
+ */
+int tuner_plan(const char *path, const netconfig *config, int batch_size,
+               int *layer_jobs);
+
+#endif /* __HELIOS_TUNER__ */
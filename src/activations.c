@@ -16,6 +16,58 @@
  */
 #include "activations.h"
 #include <math.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * Past this the Pade approximant of tanh would run over 1, so we clamp
+ * the input to it.
+ */
+#define TANH_FAST_CLAMP 4.97
+
+/**
+ * The sigmoid table covers [-SIGMOID_TABLE_RANGE, SIGMOID_TABLE_RANGE].
+ * Past it the sigmoid is within 2e-7 of 0 or 1.
+ */
+#define SIGMOID_TABLE_RANGE 16
+
+/**
+ * How many table entries there are per unit.
+ */
+#define SIGMOID_TABLE_STEPS 32
+
+/**
+ * How many entries there are in the sigmoid table.
+ */
+#define SIGMOID_TABLE_SIZE (2 * SIGMOID_TABLE_RANGE * SIGMOID_TABLE_STEPS + 1)
+
+/**
+ * The sigmoid, sampled every 1 / SIGMOID_TABLE_STEPS from
+ * -SIGMOID_TABLE_RANGE to SIGMOID_TABLE_RANGE.
+ */
+static double _sigmoid_table[SIGMOID_TABLE_SIZE];
+
+/**
+ * Makes sure the table only gets filled once.
+ */
+static pthread_once_t _sigmoid_table_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Fill the sigmoid table.
+ */
+static void _init_sigmoid_table(void);
+
+/**
+ * The Pade approximant behind tanh_fast. Written so it inlines into the
+ * array forms and vectorizes.
+ */
+static inline double _tanh_rational(double x);
+
+/**
+ * Look x up in the sigmoid table. The table must be filled.
+ */
+static inline double _sigmoid_lookup(double x);
 
 double sigmoid(double x) {
   return 1 / (1 + exp(-x));
@@ -24,3 +76,138 @@ double sigmoid(double x) {
 double sigmoid_prime(double sigmoid_x) {
   return sigmoid_x * (1 - sigmoid_x);
 }
+
+double sigmoid_fast(double x) {
+  /* sigmoid(x) = (1 + tanh(x / 2)) / 2, which halves tanh_fast's error */
+  return 0.5 + 0.5 * _tanh_rational(0.5 * x);
+}
+
+double sigmoid_table(double x) {
+  pthread_once(&_sigmoid_table_once, _init_sigmoid_table);
+  return _sigmoid_lookup(x);
+}
+
+double tanh_prime(double tanh_x) {
+  return 1 - tanh_x * tanh_x;
+}
+
+double tanh_fast(double x) {
+  return _tanh_rational(x);
+}
+
+double tanh_table(double x) {
+  /* tanh(x) = 2 sigmoid(2x) - 1, which doubles the table's error */
+  pthread_once(&_sigmoid_table_once, _init_sigmoid_table);
+  return 2 * _sigmoid_lookup(2 * x) - 1;
+}
+
+void sigmoid_array(const double *in, double *out, int count) {
+  for (int i = 0; i < count; i++) {
+    out[i] = 1 / (1 + exp(-in[i]));
+  }
+}
+
+void sigmoid_fast_array(const double *in, double *out, int count) {
+  for (int i = 0; i < count; i++) {
+    out[i] = 0.5 + 0.5 * _tanh_rational(0.5 * in[i]);
+  }
+}
+
+void sigmoid_table_array(const double *in, double *out, int count) {
+  pthread_once(&_sigmoid_table_once, _init_sigmoid_table);
+  for (int i = 0; i < count; i++) {
+    out[i] = _sigmoid_lookup(in[i]);
+  }
+}
+
+void tanh_array(const double *in, double *out, int count) {
+  for (int i = 0; i < count; i++) {
+    out[i] = tanh(in[i]);
+  }
+}
+
+void tanh_fast_array(const double *in, double *out, int count) {
+  for (int i = 0; i < count; i++) {
+    out[i] = _tanh_rational(in[i]);
+  }
+}
+
+void tanh_table_array(const double *in, double *out, int count) {
+  pthread_once(&_sigmoid_table_once, _init_sigmoid_table);
+  for (int i = 0; i < count; i++) {
+    out[i] = 2 * _sigmoid_lookup(2 * in[i]) - 1;
+  }
+}
+
+static inline double _tanh_rational(double x) {
+  /* The ternaries turn into min/max instructions rather than branches */
+  x = x > TANH_FAST_CLAMP ? TANH_FAST_CLAMP : x;
+  x = x < -TANH_FAST_CLAMP ? -TANH_FAST_CLAMP : x;
+  double x2 = x * x;
+  return x * (135135 + x2 * (17325 + x2 * (378 + x2))) /
+         (135135 + x2 * (62370 + x2 * (3150 + x2 * 28)));
+}
+
+static inline double _sigmoid_lookup(double x) {
+  x = x > SIGMOID_TABLE_RANGE ? SIGMOID_TABLE_RANGE : x;
+  x = x < -SIGMOID_TABLE_RANGE ? -SIGMOID_TABLE_RANGE : x;
+  double pos = (x + SIGMOID_TABLE_RANGE) * SIGMOID_TABLE_STEPS;
+  int i = (int) pos;
+  /* Only x == SIGMOID_TABLE_RANGE lands on the last entry */
+  i = i > SIGMOID_TABLE_SIZE - 2 ? SIGMOID_TABLE_SIZE - 2 : i;
+  double frac = pos - i;
+  return _sigmoid_table[i] + (_sigmoid_table[i + 1] - _sigmoid_table[i]) *
+                             frac;
+}
+
+static void _init_sigmoid_table(void) {
+  for (int i = 0; i < SIGMOID_TABLE_SIZE; i++) {
+    _sigmoid_table[i] = sigmoid(-SIGMOID_TABLE_RANGE +
+                                i / (double) SIGMOID_TABLE_STEPS);
+  }
+}
+
+/**
+ * The C source of tanh_fast's Pade approximant, for export.
+ */
+#define TANH_RATIONAL_SOURCE \
+  "x = x > 4.97 ? 4.97 : x;\n" \
+  "  x = x < -4.97 ? -4.97 : x;\n" \
+  "  double x2 = x * x;\n" \
+  "  double t = x * (135135 + x2 * (17325 + x2 * (378 + x2))) /\n" \
+  "             (135135 + x2 * (62370 + x2 * (3150 + x2 * 28)));\n"
+
+/**
+ * All the activations we know about. NULL terminated.
+ */
+static const activation_info _activations[] = {
+  { "sigmoid", sigmoid, sigmoid_prime, sigmoid_array,
+    "return 1 / (1 + exp(-x));" },
+  { "sigmoid_fast", sigmoid_fast, sigmoid_prime, sigmoid_fast_array,
+    "x = 0.5 * x;\n  " TANH_RATIONAL_SOURCE "  return 0.5 + 0.5 * t;" },
+  { "sigmoid_table", sigmoid_table, sigmoid_prime, sigmoid_table_array,
+    NULL },
+  { "tanh", tanh, tanh_prime, tanh_array, "return tanh(x);" },
+  { "tanh_fast", tanh_fast, tanh_prime, tanh_fast_array,
+    TANH_RATIONAL_SOURCE "  return t;" },
+  { "tanh_table", tanh_table, tanh_prime, tanh_table_array, NULL },
+  { NULL, NULL, NULL, NULL, NULL },
+};
+
+const activation_info *activation_find(double (*func)(double)) {
+  for (const activation_info *a = _activations; a->name; a++) {
+    if (a->func == func) {
+      return a;
+    }
+  }
+  return NULL;
+}
+
+const activation_info *activation_find_name(const char *name) {
+  for (const activation_info *a = _activations; a->name; a++) {
+    if (!strcmp(a->name, name)) {
+      return a;
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,236 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "checkpoint.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * The suffix of the file we write a checkpoint to before renaming it.
+ */
+#define TMP_SUFFIX ".tmp"
+
+struct _checkpointer {
+  neuralnet *net; /* The net we're checkpointing */
+  char *path; /* Where checkpoints go */
+  char *tmp_path; /* Where checkpoints get written before they're renamed */
+  int count; /* How many parameters the net has */
+  double *buffers[2]; /* The snapshot buffers */
+  int writing; /* Which buffer is being written out, or -1 if none */
+  int pending; /* Which buffer is waiting to be written, or -1 if none */
+  int rc; /* Whether the last checkpoint written succeeded */
+  int stopping; /* Are we being destroyed? */
+  pthread_t thread; /* The background writer */
+  pthread_mutex_t lock; /* Protects everything above that changes */
+  pthread_cond_t cv; /* Signals a change in writing or pending */
+};
+
+/**
+ * The background writer.
+ */
+static void *_writer_func(void *the_checkpointer);
+
+/**
+ * Write the snapshot given out to disk.
+ */
+static int _write(checkpointer *c, const double *params);
+
+/**
+ * fsync the directory the file given is in, so that renaming the file
+ * survives a crash too.
+ */
+static int _sync_dir(const char *path);
+
+int checkpointer_create(checkpointer **retval, neuralnet *net,
+                        const char *path) {
+  checkpointer *c = calloc(1, sizeof(checkpointer));
+  if (!c) {
+    perror("checkpointer_create");
+    return 0;
+  }
+  c->net = net;
+  c->count = neuralnet_param_count(net);
+  c->writing = -1;
+  c->pending = -1;
+  c->rc = 1;
+  c->path = malloc(strlen(path) + 1);
+  c->tmp_path = malloc(strlen(path) + strlen(TMP_SUFFIX) + 1);
+  c->buffers[0] = malloc(sizeof(double) * c->count);
+  c->buffers[1] = malloc(sizeof(double) * c->count);
+  if (!c->path || !c->tmp_path || !c->buffers[0] || !c->buffers[1]) {
+    perror("checkpointer_create");
+    free(c->path);
+    free(c->tmp_path);
+    free(c->buffers[0]);
+    free(c->buffers[1]);
+    free(c);
+    return 0;
+  }
+  strcpy(c->path, path);
+  strcpy(c->tmp_path, path);
+  strcat(c->tmp_path, TMP_SUFFIX);
+  if (pthread_mutex_init(&(c->lock), NULL)) {
+    free(c->path);
+    free(c->tmp_path);
+    free(c->buffers[0]);
+    free(c->buffers[1]);
+    free(c);
+    return 0;
+  }
+  if (pthread_cond_init(&(c->cv), NULL)) {
+    pthread_mutex_destroy(&(c->lock));
+    free(c->path);
+    free(c->tmp_path);
+    free(c->buffers[0]);
+    free(c->buffers[1]);
+    free(c);
+    return 0;
+  }
+  if (pthread_create(&(c->thread), NULL, _writer_func, c)) {
+    perror("checkpointer_create");
+    pthread_cond_destroy(&(c->cv));
+    pthread_mutex_destroy(&(c->lock));
+    free(c->path);
+    free(c->tmp_path);
+    free(c->buffers[0]);
+    free(c->buffers[1]);
+    free(c);
+    return 0;
+  }
+  *retval = c;
+  return 1;
+}
+
+int checkpointer_save(checkpointer *c) {
+  pthread_mutex_lock(&(c->lock));
+  /* Whichever buffer isn't being written is ours to fill, even if it holds
+   * an older snapshot that's still waiting: this one's newer. */
+  int buffer = c->writing == 0 ? 1 : 0;
+  c->pending = -1;
+  pthread_mutex_unlock(&(c->lock));
+  /* The writer never touches a buffer that isn't writing or pending */
+  neuralnet_get_params(c->net, c->buffers[buffer]);
+  pthread_mutex_lock(&(c->lock));
+  c->pending = buffer;
+  pthread_cond_broadcast(&(c->cv));
+  pthread_mutex_unlock(&(c->lock));
+  return 1;
+}
+
+int checkpointer_wait(checkpointer *c) {
+  pthread_mutex_lock(&(c->lock));
+  while (c->pending != -1 || c->writing != -1) {
+    pthread_cond_wait(&(c->cv), &(c->lock));
+  }
+  int rc = c->rc;
+  pthread_mutex_unlock(&(c->lock));
+  return rc;
+}
+
+int checkpointer_destroy(checkpointer *c) {
+  pthread_mutex_lock(&(c->lock));
+  c->stopping = 1;
+  pthread_cond_broadcast(&(c->cv));
+  pthread_mutex_unlock(&(c->lock));
+  /* The writer finishes whatever is pending before it exits */
+  pthread_join(c->thread, NULL);
+  int rc = c->rc;
+  pthread_cond_destroy(&(c->cv));
+  pthread_mutex_destroy(&(c->lock));
+  free(c->path);
+  free(c->tmp_path);
+  free(c->buffers[0]);
+  free(c->buffers[1]);
+  free(c);
+  return rc;
+}
+
+static void *_writer_func(void *the_checkpointer) {
+  checkpointer *c = (checkpointer *) the_checkpointer;
+  pthread_mutex_lock(&(c->lock));
+  while (1) {
+    while (c->pending == -1 && !c->stopping) {
+      pthread_cond_wait(&(c->cv), &(c->lock));
+    }
+    if (c->pending == -1) {
+      break;
+    }
+    c->writing = c->pending;
+    c->pending = -1;
+    pthread_mutex_unlock(&(c->lock));
+    int rc = _write(c, c->buffers[c->writing]);
+    pthread_mutex_lock(&(c->lock));
+    c->rc = rc;
+    c->writing = -1;
+    pthread_cond_broadcast(&(c->cv));
+  }
+  pthread_mutex_unlock(&(c->lock));
+  return NULL;
+}
+
+static int _write(checkpointer *c, const double *params) {
+  FILE *f = fopen(c->tmp_path, "wb");
+  if (!f) {
+    perror(c->tmp_path);
+    return 0;
+  }
+  int ok = neuralnet_save_params(c->net, params, f);
+  /* Make sure it's really on disk before it replaces the old one */
+  ok = ok && !fflush(f) && !fsync(fileno(f));
+  ok &= !fclose(f);
+  if (!ok) {
+    perror(c->tmp_path);
+    remove(c->tmp_path);
+    return 0;
+  }
+  if (rename(c->tmp_path, c->path)) {
+    perror(c->path);
+    remove(c->tmp_path);
+    return 0;
+  }
+  return _sync_dir(c->path);
+}
+
+static int _sync_dir(const char *path) {
+  const char *slash = strrchr(path, '/');
+  char *dir;
+  if (!slash) {
+    dir = strdup(".");
+  } else if (slash == path) {
+    dir = strdup("/");
+  } else {
+    dir = strndup(path, slash - path);
+  }
+  if (!dir) {
+    perror("checkpointer");
+    return 0;
+  }
+  int fd = open(dir, O_RDONLY);
+  int ok = fd != -1 && !fsync(fd);
+  if (!ok) {
+    perror(dir);
+  }
+  if (fd != -1) {
+    close(fd);
+  }
+  free(dir);
+  return ok;
+}
@@ -0,0 +1,92 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "dataparallel.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+int dataparallel_sync(neuralnet *net, transport *t) {
+  int count = neuralnet_param_count(net);
+  double *params = malloc(sizeof(double) * count);
+  if (!params) {
+    perror("dataparallel_sync");
+    return 0;
+  }
+  neuralnet_get_params(net, params);
+  if (!transport_allreduce(t, params, count)) {
+    free(params);
+    return 0;
+  }
+  for (int i = 0; i < count; i++) {
+    params[i] /= t->size;
+  }
+  int ok = neuralnet_set_params(net, params);
+  free(params);
+  return ok;
+}
+
+int dataparallel_train(neuralnet *net, transport *t, const double *inputs,
+                       const double *labels, int input_count,
+                       int sync_every) {
+  if (sync_every <= 0) {
+    fprintf(stderr, "dataparallel_train: sync_every must be positive\n");
+    return 0;
+  }
+  /* The shards might not be the same size, so find out how many rounds the
+   * biggest one needs: everyone writes their count into their own spot and
+   * the all-reduce hands us all of them. */
+  double *rounds = calloc(t->size, sizeof(double));
+  if (!rounds) {
+    perror("dataparallel_train");
+    return 0;
+  }
+  rounds[t->rank] = (input_count + sync_every - 1) / sync_every;
+  if (!transport_allreduce(t, rounds, t->size)) {
+    free(rounds);
+    return 0;
+  }
+  int max_rounds = 0;
+  for (int r = 0; r < t->size; r++) {
+    if (rounds[r] > max_rounds) {
+      max_rounds = (int) rounds[r];
+    }
+  }
+  free(rounds);
+  /* Make sure we all start from the same place */
+  if (!dataparallel_sync(net, t)) {
+    return 0;
+  }
+  int in_dim = neuralnet_input_size(net);
+  int out_dim = neuralnet_output_size(net);
+  int rc = 1;
+  for (int round = 0; round < max_rounds; round++) {
+    int start = round * sync_every;
+    int count = input_count - start;
+    if (count > sync_every) {
+      count = sync_every;
+    }
+    /* Processes that have run out of data still have to show up to the
+     * average, they just bring their weights as they are */
+    if (count > 0) {
+      rc &= neuralnet_train(net, &(inputs[start * in_dim]),
+                            &(labels[start * out_dim]), count);
+    }
+    if (!dataparallel_sync(net, t)) {
+      return 0;
+    }
+  }
+  return rc;
+}
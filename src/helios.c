@@ -14,7 +14,440 @@
  * You should have received a copy of the GNU General Public License
  * along with helios.  If not, see <http://www.gnu.org/licenses/>.
  */
+#define _POSIX_C_SOURCE 200809L
+#include "neuralnet.h"
+#include "activations.h"
+#include "sweep.h"
+#include "tuner.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* The most values any one sweep option can list */
+#define SWEEP_MAX_VALUES 16
+
+/* The most layers a swept net can have */
+#define SWEEP_MAX_LAYERS 16
+
+/**
+ * Print out how to use us.
+ */
+static void _usage(FILE *stream);
+
+/**
+ * The export subcommand: compile a saved model into C source.
+ * helios export <model> <output.c> [prefix]
+ */
+static int _export(int argc, char **argv);
+
+/**
+ * The sweep subcommand: train every combination of the options given on a
+ * dataset and report how they did.
+ * helios sweep <data> <inputs> [options]
+ */
+static int _sweep(int argc, char **argv);
+
+/**
+ * The tune subcommand: work out how to split up each layer of a net on
+ * this machine and add it to a tuning cache.
+ * helios tune <cache> <inputs> <layers> [threads] [batch]
+ */
+static int _tune(int argc, char **argv);
+
+/**
+ * Read a dataset with one example per line: its inputs, then its labels,
+ * as numbers separated by commas or whitespace. Every line has to have
+ * the same number of them.
+ */
+static int _read_data(const char *path, int in_dim, double **inputs,
+                      double **labels, int *count, int *out_dim);
+
+/**
+ * Split a comma separated list of numbers.
+ * @return how many there were, or 0 if it wasn't a list of at most max.
+ */
+static int _parse_list(const char *list, double *values, int max);
 
 int main(int argc, char **argv) {
-  return 0;
+  if (argc < 2) {
+    _usage(stderr);
+    return EXIT_FAILURE;
+  }
+  if (!strcmp(argv[1], "export")) {
+    return _export(argc - 2, argv + 2);
+  }
+  if (!strcmp(argv[1], "sweep")) {
+    return _sweep(argc - 2, argv + 2);
+  }
+  if (!strcmp(argv[1], "tune")) {
+    return _tune(argc - 2, argv + 2);
+  }
+  if (!strcmp(argv[1], "help")) {
+    _usage(stdout);
+    return EXIT_SUCCESS;
+  }
+  _usage(stderr);
+  return EXIT_FAILURE;
+}
+
+static void _usage(FILE *stream) {
+  fprintf(stream, "Usage: helios <command> [args]\n\n");
+  fprintf(stream, "Commands:\n");
+  fprintf(stream, "  export <model> <output.c> [prefix]  Compile a saved model "
+                  "into C source\n");
+  fprintf(stream, "  sweep <data> <inputs> [options]     Try out "
+                  "hyperparameters on a dataset\n");
+  fprintf(stream, "  tune <cache> <inputs> <layers> [threads] [batch]\n");
+  fprintf(stream, "                                      Tune a net's layers "
+                  "for this machine, eg\n");
+  fprintf(stream, "                                      layers 8x4x1 "
+                  "(threads: cores, batch: 1)\n");
+  fprintf(stream, "  help                                Show this message\n");
+  fprintf(stream, "\nSweep options (lists are comma separated):\n");
+  fprintf(stream, "  -a <alphas>       Learning rates (0.1)\n");
+  fprintf(stream, "  -s <iscales>      Input scales (1)\n");
+  fprintf(stream, "  -f <activations>  Activations by name (sigmoid)\n");
+  fprintf(stream, "  -l <layers>       Hidden layers, eg 4,8x4 (none)\n");
+  fprintf(stream, "  -e <epochs>       Most epochs to train for (100)\n");
+  fprintf(stream, "  -b <batch>        Batch size (1)\n");
+  fprintf(stream, "  -r <epochs>       Epochs between cuts (10)\n");
+  fprintf(stream, "  -k <fraction>     Fraction kept at each cut (0.5)\n");
+  fprintf(stream, "  -j <workers>      Nets trained at once (cores)\n");
+}
+
+static int _export(int argc, char **argv) {
+  if (argc < 2 || argc > 3) {
+    _usage(stderr);
+    return EXIT_FAILURE;
+  }
+  const char *prefix = argc == 3 ? argv[2] : "model";
+  FILE *in = fopen(argv[0], "rb");
+  if (!in) {
+    perror(argv[0]);
+    return EXIT_FAILURE;
+  }
+  neuralnet *net;
+  /* We're not gonna run the net, so it needs no pool */
+  int ok = neuralnet_load(&net, in, 0);
+  fclose(in);
+  if (!ok) {
+    return EXIT_FAILURE;
+  }
+  FILE *out = fopen(argv[1], "w");
+  if (!out) {
+    perror(argv[1]);
+    neuralnet_destroy(net);
+    return EXIT_FAILURE;
+  }
+  ok = neuralnet_export_c(net, out, prefix);
+  ok &= !fclose(out);
+  neuralnet_destroy(net);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int _sweep(int argc, char **argv) {
+  if (argc < 2 || argc % 2) {
+    _usage(stderr);
+    return EXIT_FAILURE;
+  }
+  int in_dim = atoi(argv[1]);
+  if (in_dim <= 0) {
+    fprintf(stderr, "helios sweep: bad input count %s\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  double alphas[SWEEP_MAX_VALUES] = { 0.1 };
+  double iscales[SWEEP_MAX_VALUES] = { 1 };
+  int alpha_count = 1;
+  int iscale_count = 1;
+  const activation_info *acts[SWEEP_MAX_VALUES];
+  acts[0] = activation_find_name("sigmoid");
+  int act_count = 1;
+  /* Each shape is its hidden layer sizes, the output layer comes later */
+  int shapes[SWEEP_MAX_VALUES][SWEEP_MAX_LAYERS];
+  int shape_layers[SWEEP_MAX_VALUES] = { 0 };
+  int shape_count = 1;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  sweepconfig config = { 0 };
+  config.epochs = 100;
+  config.batch_size = 1;
+  config.rung_epochs = 10;
+  config.keep = 0.5;
+  config.threads = cores > 0 ? (int) cores : 1;
+  for (int i = 2; i < argc; i += 2) {
+    const char *opt = argv[i];
+    char *value = argv[i + 1];
+    int ok = 1;
+    if (!strcmp(opt, "-a")) {
+      ok = alpha_count = _parse_list(value, alphas, SWEEP_MAX_VALUES);
+    } else if (!strcmp(opt, "-s")) {
+      ok = iscale_count = _parse_list(value, iscales, SWEEP_MAX_VALUES);
+    } else if (!strcmp(opt, "-f")) {
+      act_count = 0;
+      for (char *name = strtok(value, ","); name && ok;
+           name = strtok(NULL, ",")) {
+        ok = act_count < SWEEP_MAX_VALUES &&
+             (acts[act_count++] = activation_find_name(name));
+      }
+    } else if (!strcmp(opt, "-l")) {
+      /* strtok can't nest, so split the shapes by hand */
+      shape_count = 0;
+      for (char *shape = value; shape && ok; ) {
+        char *end = strchr(shape, ',');
+        if (end) {
+          *end = '\0';
+        }
+        ok = shape_count < SWEEP_MAX_VALUES;
+        int layers = 0;
+        for (char *size = shape; ok && *size; ) {
+          char *next;
+          long width = strtol(size, &next, 10);
+          ok = width > 0 && next != size && layers < SWEEP_MAX_LAYERS - 1 &&
+               (*next == 'x' || !*next);
+          if (ok) {
+            shapes[shape_count][layers++] = (int) width;
+            size = *next ? next + 1 : next;
+          }
+        }
+        shape_layers[shape_count++] = layers;
+        shape = end ? end + 1 : NULL;
+      }
+    } else if (!strcmp(opt, "-e")) {
+      config.epochs = atoi(value);
+    } else if (!strcmp(opt, "-b")) {
+      config.batch_size = atoi(value);
+    } else if (!strcmp(opt, "-r")) {
+      config.rung_epochs = atoi(value);
+    } else if (!strcmp(opt, "-k")) {
+      config.keep = atof(value);
+    } else if (!strcmp(opt, "-j")) {
+      config.threads = atoi(value);
+    } else {
+      ok = 0;
+    }
+    if (!ok) {
+      fprintf(stderr, "helios sweep: bad option %s %s\n", opt, argv[i + 1]);
+      return EXIT_FAILURE;
+    }
+  }
+  double *inputs;
+  double *labels;
+  int count;
+  int out_dim;
+  if (!_read_data(argv[0], in_dim, &inputs, &labels, &count, &out_dim)) {
+    return EXIT_FAILURE;
+  }
+  int total = alpha_count * iscale_count * act_count * shape_count;
+  netconfig *configs = calloc(total, sizeof(netconfig));
+  sweepresult *results = malloc(sizeof(sweepresult) * total);
+  int (*sizes)[SWEEP_MAX_LAYERS] = malloc(sizeof(*sizes) * shape_count);
+  if (!configs || !results || !sizes) {
+    perror("helios sweep");
+    free(configs);
+    free(results);
+    free(sizes);
+    free(inputs);
+    free(labels);
+    return EXIT_FAILURE;
+  }
+  for (int sh = 0; sh < shape_count; sh++) {
+    memcpy(sizes[sh], shapes[sh], sizeof(int) * shape_layers[sh]);
+    sizes[sh][shape_layers[sh]] = out_dim;
+  }
+  int c = 0;
+  for (int sh = 0; sh < shape_count; sh++) {
+    int max_width = in_dim > out_dim ? in_dim : out_dim;
+    for (int l = 0; l < shape_layers[sh]; l++) {
+      if (sizes[sh][l] > max_width) {
+        max_width = sizes[sh][l];
+      }
+    }
+    for (int f = 0; f < act_count; f++) {
+      for (int a = 0; a < alpha_count; a++) {
+        for (int is = 0; is < iscale_count; is++) {
+          netconfig *conf = &(configs[c++]);
+          conf->layers = shape_layers[sh] + 1;
+          conf->layer_sizes = sizes[sh];
+          conf->dimensionality = in_dim;
+          conf->activation = acts[f]->func;
+          conf->activation_prime = acts[f]->prime;
+          conf->alpha = alphas[a];
+          conf->iscale = iscales[is];
+          conf->max_width = max_width;
+          conf->seed = 1;
+        }
+      }
+    }
+  }
+  int ok = sweep_run(configs, total, inputs, labels, count, config, results);
+  if (ok) {
+    sweep_report(configs, total, results, stdout);
+  }
+  free(sizes);
+  free(results);
+  free(configs);
+  free(inputs);
+  free(labels);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int _tune(int argc, char **argv) {
+  if (argc < 3 || argc > 5) {
+    _usage(stderr);
+    return EXIT_FAILURE;
+  }
+  int sizes[SWEEP_MAX_LAYERS];
+  int layers = 0;
+  int max_width = atoi(argv[1]);
+  for (char *size = argv[2]; *size; ) {
+    char *next;
+    long width = strtol(size, &next, 10);
+    if (width <= 0 || next == size || layers == SWEEP_MAX_LAYERS ||
+        (*next && *next != 'x')) {
+      fprintf(stderr, "helios tune: bad layers %s\n", argv[2]);
+      return EXIT_FAILURE;
+    }
+    sizes[layers++] = (int) width;
+    if (width > max_width) {
+      max_width = (int) width;
+    }
+    size = *next ? next + 1 : next;
+  }
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  netconfig config = { 0 };
+  config.layers = layers;
+  config.layer_sizes = sizes;
+  config.dimensionality = atoi(argv[1]);
+  config.activation = sigmoid;
+  config.activation_prime = sigmoid_prime;
+  config.threads = argc > 3 ? atoi(argv[3]) : (cores > 0 ? (int) cores : 1);
+  config.alpha = 0.1;
+  config.iscale = 1;
+  config.max_width = max_width;
+  int batch_size = argc > 4 ? atoi(argv[4]) : 1;
+  if (!layers || config.dimensionality <= 0 || config.threads <= 0) {
+    _usage(stderr);
+    return EXIT_FAILURE;
+  }
+  int plan[SWEEP_MAX_LAYERS];
+  /* Asking means we want it worked out again, whatever's in the cache */
+  if (!tuner_tune(config, batch_size, plan) ||
+      !tuner_store(argv[0], &config, batch_size, plan)) {
+    return EXIT_FAILURE;
+  }
+  printf("%-6s %-6s %s\n", "layer", "width", "jobs");
+  for (int layer = 0; layer < layers; layer++) {
+    printf("%-6d %-6d %d\n", layer, sizes[layer], plan[layer]);
+  }
+  return EXIT_SUCCESS;
+}
+
+static int _read_data(const char *path, int in_dim, double **inputs,
+                      double **labels, int *count, int *out_dim) {
+  FILE *in = fopen(path, "r");
+  if (!in) {
+    perror(path);
+    return 0;
+  }
+  char *line = NULL;
+  size_t line_size = 0;
+  double *values = NULL;
+  int capacity = 0;
+  int total = 0;
+  int width = 0;
+  int rows = 0;
+  int ok = 1;
+  while (ok && getline(&line, &line_size, in) != -1) {
+    int row = 0;
+    char *cur = line;
+    for (;;) {
+      while (*cur == ',' || *cur == ' ' || *cur == '\t' || *cur == '\n' ||
+             *cur == '\r') {
+        cur++;
+      }
+      if (!*cur) {
+        break;
+      }
+      char *end;
+      double value = strtod(cur, &end);
+      if (end == cur) {
+        fprintf(stderr, "%s:%d: not a number\n", path, rows + 1);
+        ok = 0;
+        break;
+      }
+      if (total == capacity) {
+        capacity = capacity ? capacity * 2 : 1024;
+        double *grown = realloc(values, sizeof(double) * capacity);
+        if (!grown) {
+          perror(path);
+          ok = 0;
+          break;
+        }
+        values = grown;
+      }
+      values[total++] = value;
+      row++;
+      cur = end;
+    }
+    /* Blank lines don't count */
+    if (!ok || !row) {
+      continue;
+    }
+    if (!width) {
+      width = row;
+    }
+    if (row <= in_dim) {
+      fprintf(stderr, "%s:%d: no labels after the %d inputs\n", path,
+              rows + 1, in_dim);
+      ok = 0;
+    } else if (row != width) {
+      fprintf(stderr, "%s:%d: expected %d numbers, got %d\n", path,
+              rows + 1, width, row);
+      ok = 0;
+    }
+    rows++;
+  }
+  free(line);
+  fclose(in);
+  if (ok && !rows) {
+    fprintf(stderr, "%s: no examples\n", path);
+    ok = 0;
+  }
+  if (ok) {
+    *out_dim = width - in_dim;
+    *inputs = malloc(sizeof(double) * rows * in_dim);
+    *labels = malloc(sizeof(double) * rows * *out_dim);
+    if (!*inputs || !*labels) {
+      perror(path);
+      free(*inputs);
+      free(*labels);
+      ok = 0;
+    }
+  }
+  if (ok) {
+    for (int r = 0; r < rows; r++) {
+      memcpy(&((*inputs)[r * in_dim]), &(values[r * width]),
+             sizeof(double) * in_dim);
+      memcpy(&((*labels)[r * *out_dim]), &(values[r * width + in_dim]),
+             sizeof(double) * *out_dim);
+    }
+    *count = rows;
+  }
+  free(values);
+  return ok;
+}
+
+static int _parse_list(const char *list, double *values, int max) {
+  int count = 0;
+  const char *cur = list;
+  while (*cur) {
+    char *end;
+    double value = strtod(cur, &end);
+    if (end == cur || count == max || (*end && *end != ',')) {
+      return 0;
+    }
+    values[count++] = value;
+    cur = *end ? end + 1 : end;
+  }
+  return count;
 }
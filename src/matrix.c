@@ -0,0 +1,217 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "matrix.h"
+#include <math.h>
+
+/**
+ * How many rows of C to do at a time.
+ */
+#define BLOCK_M 32
+
+/**
+ * How many columns of C to do at a time.
+ */
+#define BLOCK_N 256
+
+/**
+ * How much of the shared dimension to do at a time.
+ */
+#define BLOCK_K 128
+
+/**
+ * Get element (row, col) of op(X), for X with leading dimension ld.
+ */
+#define OP(x, ld, trans, row, col) \
+  ((trans) ? (x)[(col) * (ld) + (row)] : (x)[(row) * (ld) + (col)])
+
+/**
+ * Get the smaller of a and b.
+ */
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/**
+ * The most sweeps over every pair of columns the SVD makes.
+ */
+#define SVD_SWEEPS 60
+
+/**
+ * How close to orthogonal two columns have to be, relative to their
+ * lengths, for the SVD to leave them be.
+ */
+#define SVD_EPSILON 1e-15
+
+/**
+ * How short a column can get, relative to the whole of A, before the SVD
+ * counts it as zero. A's got at least n - m of these if it's wider than
+ * it's tall, and rounding never leaves them orthogonal to anything.
+ */
+#define SVD_NEGLIGIBLE 1e-30
+
+/**
+ * Swap columns p and q of X, which has the rows and leading dimension
+ * given.
+ */
+static void _swap_columns(double *x, int rows, int ld, int p, int q);
+
+void matrix_gemm(int trans_a, int trans_b, int m, int n, int k, double alpha,
+                 const double *a, int lda, const double *b, int ldb,
+                 double beta, double *c, int ldc) {
+  for (int i = 0; i < m; i++) {
+    double *row = &(c[i * ldc]);
+    if (beta == 0) {
+      /* Don't let whatever garbage was in there through, even as 0 * NaN */
+      for (int j = 0; j < n; j++) {
+        row[j] = 0;
+      }
+    } else if (beta != 1) {
+      for (int j = 0; j < n; j++) {
+        row[j] *= beta;
+      }
+    }
+  }
+  if (trans_b) {
+    /* Rows of op(B) are strided, so go down columns of C instead: every
+     * entry is then a dot product of two rows, which is contiguous at
+     * least for untransposed A */
+    for (int i0 = 0; i0 < m; i0 += BLOCK_M) {
+      for (int j0 = 0; j0 < n; j0 += BLOCK_M) {
+        for (int i = i0; i < MIN(i0 + BLOCK_M, m); i++) {
+          for (int j = j0; j < MIN(j0 + BLOCK_M, n); j++) {
+            double acc = 0;
+            for (int p = 0; p < k; p++) {
+              acc += OP(a, lda, trans_a, i, p) * b[j * ldb + p];
+            }
+            c[i * ldc + j] += alpha * acc;
+          }
+        }
+      }
+    }
+    return;
+  }
+  /* Every entry of C still gets its terms added in order of p, the blocks
+   * just keep the rows of B we're streaming through in cache */
+  for (int i0 = 0; i0 < m; i0 += BLOCK_M) {
+    for (int p0 = 0; p0 < k; p0 += BLOCK_K) {
+      for (int j0 = 0; j0 < n; j0 += BLOCK_N) {
+        int j1 = MIN(j0 + BLOCK_N, n);
+        for (int i = i0; i < MIN(i0 + BLOCK_M, m); i++) {
+          double *row = &(c[i * ldc]);
+          for (int p = p0; p < MIN(p0 + BLOCK_K, k); p++) {
+            double scaled = alpha * OP(a, lda, trans_a, i, p);
+            /* Gradients are mostly zeros after max pooling */
+            if (scaled == 0) {
+              continue;
+            }
+            const double *brow = &(b[p * ldb]);
+            for (int j = j0; j < j1; j++) {
+              row[j] += scaled * brow[j];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+int matrix_svd(int m, int n, double *a, int lda, double *s, double *v,
+               int ldv) {
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      v[i * ldv + j] = i == j;
+    }
+  }
+  double total = 0;
+  for (int i = 0; i < m; i++) {
+    for (int j = 0; j < n; j++) {
+      total += a[i * lda + j] * a[i * lda + j];
+    }
+  }
+  double negligible = SVD_NEGLIGIBLE * total;
+  int converged = 0;
+  for (int sweep = 0; sweep < SVD_SWEEPS && !converged; sweep++) {
+    converged = 1;
+    for (int p = 0; p < n - 1; p++) {
+      for (int q = p + 1; q < n; q++) {
+        double alpha = 0;
+        double beta = 0;
+        double gamma = 0;
+        for (int i = 0; i < m; i++) {
+          double ap = a[i * lda + p];
+          double aq = a[i * lda + q];
+          alpha += ap * ap;
+          beta += aq * aq;
+          gamma += ap * aq;
+        }
+        if (alpha <= negligible || beta <= negligible ||
+            fabs(gamma) <= SVD_EPSILON * sqrt(alpha * beta)) {
+          continue;
+        }
+        converged = 0;
+        /* The rotation that makes columns p and q orthogonal */
+        double zeta = (beta - alpha) / (2 * gamma);
+        double t = (zeta >= 0 ? 1 : -1) / (fabs(zeta) + sqrt(1 + zeta * zeta));
+        double c = 1 / sqrt(1 + t * t);
+        double sn = c * t;
+        for (int i = 0; i < m; i++) {
+          double ap = a[i * lda + p];
+          double aq = a[i * lda + q];
+          a[i * lda + p] = c * ap - sn * aq;
+          a[i * lda + q] = sn * ap + c * aq;
+        }
+        for (int i = 0; i < n; i++) {
+          double vp = v[i * ldv + p];
+          double vq = v[i * ldv + q];
+          v[i * ldv + p] = c * vp - sn * vq;
+          v[i * ldv + q] = sn * vp + c * vq;
+        }
+      }
+    }
+  }
+  for (int j = 0; j < n; j++) {
+    double norm = 0;
+    for (int i = 0; i < m; i++) {
+      norm += a[i * lda + j] * a[i * lda + j];
+    }
+    s[j] = sqrt(norm);
+  }
+  /* Selection sort, biggest first; n is a layer width, this is nothing
+   * next to the sweeps */
+  for (int j = 0; j < n - 1; j++) {
+    int best = j;
+    for (int k = j + 1; k < n; k++) {
+      if (s[k] > s[best]) {
+        best = k;
+      }
+    }
+    if (best != j) {
+      double tmp = s[j];
+      s[j] = s[best];
+      s[best] = tmp;
+      _swap_columns(a, m, lda, j, best);
+      _swap_columns(v, n, ldv, j, best);
+    }
+  }
+  return converged;
+}
+
+static void _swap_columns(double *x, int rows, int ld, int p, int q) {
+  for (int i = 0; i < rows; i++) {
+    double tmp = x[i * ld + p];
+    x[i * ld + p] = x[i * ld + q];
+    x[i * ld + q] = tmp;
+  }
+}
@@ -16,9 +16,86 @@
  */
 #include "threadpool.h"
 #include "neuralnet.h"
+#include "activations.h"
+#include "matrix.h"
+#include "rng.h"
+#include "trace.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+
+/**
+ * The magic string at the start of every saved model.
+ */
+#define MODEL_MAGIC "HELIOSNN"
+
+/**
+ * The version of the model format we write.
+ */
+#define MODEL_VERSION 1
+
+/**
+ * The version of the model format we write for nets with conv layers. It
+ * adds every layer's conv spec after the layer sizes.
+ */
+#define MODEL_VERSION_CONV 2
+
+/**
+ * The version of the model format we write for nets with factored layers.
+ * It has every layer's conv spec like version 2 does, and each layer's
+ * weights start with its rank: 0 for a dense layer, whose weights follow
+ * as usual, or the rank of a factored one, whose factors and biases follow
+ * instead.
+ */
+#define MODEL_VERSION_LOWRANK 3
+
+/**
+ * How many ints a conv spec takes up in a saved model.
+ */
+#define MODEL_CONV_INTS 8
+
+/**
+ * How long the activation name in a saved model can be, including the NUL.
+ */
+#define MODEL_ACTIVATION_LEN 32
+
+/**
+ * Layers with at most this many weights per neuron get their dot products
+ * fully unrolled when exported to C. Wider ones get unrolled by 4.
+ */
+#define EXPORT_UNROLL_MAX 8
+
+/**
+ * How many samples each pipeline stage can have in flight, on average.
+ */
+#define PIPELINE_SLOTS_PER_STAGE 2
+
+/**
+ * How many times to spin on an empty (or full) pipeline ring before we start
+ * yielding the processor.
+ */
+#define PIPELINE_SPINS 64
+
+/**
+ * The size of a cache line, so the ends of a pipeline ring don't share one.
+ */
+#define CACHE_LINE 64
+
+/**
+ * How close to 0 or 1 we let an output get when we take its log for the
+ * cross entropy, so a confidently wrong output doesn't make it infinite.
+ */
+#define EVAL_EPSILON 1e-12
+
+/**
+ * Mixed into the seed to get the stream the output samples come from, so
+ * they don't follow the initial weights around.
+ */
+#define SAMPLE_STREAM 0x73616d706c65ULL
 
 /**
  * Get the weight by indexing into the weight table given.
@@ -37,6 +114,26 @@
  */
 static int _init_layer_params(neuralnet *net);
 
+/**
+ * Run the jobs given like threadpool_submit does, on the net's pool, or
+ * one after the other on the calling thread if it hasn't got one or there's
+ * only the one job.
+ */
+static void _submit(neuralnet *net, unsigned char *retvals,
+                    void (*mapper)(void *, void *), unsigned char *arguments,
+                    size_t arg_size, int arg_count, size_t retval_size);
+
+/**
+ * Destroy the net's pool, if it has one of its own.
+ */
+static int _destroy_pool(neuralnet *net);
+
+/**
+ * Load a net saved with neuralnet_save, reporting errors as who.
+ */
+static int _load(neuralnet **retval, FILE *stream, threadpool *pool,
+                 int threads, int inference_only, const char *who);
+
 /**
  * Do one single feed forward pass on the network
  */
@@ -44,9 +141,11 @@ static void _feed_forward(neuralnet *net, const double *inputs);
 
 /**
  * Do one single backpropagate on the network, adjusting stuff as we go.
+ * If losses isn't NULL, it gets each job's share of the squared error at
+ * the output layer.
  */
 static void _back_propagate(neuralnet *net, const double *inputs,
-                            const double *labels);
+                            const double *labels, double *losses);
 
 /**
  * The worker for the feedforward pass.
@@ -55,7 +154,8 @@ static void _ff_worker(void *in, void *out);
 
 /**
  * The worker for the first backpropagate iteration, that deals with the
- * output layer
+ * output layer. Returns the squared error over its neurons, as a double,
+ * if out isn't NULL.
  */
 static void _output_bp_worker(void *in, void *out);
 
@@ -64,6 +164,213 @@ static void _output_bp_worker(void *in, void *out);
  */
 static void _bp_worker(void *in, void *out);
 
+/**
+ * Pick the output neurons to train on the labels given, when the net
+ * samples its outputs, and hand them out to the layers' jobs.
+ * @param samples room for an int per output
+ * @param marks a char per output, all 0, which are left that way
+ * @return how many outputs were picked
+ */
+static int _sample_outputs(neuralnet *net, const double *labels,
+                            int *samples, char *marks);
+
+/**
+ * Go back to working out every output.
+ */
+static void _stop_sampling(neuralnet *net);
+
+/**
+ * Compare two ints, for qsort.
+ */
+static int _compare_ints(const void *a, const void *b);
+
+/**
+ * How many inputs the layer given has.
+ */
+static int _layer_inputs(const netconfig *config, int layer);
+
+/**
+ * Is the layer given convolutional?
+ */
+static int _is_conv(const netconfig *config, int layer);
+
+/**
+ * How many rows of weights (neurons, or filters for a conv layer) the layer
+ * given has.
+ */
+static int _layer_rows(const netconfig *config, int layer);
+
+/**
+ * How many weights (excluding the bias) each row of the layer given has.
+ */
+static int _layer_weights(const netconfig *config, int layer);
+
+/**
+ * Roughly how many multiply-adds feeding an input forward through the
+ * layer given takes.
+ */
+static double _layer_cost(const netconfig *config, int layer);
+
+/**
+ * Make sure the conv layers in the config given make sense.
+ */
+static int _check_conv(const netconfig *config);
+
+/**
+ * Write out the header of a saved model (everything but the weights).
+ * @param lowrank whether to write the format with factored layers in it
+ */
+static int _save_header(neuralnet *net, FILE *stream, int lowrank);
+
+/**
+ * Write out the conv specs of a saved model, if it has any or they're
+ * wanted anyway.
+ */
+static int _save_conv(neuralnet *net, FILE *stream, int always);
+
+/**
+ * Write out a layer's rank, followed by its factors and biases if it's
+ * factored.
+ */
+static int _save_lowrank(neuralnet *net, int layer, FILE *stream);
+
+/**
+ * Read back what _save_lowrank wrote for a layer, complaining as who if
+ * it's wrong.
+ */
+static int _load_lowrank(neuralnet *net, int layer, FILE *stream,
+                         const char *who);
+
+/**
+ * Write out the statements adding up the dot product of weights w[from, to)
+ * with the inputs given into acc, for neuralnet_export_c.
+ */
+static void _export_dot(FILE *stream, const char *inputs, int from, int to);
+
+/**
+ * The shape and buffers of a convolutional layer.
+ */
+typedef struct _conv_layer {
+  const conv_spec *spec; /* The spec, or NULL if the layer is dense */
+  int stride; /* The stride, with the default filled in */
+  int pool; /* The side of the pooling windows, with the default filled in */
+  int conv_h; /* The height of the convolution, before pooling */
+  int conv_w; /* The width of the convolution, before pooling */
+  int out_h; /* The height of the outputs, after pooling */
+  int out_w; /* The width of the outputs, after pooling */
+  int cols; /* How many weights each filter has (channels * kernel^2) */
+  int positions; /* How many filter positions we work out: every one in
+                  * the rows the pooling windows cover */
+  double *col; /* The last training input, im2col'd: cols x positions */
+  double *pre; /* The activated convolution before pooling:
+               * filters x positions */
+  int *argmax; /* Which position each output was pooled from */
+  double *dconv; /* The error derivatives at each filter position */
+  double *dcol; /* The error derivatives at each entry of col */
+  double *errors; /* The errors at the layer's inputs, for the one before */
+} conv_layer;
+
+/**
+ * Work out the shape of the conv layer given from its spec.
+ */
+static void _conv_shape(const conv_spec *spec, conv_layer *conv);
+
+/**
+ * Fill in the shapes and allocate the buffers of the net's conv layers.
+ */
+static int _init_conv(neuralnet *net);
+
+/**
+ * Free the net's conv layers.
+ */
+static void _free_conv(neuralnet *net);
+
+/**
+ * A dense layer whose weights have been replaced by a low rank
+ * factorization, W ~= A * B, so feeding forward through it takes two thin
+ * products instead of one fat one. The dense weights get freed, so the
+ * biases live here too.
+ */
+typedef struct _lowrank_layer {
+  int rank; /* The rank, or 0 if the layer isn't factored */
+  double *a; /* A: rank weights per neuron */
+  double *b; /* B: a weight per input for each of the rank rows */
+  double *bias; /* A bias per neuron */
+  double *h; /* B times the layer's inputs, shared by the pool's jobs */
+} lowrank_layer;
+
+/**
+ * Work out the SVD of a dense layer's weights (W = US * V^T), complaining
+ * as who if it can't.
+ * @param us where to allocate US, a row of inputs doubles per neuron
+ * @param s where to allocate the singular values, inputs of them
+ * @param v where to allocate V, a row of inputs doubles per input
+ */
+static int _layer_svd(neuralnet *net, int layer, double **us, double **s,
+                      double **v, const char *who);
+
+/**
+ * Factor a layer at the rank given from its SVD, keeping its biases. Any
+ * dense weights it has are left as they are.
+ */
+static int _set_lowrank(neuralnet *net, int layer, int rank,
+                        const double *us, const double *v, const char *who);
+
+/**
+ * Run a layer with the factors and biases given, which the net takes over
+ * (and frees, if this fails). Any dense weights it has are left as they
+ * are, until _pack_weights frees them.
+ */
+static int _use_lowrank(neuralnet *net, int layer, int rank, double *a,
+                        double *b, double *bias, const char *who);
+
+/**
+ * Is the layer given factored?
+ */
+static int _is_factored(const neuralnet *net, int layer);
+
+/**
+ * Where the dense weights of the layer given start, or NULL if it's
+ * factored and has none.
+ */
+static double *_weights_of(neuralnet *net, int layer);
+
+/**
+ * Get a row of the layer given's weights followed by its bias, working it
+ * out from the factors if the layer's factored.
+ * @param row room for the row's weights and its bias
+ */
+static void _dense_row(neuralnet *net, int layer, int neuron, double *row);
+
+/**
+ * Give every layer that isn't factored (or every layer, if all is set)
+ * room for its dense weights in net->w, and free the room the rest had.
+ */
+static int _pack_weights(neuralnet *net, int all, const char *who);
+
+/**
+ * How far off the rank given gets the layer with the singular values
+ * given, relative to the whole.
+ */
+static double _reconstruction(const double *s, int count, int rank);
+
+/**
+ * Check a layer and rank can be factored, complaining as who if not.
+ */
+static int _check_lowrank(neuralnet *net, int layer, int rank,
+                          const char *who);
+
+/**
+ * Go back to running a layer with its dense weights, which it needs to
+ * have (see _pack_weights).
+ */
+static void _drop_lowrank(neuralnet *net, int layer);
+
+/**
+ * Free every layer's factorization, without touching the layer params.
+ */
+static void _free_lowrank(neuralnet *net);
+
 /**
  * A structure containing parameters for each worker for each layer.
  */
@@ -84,55 +391,332 @@ typedef struct _layer_params {
   const double *targets; /* The targets - only if this corresponds to the
                           * last layer */
   double ifactor; /* The input factor for this layer */
+  /* The array form of the activation, or NULL if we don't know it */
+  void (*activation_array)(const double *, double *, int);
+  conv_layer *conv; /* The conv layer, or NULL if this one is dense */
+  int chan_start; /* The first filter to train, inclusive */
+  int chan_end; /* The last filter to train, exclusive */
+  int in_start; /* The first input channel to find the errors of, inclusive */
+  int in_end; /* The last input channel to find the errors of, exclusive */
+  int tile_start; /* The first row of outputs to feed forward, inclusive */
+  int tile_end; /* The last row of outputs to feed forward, exclusive */
+  int jobs; /* How many jobs this layer is split into */
+  lowrank_layer *lowrank; /* The factorization, or NULL if there's none */
+  int rank_start; /* The first row of B to work out, inclusive */
+  int rank_end; /* The last row of B to work out, exclusive */
+  const double *next_errors; /* The errors at our outputs, if the next layer
+                              * is a conv layer and so worked them out */
+  const int *samples; /* The output neurons being trained on, in order, or
+                       * NULL to train every one. Output layer only */
+  int sample_start; /* The first of samples to look at, inclusive */
+  int sample_end; /* The last of samples to look at, exclusive */
+  const int *next_samples; /* The next layer's samples, if it's a sampled
+                            * output layer, or NULL */
+  int next_sample_count; /* How many next_samples there are */
 } layer_params;
 
 struct _neuralnet {
   netconfig config; /* The net's configuration */
   threadpool *pool; /* Our threadpool */
+  int own_pool; /* Whether we created the pool, and so have to destroy it */
   double *w; /* All the weights. See below for indexing */
   double *oldw; /* The old unadjusted weights (for backpropagation) */
   double *derr; /* The error derivatives. */
   double *out; /* All the neuron outputs. */
   layer_params *l_params; /* Array of parameters for layer workers */
+  int *sizes; /* The layer sizes, if we own them (ie we were loaded) */
+  conv_spec *specs; /* The conv specs, if we own them (ie we were loaded) */
+  conv_layer *conv; /* Every layer's conv shape, or NULL if all are dense */
+  int layer_scratch; /* How many doubles of scratch feeding one input
+                      * forward through any one layer needs (only conv
+                      * and factored layers need any) */
+  lowrank_layer *lowrank; /* Every layer's factorization, or NULL if none
+                           * has been factored */
+  int jobs; /* How many jobs each layer is split into: one per thread, or
+             * just one if we have no pool */
+  rng sampler; /* Where the output samples come from */
 };
 
+/**
+ * A lock-free ring of pointers with a single producer and a single consumer,
+ * used to hand samples from one pipeline stage to the next.
+ */
+typedef struct _spsc_ring {
+  void **items; /* The items */
+  unsigned int capacity; /* How many items fit */
+  char pad0[CACHE_LINE]; /* Keep head and tail on different cache lines */
+  unsigned int head; /* The next item to pop; only the consumer writes it */
+  char pad1[CACHE_LINE];
+  unsigned int tail; /* The next item to push; only the producer writes it */
+  char pad2[CACHE_LINE];
+} spsc_ring;
+
+/**
+ * One sample in flight through the pipeline.
+ */
+typedef struct _pipeline_slot {
+  int index; /* Which input this is */
+  const double *input; /* The input */
+  double *out; /* The outputs of every layer but the last for this sample */
+} pipeline_slot;
+
+/**
+ * One stage of the pipeline, which owns a contiguous run of layers.
+ */
+typedef struct _pipeline_stage {
+  neuralnet *net; /* The net */
+  int first; /* The first layer in this stage, inclusive */
+  int last; /* The last layer in this stage, exclusive */
+  spsc_ring *in; /* Where samples come from */
+  spsc_ring *out; /* Where samples go when we're done with them */
+  double *results; /* Where the outputs of the net go */
+  double *scratch; /* Scratch for the stage's conv layers */
+  pthread_t thread; /* The thread running the stage */
+} pipeline_stage;
+
+/**
+ * The parameters for each evaluation worker.
+ */
+typedef struct _eval_params {
+  neuralnet *net; /* The net */
+  const double *inputs; /* All the inputs */
+  const double *labels; /* All the labels */
+  int start; /* The first input to evaluate, inclusive */
+  int end; /* The last input to evaluate, exclusive */
+  double *scratch; /* Scratch for _forward_serial */
+} eval_params;
+
+/**
+ * The running totals of an evaluation worker.
+ */
+typedef struct _eval_totals {
+  double squared_error; /* Sum of the squared errors */
+  double cross_entropy; /* Sum of the cross entropies */
+  int correct; /* How many were classified correctly */
+} eval_totals;
+
+/**
+ * The worker for neuralnet_evaluate. Returns its eval_totals.
+ */
+static void _eval_worker(void *in, void *out);
+
+/**
+ * The parameters for each weight initialization worker.
+ */
+typedef struct _init_params {
+  const layer_params *layer; /* The slice of the layer to initialize */
+  unsigned long long offset; /* Where the layer's first parameter is in the
+                              * order of neuralnet_get_params, which is
+                              * where in the stream its numbers come from */
+  int fan_out; /* How many outputs each of the layer's inputs feeds */
+} init_params;
+
+/**
+ * Initialize the weights of a new net from its seed, spreading the work
+ * out over the thread pool.
+ */
+static int _init_weights(neuralnet *net);
+
+/**
+ * The worker for _init_weights.
+ */
+static void _init_worker(void *in, void *out);
+
+/**
+ * How many doubles of scratch _forward_serial needs.
+ */
+static int _serial_scratch(neuralnet *net);
+
+/**
+ * Feed a single input forward through the whole net on the calling thread,
+ * using the scratch given (_serial_scratch doubles) instead of the net's
+ * outputs and buffers.
+ * @return the outputs of the last layer, somewhere in scratch
+ */
+static const double *_forward_serial(neuralnet *net, const double *input,
+                                     double *scratch);
+
+/**
+ * Feed the inputs given forward through the whole of a layer on the
+ * calling thread.
+ * @param size the layer's size
+ * @param scratch net->layer_scratch doubles, if it's a conv or factored
+ *        layer
+ */
+static void _ff_layer(const layer_params *params, const double *inputs,
+                      double *outputs, int size, double *scratch);
+
+/**
+ * Feed the inputs given forward through neurons [start, end) of the layer
+ * described by params, writing to outputs.
+ */
+static void _ff_neurons(const layer_params *params, const double *inputs,
+                        double *outputs, int start, int end);
+
+/**
+ * Scale neurons [start, end) of a layer's sums, which already have their
+ * biases in, and run them through the activation function.
+ */
+static void _activate(const layer_params *params, double *outputs, int start,
+                      int end);
+
+/**
+ * Work out rows [start, end) of B times the inputs given for a factored
+ * layer, into h.
+ */
+static void _lowrank_project(const layer_params *params, const double *inputs,
+                             double *h, int start, int end);
+
+/**
+ * Feed B times the inputs (h) forward through neurons [start, end) of a
+ * factored layer, writing to outputs.
+ */
+static void _lowrank_neurons(const layer_params *params, const double *h,
+                             double *outputs, int start, int end);
+
+/**
+ * The worker that works out a factored layer's share of B times its inputs.
+ */
+static void _lowrank_worker(void *in, void *out);
+
+/**
+ * Feed the inputs given forward through output rows [start, end) of the
+ * conv layer described by params, writing to outputs.
+ * @param col where to im2col the inputs
+ * @param pre where to put the activated convolution before pooling
+ * @param argmax where to note what each output was pooled from, or NULL
+ */
+static void _conv_forward(const layer_params *params, const double *inputs,
+                          double *outputs, int start, int end, double *col,
+                          double *pre, int *argmax);
+
+/**
+ * Copy columns [start, end) of the im2col matrix of the inputs given into
+ * col.
+ */
+static void _im2col(const conv_layer *conv, const double *inputs,
+                    double *col, int start, int end);
+
+/**
+ * Work out the error at an output neuron and adjust its weights, for
+ * _output_bp_worker.
+ * @return the squared error
+ */
+static double _output_bp_neuron(layer_params *params, int neuron);
+
+/**
+ * Work out the errors at the outputs of the layer described by params,
+ * either from the next layer's error derivatives and old weights, or from
+ * next_errors.
+ */
+static void _bp_errors(layer_params *params);
+
+/**
+ * The worker that back propagates through a conv layer and adjusts its
+ * filters.
+ */
+static void _conv_bp_worker(void *in, void *out);
+
+/**
+ * The worker that works out the errors at a conv layer's inputs, for the
+ * layer before it.
+ */
+static void _conv_errors_worker(void *in, void *out);
+
+/**
+ * Split the net's layers into the stages given, so that each stage does
+ * about the same amount of work.
+ */
+static void _assign_stages(neuralnet *net, pipeline_stage *stages, int count);
+
+/**
+ * The thread running a pipeline stage.
+ */
+static void *_stage_func(void *the_stage);
+
+/**
+ * Push an item onto the ring given, waiting for room if need be.
+ */
+static void _ring_push(spsc_ring *ring, void *item);
+
+/**
+ * Pop an item off the ring given, waiting for one if need be.
+ */
+static void *_ring_pop(spsc_ring *ring);
+
 
 int neuralnet_create(neuralnet **retval, netconfig config) {
+  if (config.init < INIT_UNIFORM || config.init > INIT_HE) {
+    fprintf(stderr, "neuralnet_create: unknown weight init %d\n",
+            (int) config.init);
+    return 0;
+  }
+  if (!_check_conv(&config)) {
+    return 0;
+  }
+  if (config.output_samples < 0) {
+    fprintf(stderr, "neuralnet_create: can't sample %d outputs\n",
+            config.output_samples);
+    return 0;
+  }
+  for (int layer = 0; config.layer_jobs && layer < config.layers; layer++) {
+    if (config.layer_jobs[layer] < 1) {
+      fprintf(stderr, "neuralnet_create: layer %d can't be split into %d "
+                      "jobs\n", layer, config.layer_jobs[layer]);
+      return 0;
+    }
+  }
   neuralnet *net = malloc(sizeof(struct _neuralnet));
   if (!net) {
     perror("neuralnet_create");
     return 0;
   }
   net->config = config;
-  if (!threadpool_create(&(net->pool), net->config.threads)) {
-    perror("neuralnet_create");
-    free(net);
-    return 0;
+  net->sizes = NULL;
+  net->specs = NULL;
+  net->conv = NULL;
+  net->layer_scratch = 0;
+  net->lowrank = NULL;
+  rng_init(&(net->sampler), net->config.seed ^ SAMPLE_STREAM);
+  net->pool = net->config.pool;
+  net->own_pool = 0;
+  net->jobs = net->config.threads ? net->config.threads : 1;
+  if (net->pool) {
+    if (!net->config.threads) {
+      net->jobs = threadpool_size(net->pool);
+    }
+  } else if (net->config.threads) {
+    net->own_pool = 1;
+    if (!threadpool_create(&(net->pool), net->config.threads)) {
+      perror("neuralnet_create");
+      free(net);
+      return 0;
+    }
   }
   net->config.max_width++;
   size_t sz = net->config.max_width * net->config.max_width *
               net->config.layers;
-  net->w = malloc(sizeof(double) * sz);
+  /* calloc so the padding past each neuron's bias is 0; the real weights
+   * are set once the layer params are ready to split the work up. */
+  net->w = calloc(sz, sizeof(double));
   if (!net->w) {
     perror("neuralnet_create");
-    threadpool_destroy(net->pool);
+    _destroy_pool(net);
     free(net);
     return 0;
   }
-  for (int i = 0; i < sz; i++) {
-    net->w[i] = ((double) rand() / (double) RAND_MAX);
-  }
   /* That 2 is to save a bit of memory; after all we only ever need
    * two sets of old error derivatives: the ones for the next layer, to adjust
    * this layer, and an empty array for the ones for this layer so that
    * we can save them as we adjust the layer.
    * See the backpropagation method for how this works in practice.
+   * Nets that don't train don't need any.
    */
-  net->derr = malloc(sizeof(double) * net->config.max_width *
-                     2);
-  if (!net->derr) {
+  net->derr = net->config.inference_only ? NULL :
+              malloc(sizeof(double) * net->config.max_width * 2);
+  if (!net->config.inference_only && !net->derr) {
     perror("neuralnet_create");
-    threadpool_destroy(net->pool);
+    _destroy_pool(net);
     free(net->w);
     free(net);
     return 0;
@@ -141,7 +725,7 @@ int neuralnet_create(neuralnet **retval, netconfig config) {
                     net->config.layers);
   if (!net->out) {
     perror("neuralnet_create");
-    threadpool_destroy(net->pool);
+    _destroy_pool(net);
     free(net->derr);
     free(net->w);
     free(net);
@@ -150,19 +734,45 @@ int neuralnet_create(neuralnet **retval, netconfig config) {
   /* See the above comment about the derr for why we only allocate 2.
    * In this case this also saves us an expensive memcpy before every layer
    */
-  net->oldw = malloc(sizeof(double) * net->config.max_width *
+  net->oldw = net->config.inference_only ? NULL :
+              malloc(sizeof(double) * net->config.max_width *
                      net->config.max_width * 2);
-  if (!net->oldw) {
+  if (!net->config.inference_only && !net->oldw) {
+    perror("neuralnet_create");
+    _destroy_pool(net);
+    free(net->out);
+    free(net->derr);
+    free(net->w);
+    free(net);
+    return 0;
+  }
+  if (!_init_conv(net)) {
     perror("neuralnet_create");
-    threadpool_destroy(net->pool);
+    _free_conv(net);
+    _destroy_pool(net);
     free(net->out);
     free(net->derr);
     free(net->w);
+    free(net->oldw);
     free(net);
+    return 0;
   }
   if(!_init_layer_params(net)) {
     perror("neuralnet_create");
-    threadpool_destroy(net->pool);
+    _free_conv(net);
+    _destroy_pool(net);
+    free(net->out);
+    free(net->derr);
+    free(net->w);
+    free(net->oldw);
+    free(net);
+    return 0;
+  }
+  if (!_init_weights(net)) {
+    perror("neuralnet_create");
+    _free_conv(net);
+    _destroy_pool(net);
+    free(net->l_params);
     free(net->out);
     free(net->derr);
     free(net->w);
@@ -176,11 +786,73 @@ int neuralnet_create(neuralnet **retval, netconfig config) {
 
 int neuralnet_train(neuralnet *net, const double *inputs, const double *labels,
                     int input_count) {
+  return neuralnet_train_stats(net, inputs, labels, input_count, NULL);
+}
+
+int neuralnet_train_stats(neuralnet *net, const double *inputs,
+                          const double *labels, int input_count,
+                          trainstats *stats) {
+  if (net->config.inference_only) {
+    fprintf(stderr, "neuralnet_train: net is inference only\n");
+    return 0;
+  }
+  if (net->lowrank) {
+    fprintf(stderr, "neuralnet_train: net has factored layers\n");
+    return 0;
+  }
   int out_dim = net->config.layer_sizes[net->config.layers - 1];
   int dim = net->config.dimensionality;
-  for (int i = 0; i < input_count; i++) {
-    _feed_forward(net, &(inputs[i * dim]));
-    _back_propagate(net, &(inputs[i * dim]), &(labels[i * out_dim]));
+  double *losses = NULL;
+  if (stats) {
+    losses = malloc(sizeof(double) * net->jobs);
+    if (!losses) {
+      perror("neuralnet_train");
+      return 0;
+    }
+  }
+  int *samples = NULL;
+  char *marks = NULL;
+  if (net->config.output_samples) {
+    samples = malloc(sizeof(int) * out_dim);
+    marks = calloc(out_dim, sizeof(char));
+    if (!samples || !marks) {
+      perror("neuralnet_train");
+      free(samples);
+      free(marks);
+      free(losses);
+      return 0;
+    }
+  }
+  double loss = 0;
+  /* How many outputs the loss covers, which is fewer than all of them
+   * when sampling */
+  long trained = (long) input_count * out_dim;
+  if (samples) {
+    trained = 0;
+  }
+  int out_jobs = net->l_params[(net->config.layers - 1) * net->jobs].jobs;
+  for (int i = 0; i < input_count; i++) {
+    if (samples) {
+      trained += _sample_outputs(net, &(labels[i * out_dim]), samples, marks);
+    }
+    _feed_forward(net, &(inputs[i * dim]));
+    _back_propagate(net, &(inputs[i * dim]), &(labels[i * out_dim]), losses);
+    if (losses) {
+      for (int t = 0; t < out_jobs; t++) {
+        loss += losses[t];
+      }
+    }
+  }
+  if (samples) {
+    _stop_sampling(net);
+    free(samples);
+    free(marks);
+  }
+  if (stats) {
+    stats->loss = loss;
+    stats->count = input_count;
+    stats->mse = trained ? loss / (double) trained : 0;
+    free(losses);
   }
   return 1;
 }
@@ -199,43 +871,644 @@ int neuralnet_classify(neuralnet *net, const double *inputs, double *results,
   return 1;
 }
 
+int neuralnet_evaluate(neuralnet *net, const double *inputs,
+                       const double *labels, int input_count,
+                       netmetrics *metrics) {
+  int jobs = net->jobs;
+  int per_job = _serial_scratch(net);
+  eval_params *params = malloc(sizeof(eval_params) * jobs);
+  eval_totals *totals = calloc(jobs, sizeof(eval_totals));
+  double *scratch = malloc(sizeof(double) * per_job * jobs);
+  if (!params || !totals || !scratch) {
+    perror("neuralnet_evaluate");
+    free(params);
+    free(totals);
+    free(scratch);
+    return 0;
+  }
+  for (int j = 0; j < jobs; j++) {
+    params[j].net = net;
+    params[j].inputs = inputs;
+    params[j].labels = labels;
+    params[j].start = (int) ((long) input_count * j / jobs);
+    params[j].end = (int) ((long) input_count * (j + 1) / jobs);
+    params[j].scratch = &(scratch[per_job * j]);
+  }
+  _submit(net, (unsigned char *) totals, _eval_worker,
+      (unsigned char *) params, sizeof(eval_params), jobs,
+      sizeof(eval_totals));
+  /* Always add the totals up in the same order, so the answer doesn't
+   * depend on which thread finished first */
+  double squared_error = 0;
+  double cross_entropy = 0;
+  int correct = 0;
+  for (int j = 0; j < jobs; j++) {
+    squared_error += totals[j].squared_error;
+    cross_entropy += totals[j].cross_entropy;
+    correct += totals[j].correct;
+  }
+  int out_dim = neuralnet_output_size(net);
+  metrics->count = input_count;
+  metrics->mse = input_count ?
+    squared_error / ((double) input_count * out_dim) : 0;
+  metrics->cross_entropy = input_count ? cross_entropy / input_count : 0;
+  metrics->accuracy = input_count ? correct / (double) input_count : 0;
+  free(params);
+  free(totals);
+  free(scratch);
+  return 1;
+}
+
+int neuralnet_classify_pipelined(neuralnet *net, const double *inputs,
+                                 double *results, int input_count,
+                                 int stage_count) {
+  if (stage_count <= 0) {
+    fprintf(stderr, "neuralnet_classify_pipelined: need at least one stage\n");
+    return 0;
+  }
+  if (stage_count > net->config.layers) {
+    stage_count = net->config.layers;
+  }
+  int mw = net->config.max_width;
+  int dim = net->config.dimensionality;
+  int slot_count = stage_count * PIPELINE_SLOTS_PER_STAGE;
+  /* Rings never hold more than every slot plus the stop marker */
+  unsigned int capacity = slot_count + 1;
+  pipeline_stage *stages = calloc(stage_count, sizeof(pipeline_stage));
+  spsc_ring *rings = calloc(stage_count + 1, sizeof(spsc_ring));
+  pipeline_slot *slots = calloc(slot_count, sizeof(pipeline_slot));
+  pipeline_slot **free_slots = malloc(sizeof(pipeline_slot *) * slot_count);
+  void **items = malloc(sizeof(void *) * capacity * (stage_count + 1));
+  double *outs = malloc(sizeof(double) * mw * net->config.layers * slot_count);
+  /* The + 1 is so we get something back even for an all dense net */
+  double *scratch = malloc(sizeof(double) *
+                           (net->layer_scratch * stage_count + 1));
+  if (!stages || !rings || !slots || !free_slots || !items || !outs ||
+      !scratch) {
+    perror("neuralnet_classify_pipelined");
+    free(stages);
+    free(rings);
+    free(slots);
+    free(free_slots);
+    free(items);
+    free(outs);
+    free(scratch);
+    return 0;
+  }
+  /* Ring k feeds stage k; the last ring brings finished slots back to us */
+  for (int r = 0; r <= stage_count; r++) {
+    rings[r].items = &(items[r * capacity]);
+    rings[r].capacity = capacity;
+  }
+  for (int i = 0; i < slot_count; i++) {
+    slots[i].out = &(outs[i * mw * net->config.layers]);
+    free_slots[i] = &(slots[i]);
+  }
+  _assign_stages(net, stages, stage_count);
+  int started;
+  for (started = 0; started < stage_count; started++) {
+    pipeline_stage *stage = &(stages[started]);
+    stage->net = net;
+    stage->in = &(rings[started]);
+    stage->out = &(rings[started + 1]);
+    stage->results = results;
+    stage->scratch = &(scratch[net->layer_scratch * started]);
+    if (pthread_create(&(stage->thread), NULL, _stage_func, stage)) {
+      perror("neuralnet_classify_pipelined");
+      break;
+    }
+  }
+  int rc = started == stage_count;
+  if (rc) {
+    int free_count = slot_count;
+    for (int i = 0; i < input_count; i++) {
+      pipeline_slot *slot;
+      if (free_count) {
+        slot = free_slots[--free_count];
+      } else {
+        slot = _ring_pop(&(rings[stage_count]));
+      }
+      slot->index = i;
+      slot->input = &(inputs[i * dim]);
+      _ring_push(&(rings[0]), slot);
+    }
+  }
+  /* Tell the stages to stop. If not all of them started, the stop marker
+   * just falls out of the last one that did. */
+  if (started) {
+    _ring_push(&(rings[0]), NULL);
+    while (_ring_pop(&(rings[started]))) {
+      /* Drain whatever was still in flight */
+    }
+  }
+  for (int i = 0; i < started; i++) {
+    pthread_join(stages[i].thread, NULL);
+  }
+  free(stages);
+  free(rings);
+  free(slots);
+  free(free_slots);
+  free(items);
+  free(outs);
+  free(scratch);
+  return rc;
+}
+
+int neuralnet_input_size(neuralnet *net) {
+  return net->config.dimensionality;
+}
+
+int neuralnet_output_size(neuralnet *net) {
+  return net->config.layer_sizes[net->config.layers - 1];
+}
+
+int neuralnet_param_count(neuralnet *net) {
+  int count = 0;
+  for (int layer = 0; layer < net->config.layers; layer++) {
+    count += _layer_rows(&(net->config), layer) *
+             (_layer_weights(&(net->config), layer) + 1);
+  }
+  return count;
+}
+
+void neuralnet_get_params(neuralnet *net, double *params) {
+  for (int layer = 0; layer < net->config.layers; layer++) {
+    int count = _layer_weights(&(net->config), layer) + 1;
+    int rows = _layer_rows(&(net->config), layer);
+    for (int neuron = 0; neuron < rows; neuron++) {
+      _dense_row(net, layer, neuron, params);
+      params += count;
+    }
+  }
+}
+
+int neuralnet_set_params(neuralnet *net, const double *params) {
+  int mw = net->config.max_width;
+  /* The factorizations are of the old weights, so every layer goes back to
+   * being dense */
+  if (net->lowrank && !_pack_weights(net, 1, "neuralnet_set_params")) {
+    return 0;
+  }
+  for (int layer = 0; net->lowrank && layer < net->config.layers; layer++) {
+    _drop_lowrank(net, layer);
+  }
+  for (int layer = 0; layer < net->config.layers; layer++) {
+    int count = _layer_weights(&(net->config), layer) + 1;
+    int rows = _layer_rows(&(net->config), layer);
+    for (int neuron = 0; neuron < rows; neuron++) {
+      memcpy(&(GET_WEIGHT(_weights_of(net, layer), mw, 0, neuron, 0)), params,
+             sizeof(double) * count);
+      params += count;
+    }
+  }
+  return 1;
+}
+
 int neuralnet_destroy(neuralnet *net) {
   int rc = 1;
   /* I mean it's not like we can do anything if we fail to destroy something
    * and we do still have to delete everything else.
    * So just store the rc and hope the caller knows what to do */
-  rc &= threadpool_destroy(net->pool);
+  rc &= _destroy_pool(net);
   free(net->out);
   free(net->derr);
   free(net->w);
   free(net->oldw);
   free(net->l_params);
+  _free_conv(net);
+  _free_lowrank(net);
+  free(net->sizes);
+  free(net->specs);
   free(net);
   return rc;
 }
 
+int neuralnet_save(neuralnet *net, FILE *stream) {
+  int ok = _save_header(net, stream, net->lowrank != NULL);
+  int mw = net->config.max_width;
+  for (int layer = 0; ok && layer < net->config.layers; layer++) {
+    /* Factored layers are saved as their factors instead */
+    if (net->lowrank) {
+      ok = _save_lowrank(net, layer, stream);
+      if (_is_factored(net, layer)) {
+        continue;
+      }
+    }
+    /* The bias lives right after the last weight */
+    int count = _layer_weights(&(net->config), layer) + 1;
+    int rows = _layer_rows(&(net->config), layer);
+    double *weights = _weights_of(net, layer);
+    for (int neuron = 0; ok && neuron < rows; neuron++) {
+      ok = fwrite(&(GET_WEIGHT(weights, mw, 0, neuron, 0)), sizeof(double),
+                  count, stream) == count;
+    }
+  }
+  if (!ok) {
+    perror("neuralnet_save");
+  }
+  return ok;
+}
+
+int neuralnet_save_params(neuralnet *net, const double *params,
+                          FILE *stream) {
+  /* The params are already in the order we save the weights in */
+  int count = neuralnet_param_count(net);
+  int ok = _save_header(net, stream, 0) &&
+           fwrite(params, sizeof(double), count, stream) == count;
+  if (!ok) {
+    perror("neuralnet_save_params");
+  }
+  return ok;
+}
+
+int neuralnet_load(neuralnet **retval, FILE *stream, int threads) {
+  return _load(retval, stream, NULL, threads, 0, "neuralnet_load");
+}
+
+int neuralnet_load_inference(neuralnet **retval, FILE *stream, int threads) {
+  return _load(retval, stream, NULL, threads, 1, "neuralnet_load_inference");
+}
+
+int neuralnet_load_shared(neuralnet **retval, FILE *stream, threadpool *pool,
+                          int threads, int inference_only) {
+  return _load(retval, stream, pool, threads, inference_only,
+               "neuralnet_load_shared");
+}
+
+int neuralnet_export_c(neuralnet *net, FILE *stream, const char *prefix) {
+  const activation_info *act = activation_find(net->config.activation);
+  if (!act || !act->source) {
+    fprintf(stderr, "neuralnet_export_c: can't export activation function\n");
+    return 0;
+  }
+  if (net->conv) {
+    fprintf(stderr, "neuralnet_export_c: can't export conv layers\n");
+    return 0;
+  }
+  if (!isalpha((unsigned char) prefix[0]) && prefix[0] != '_') {
+    fprintf(stderr, "neuralnet_export_c: invalid prefix %s\n", prefix);
+    return 0;
+  }
+  for (const char *c = prefix; *c; c++) {
+    if (!isalnum((unsigned char) *c) && *c != '_') {
+      fprintf(stderr, "neuralnet_export_c: invalid prefix %s\n", prefix);
+      return 0;
+    }
+  }
+  /* Macros get an upper case prefix */
+  size_t len = strlen(prefix);
+  char *upper = malloc(len + 1);
+  /* Where to work out each row, which factored layers only have as A * B */
+  double *row = malloc(sizeof(double) * net->config.max_width);
+  if (!upper || !row) {
+    perror("neuralnet_export_c");
+    free(upper);
+    free(row);
+    return 0;
+  }
+  for (size_t i = 0; i <= len; i++) {
+    upper[i] = toupper((unsigned char) prefix[i]);
+  }
+  const netconfig *config = &(net->config);
+  int last_layer = config->layers - 1;
+  fprintf(stream, "/* Generated by helios from a trained neural net. "
+                  "Do not edit. */\n");
+  fprintf(stream, "#include <math.h>\n\n");
+  fprintf(stream, "#define %s_INPUTS %d\n", upper, config->dimensionality);
+  fprintf(stream, "#define %s_OUTPUTS %d\n\n", upper,
+          config->layer_sizes[last_layer]);
+  fprintf(stream, "#if defined(__GNUC__)\n");
+  fprintf(stream, "#define %s_ALIGNED __attribute__((aligned(64)))\n", upper);
+  fprintf(stream, "#else\n#define %s_ALIGNED\n#endif\n\n", upper);
+  fprintf(stream, "static inline double %s_activation(double x) {\n", prefix);
+  fprintf(stream, "  %s\n}\n\n", act->source);
+  for (int layer = 0; layer < config->layers; layer++) {
+    int w_count = _layer_inputs(config, layer);
+    int size = config->layer_sizes[layer];
+    fprintf(stream, "/* Layer %d: %d neurons of %d weights plus a bias */\n",
+            layer, size, w_count);
+    fprintf(stream, "static const double %s_w%d[%d][%d] %s_ALIGNED = {\n",
+            prefix, layer, size, w_count + 1, upper);
+    for (int neuron = 0; neuron < size; neuron++) {
+      _dense_row(net, layer, neuron, row);
+      fprintf(stream, "  {");
+      for (int input = 0; input <= w_count; input++) {
+        /* %a so that the weights survive the round trip bit for bit */
+        fprintf(stream, " %a,", row[input]);
+      }
+      fprintf(stream, " },\n");
+    }
+    fprintf(stream, "};\n\n");
+  }
+  fprintf(stream, "void %s_classify(const double *input, double *output) {\n",
+          prefix);
+  for (int layer = 0; layer < config->layers; layer++) {
+    int w_count = _layer_inputs(config, layer);
+    int size = config->layer_sizes[layer];
+    char inputs[32];
+    char outputs[32];
+    if (layer) {
+      snprintf(inputs, sizeof(inputs), "l%d", layer - 1);
+    } else {
+      snprintf(inputs, sizeof(inputs), "input");
+    }
+    if (layer == last_layer) {
+      snprintf(outputs, sizeof(outputs), "output");
+    } else {
+      snprintf(outputs, sizeof(outputs), "l%d", layer);
+      fprintf(stream, "  double %s[%d];\n", outputs, size);
+    }
+    fprintf(stream, "  for (int n = 0; n < %d; n++) {\n", size);
+    fprintf(stream, "    const double *w = %s_w%d[n];\n", prefix, layer);
+    /* Keep the same summation order as _ff_worker, so we get the same
+     * answers as the net did. */
+    fprintf(stream, "    double acc = 0;\n");
+    int unrolled = 0;
+    if (w_count > EXPORT_UNROLL_MAX) {
+      unrolled = w_count - (w_count % 4);
+      fprintf(stream, "    for (int i = 0; i < %d; i += 4) {\n", unrolled);
+      fprintf(stream, "      acc += w[i] * %s[i];\n", inputs);
+      fprintf(stream, "      acc += w[i + 1] * %s[i + 1];\n", inputs);
+      fprintf(stream, "      acc += w[i + 2] * %s[i + 2];\n", inputs);
+      fprintf(stream, "      acc += w[i + 3] * %s[i + 3];\n", inputs);
+      fprintf(stream, "    }\n");
+    }
+    _export_dot(stream, inputs, unrolled, w_count);
+    fprintf(stream, "    acc += w[%d];\n", w_count);
+    fprintf(stream, "    %s[n] = %s_activation(%a * acc);\n", outputs, prefix,
+            net->l_params[layer * net->jobs].ifactor);
+    fprintf(stream, "  }\n");
+  }
+  fprintf(stream, "}\n");
+  free(upper);
+  free(row);
+  if (ferror(stream)) {
+    perror("neuralnet_export_c");
+    return 0;
+  }
+  return 1;
+}
+
+int neuralnet_factorize(neuralnet *net, int layer, int rank,
+                        double *reconstruction) {
+  const char *who = "neuralnet_factorize";
+  if (!_check_lowrank(net, layer, rank, who)) {
+    return 0;
+  }
+  double *us, *s, *v;
+  if (!_layer_svd(net, layer, &us, &s, &v, who)) {
+    return 0;
+  }
+  int ok = _set_lowrank(net, layer, rank, us, v, who);
+  /* The dense weights have to go for the factors to save any memory */
+  if (ok && !_pack_weights(net, 0, who)) {
+    _drop_lowrank(net, layer);
+    ok = 0;
+  }
+  if (ok && reconstruction) {
+    *reconstruction = _reconstruction(s, _layer_inputs(&(net->config), layer),
+                                      rank);
+  }
+  free(us);
+  free(s);
+  free(v);
+  return ok;
+}
+
+int neuralnet_factor_report(neuralnet *net, int layer, const int *ranks,
+                            int count, const double *inputs,
+                            const double *labels, int input_count,
+                            factor_report *reports) {
+  const char *who = "neuralnet_factor_report";
+  for (int i = 0; i < count; i++) {
+    if (!_check_lowrank(net, layer, ranks[i], who)) {
+      return 0;
+    }
+  }
+  if (_is_factored(net, layer)) {
+    fprintf(stderr, "%s: layer %d is already factored\n", who, layer);
+    return 0;
+  }
+  netmetrics base;
+  if (!neuralnet_evaluate(net, inputs, labels, input_count, &base)) {
+    return 0;
+  }
+  int rows = _layer_rows(&(net->config), layer);
+  int in = _layer_inputs(&(net->config), layer);
+  /* The dense weights stay put while we try each rank, so we can go back
+   * to them after */
+  double *us, *s, *v;
+  if (!_layer_svd(net, layer, &us, &s, &v, who)) {
+    return 0;
+  }
+  int ok = 1;
+  for (int i = 0; ok && i < count; i++) {
+    netmetrics metrics;
+    ok = _set_lowrank(net, layer, ranks[i], us, v, who) &&
+         neuralnet_evaluate(net, inputs, labels, input_count, &metrics);
+    if (ok) {
+      reports[i].rank = ranks[i];
+      reports[i].reconstruction = _reconstruction(s, in, ranks[i]);
+      reports[i].mse_delta = metrics.mse - base.mse;
+      reports[i].accuracy_delta = metrics.accuracy - base.accuracy;
+      reports[i].cost = (double) ranks[i] * (in + rows) / ((double) in * rows);
+    }
+  }
+  _drop_lowrank(net, layer);
+  free(us);
+  free(s);
+  free(v);
+  return ok;
+}
+
+static int _load(neuralnet **retval, FILE *stream, threadpool *pool,
+                 int threads, int inference_only, const char *who) {
+  char magic[sizeof(MODEL_MAGIC)] = { 0 };
+  int header[4];
+  double params[2];
+  char act_name[MODEL_ACTIVATION_LEN];
+  if (fread(magic, 1, strlen(MODEL_MAGIC), stream) != strlen(MODEL_MAGIC) ||
+      fread(header, sizeof(int), 4, stream) != 4 ||
+      fread(params, sizeof(double), 2, stream) != 2 ||
+      fread(act_name, 1, MODEL_ACTIVATION_LEN, stream) !=
+        MODEL_ACTIVATION_LEN) {
+    fprintf(stderr, "%s: truncated model\n", who);
+    return 0;
+  }
+  if (strcmp(magic, MODEL_MAGIC) ||
+      (header[0] != MODEL_VERSION && header[0] != MODEL_VERSION_CONV &&
+       header[0] != MODEL_VERSION_LOWRANK)) {
+    fprintf(stderr, "%s: not a helios model\n", who);
+    return 0;
+  }
+  act_name[MODEL_ACTIVATION_LEN - 1] = '\0';
+  const activation_info *act = activation_find_name(act_name);
+  if (!act) {
+    fprintf(stderr, "%s: unknown activation %s\n", who, act_name);
+    return 0;
+  }
+  netconfig config = { 0 };
+  config.layers = header[1];
+  config.dimensionality = header[2];
+  config.max_width = header[3];
+  config.alpha = params[0];
+  config.iscale = params[1];
+  config.activation = act->func;
+  config.activation_prime = act->prime;
+  config.threads = threads;
+  config.inference_only = inference_only;
+  config.pool = pool;
+  if (config.layers <= 0 || config.dimensionality <= 0 ||
+      config.max_width < config.dimensionality) {
+    fprintf(stderr, "%s: corrupt model\n", who);
+    return 0;
+  }
+  int *sizes = malloc(sizeof(int) * config.layers);
+  if (!sizes) {
+    perror(who);
+    return 0;
+  }
+  if (fread(sizes, sizeof(int), config.layers, stream) != config.layers) {
+    fprintf(stderr, "%s: truncated model\n", who);
+    free(sizes);
+    return 0;
+  }
+  for (int layer = 0; layer < config.layers; layer++) {
+    if (sizes[layer] <= 0 || sizes[layer] > config.max_width) {
+      fprintf(stderr, "%s: corrupt model\n", who);
+      free(sizes);
+      return 0;
+    }
+  }
+  config.layer_sizes = sizes;
+  conv_spec *specs = NULL;
+  if (header[0] != MODEL_VERSION) {
+    specs = malloc(sizeof(conv_spec) * config.layers);
+    if (!specs) {
+      perror(who);
+      free(sizes);
+      return 0;
+    }
+    for (int layer = 0; layer < config.layers; layer++) {
+      int spec[MODEL_CONV_INTS];
+      if (fread(spec, sizeof(int), MODEL_CONV_INTS, stream) !=
+          MODEL_CONV_INTS) {
+        fprintf(stderr, "%s: truncated model\n", who);
+        free(specs);
+        free(sizes);
+        return 0;
+      }
+      specs[layer].filters = spec[0];
+      specs[layer].channels = spec[1];
+      specs[layer].height = spec[2];
+      specs[layer].width = spec[3];
+      specs[layer].kernel = spec[4];
+      specs[layer].stride = spec[5];
+      specs[layer].padding = spec[6];
+      specs[layer].pool = spec[7];
+    }
+    config.conv = specs;
+    /* Factored nets have specs whether or not any layer is conv */
+    int any_conv = 0;
+    for (int layer = 0; layer < config.layers; layer++) {
+      any_conv |= _is_conv(&config, layer);
+    }
+    if (!any_conv) {
+      free(specs);
+      specs = NULL;
+      config.conv = NULL;
+    }
+  }
+  neuralnet *net;
+  /* This checks the conv specs for us */
+  if (!neuralnet_create(&net, config)) {
+    free(specs);
+    free(sizes);
+    return 0;
+  }
+  net->sizes = sizes;
+  net->specs = specs;
+  int mw = net->config.max_width;
+  for (int layer = 0; layer < config.layers; layer++) {
+    if (header[0] == MODEL_VERSION_LOWRANK &&
+        !_load_lowrank(net, layer, stream, who)) {
+      neuralnet_destroy(net);
+      return 0;
+    }
+    if (_is_factored(net, layer)) {
+      continue;
+    }
+    int count = _layer_weights(&config, layer) + 1;
+    int rows = _layer_rows(&config, layer);
+    double *weights = _weights_of(net, layer);
+    for (int neuron = 0; neuron < rows; neuron++) {
+      if (fread(&(GET_WEIGHT(weights, mw, 0, neuron, 0)), sizeof(double),
+                count, stream) != count) {
+        fprintf(stderr, "%s: truncated model\n", who);
+        neuralnet_destroy(net);
+        return 0;
+      }
+    }
+  }
+  /* The factored layers have no use for the room their dense weights took */
+  if (net->lowrank && !_pack_weights(net, 0, who)) {
+    neuralnet_destroy(net);
+    return 0;
+  }
+  *retval = net;
+  return 1;
+}
+
 static int _init_layer_params(neuralnet *net) {
-  net->l_params = malloc(sizeof(layer_params) * net->config.threads *
+  net->l_params = malloc(sizeof(layer_params) * net->jobs *
                          net->config.layers);
   if (!net->l_params) {
     return 0;
   }
   int mw = net->config.max_width;
+  const activation_info *act = activation_find(net->config.activation);
+  int stride = net->jobs;
   for (int layer = 0; layer < net->config.layers; layer++) {
-    int sect_size = net->config.layer_sizes[layer] / net->config.threads;
+    /* Each layer gets split as the plan says, but never into more jobs than
+     * we left room for */
+    int threads = stride;
+    if (net->config.layer_jobs && net->config.layer_jobs[layer] < threads) {
+      threads = net->config.layer_jobs[layer];
+    }
+    int sect_size = net->config.layer_sizes[layer] / threads;
+    conv_layer *conv = _is_conv(&(net->config), layer) ?
+                       &(net->conv[layer]) : NULL;
     layer_params *p = NULL;
-    for (int t = 0; t < net->config.threads; t++) {
+    for (int t = 0; t < threads; t++) {
       /* the if()s inside a loop will probably be fine here, hopefully this init
        * code isn't run too often. */
-      p = &(net->l_params[layer * net->config.threads + t]);
+      p = &(net->l_params[layer * stride + t]);
+      p->jobs = threads;
+      p->lowrank = NULL;
+      p->rank_start = 0;
+      p->rank_end = 0;
+      p->samples = NULL;
+      p->sample_start = 0;
+      p->sample_end = 0;
+      p->next_samples = NULL;
+      p->next_sample_count = 0;
       p->start = sect_size * t;
       p->end = sect_size * (t + 1);
       p->config = &(net->config);
+      p->activation_array = act ? act->array : NULL;
       p->weights = &(GET_WEIGHT(net->w, mw, layer, 0, 0));
       /* layer % 2 will ensure that we alternate between read and write old
-       * weigths every layer */
-      p->oldw_r = &(GET_WEIGHT(net->oldw, mw, layer % 2, 0, 0));
-      p->oldw_w = &(GET_WEIGHT(net->oldw, mw, ((layer + 1) % 2), 0, 0));
+       * weigths every layer. Nets that don't train have none. */
+      p->oldw_r = NULL;
+      p->oldw_w = NULL;
+      p->derr_r = NULL;
+      p->derr_w = NULL;
+      if (!net->config.inference_only) {
+        p->oldw_r = &(GET_WEIGHT(net->oldw, mw, layer % 2, 0, 0));
+        p->oldw_w = &(GET_WEIGHT(net->oldw, mw, ((layer + 1) % 2), 0, 0));
+        p->derr_r = &(net->derr[(layer % 2) * mw]);
+        p->derr_w = &(net->derr[(((layer + 1) % 2)) * mw]);
+      }
       if (!layer ) {
         p->w_count = net->config.dimensionality;
       } else {
@@ -244,118 +1517,510 @@ static int _init_layer_params(neuralnet *net) {
          * up to the outputs of the last layer. */
         p->inputs = &(net->out[(layer - 1) * mw]);
       }
-      /* Output layer doesn't really use this but it doesn't matter if we set
-       * it */
-      p->wnext_count = net->config.layer_sizes[layer];
+      p->conv = conv;
+      p->next_errors = NULL;
+      if (conv) {
+        /* Filters get split up for training, input channels for finding
+         * the errors of the layer before, and output rows for feeding
+         * forward */
+        const conv_spec *spec = conv->spec;
+        int plane = conv->out_h * conv->out_w;
+        p->w_count = conv->cols;
+        p->chan_start = (int) ((long) spec->filters * t / threads);
+        p->chan_end = (int) ((long) spec->filters * (t + 1) / threads);
+        p->in_start = (int) ((long) spec->channels * t / threads);
+        p->in_end = (int) ((long) spec->channels * (t + 1) / threads);
+        p->tile_start = (int) ((long) conv->out_h * t / threads);
+        p->tile_end = (int) ((long) conv->out_h * (t + 1) / threads);
+        p->start = p->chan_start * plane;
+        p->end = p->chan_end * plane;
+      }
+      if (layer < net->config.layers - 1 &&
+          _is_conv(&(net->config), layer + 1)) {
+        p->next_errors = net->conv[layer + 1].errors;
+      }
+      /* Output layer doesn't use this, so it gets 0 */
+      p->wnext_count = layer < net->config.layers - 1 ?
+                       net->config.layer_sizes[layer + 1] : 0;
       p->outputs = &(net->out[layer * mw]);
-      p->derr_r = &(net->derr[(layer % 2) * mw]);
-      p->derr_w = &(net->derr[(((layer + 1) % 2)) * mw]);
       /* TODO: Check the literature on this factor. I'm not sure what's best */
       p->ifactor = net->config.iscale * (net->config.layer_sizes[layer] / ((double) mw));
       if (layer == net->config.layers - 1) {
         p->ifactor = net->config.iscale;
       }
     }
-    /* The last one has to go all the way to the end. Note that if for
-     * some reason we have 0 threads we'll segfault here. That's the user's
-     * fault for wanting us to run with no threads. */
+    /* The last one has to go all the way to the end. There's always at
+     * least one, since no threads still means one job. */
     p->end = net->config.layer_sizes[layer];
   }
   return 1;
 }
 
+static int _init_weights(neuralnet *net) {
+  int stride = net->jobs;
+  init_params *params = malloc(sizeof(init_params) * net->config.layers *
+                               stride);
+  if (!params) {
+    return 0;
+  }
+  int jobs = 0;
+  unsigned long long offset = 0;
+  for (int layer = 0; layer < net->config.layers; layer++) {
+    int fan_out = net->config.layer_sizes[layer];
+    if (_is_conv(&(net->config), layer)) {
+      const conv_spec *spec = &(net->config.conv[layer]);
+      fan_out = spec->filters * spec->kernel * spec->kernel;
+    }
+    const layer_params *slices = &(net->l_params[layer * stride]);
+    for (int t = 0; t < slices->jobs; t++) {
+      params[jobs].layer = &(slices[t]);
+      params[jobs].offset = offset;
+      params[jobs].fan_out = fan_out;
+      jobs++;
+    }
+    offset += (unsigned long long) _layer_rows(&(net->config), layer) *
+              (_layer_weights(&(net->config), layer) + 1);
+  }
+  /* Every slice of every layer is independent, so do them all at once */
+  _submit(net, NULL, _init_worker, (unsigned char *) params,
+          sizeof(init_params), jobs, 0);
+  free(params);
+  return 1;
+}
+
+static void _init_worker(void *in, void *out) {
+  init_params *params = (init_params *) in;
+  const layer_params *layer = params->layer;
+  const netconfig *config = layer->config;
+  int mw = config->max_width;
+  int w_count = layer->w_count;
+  double limit = 0;
+  if (config->init == INIT_XAVIER) {
+    limit = sqrt(6.0 / (w_count + params->fan_out));
+  } else if (config->init == INIT_HE) {
+    limit = sqrt(6.0 / w_count);
+  }
+  /* Conv layers have a row of weights per filter, not per output */
+  int start = layer->conv ? layer->chan_start : layer->start;
+  int end = layer->conv ? layer->chan_end : layer->end;
+  for (int neuron = start; neuron < end; neuron++) {
+    /* Each parameter takes the number at its own index in the stream, so it
+     * doesn't matter which thread gets to it, or how wide the net is padded */
+    unsigned long long index = params->offset +
+                               (unsigned long long) neuron * (w_count + 1);
+    for (int input = 0; input <= w_count; input++) {
+      double u = rng_uniform_at(config->seed, index + input);
+      double *w = &(GET_WEIGHT(layer->weights, mw, 0, neuron, input));
+      if (config->init == INIT_UNIFORM) {
+        *w = u;
+      } else if (input == w_count) {
+        *w = 0;
+      } else {
+        *w = (2 * u - 1) * limit;
+      }
+    }
+  }
+}
+
+static void _submit(neuralnet *net, unsigned char *retvals,
+                    void (*mapper)(void *, void *), unsigned char *arguments,
+                    size_t arg_size, int arg_count, size_t retval_size) {
+  /* A single job isn't worth handing to another thread */
+  if (net->pool && arg_count > 1) {
+    threadpool_submit(net->pool, retvals, mapper, arguments, arg_size,
+                      arg_count, retval_size);
+    return;
+  }
+  for (int i = 0; i < arg_count; i++) {
+    /* Traced like the pool's workers trace theirs, so these jobs still
+     * turn up on the timeline */
+    unsigned long long start = trace_begin();
+    mapper(arguments + i * arg_size,
+           retvals ? retvals + i * retval_size : NULL);
+    trace_end("job", i, start);
+  }
+}
+
+static int _destroy_pool(neuralnet *net) {
+  return net->own_pool ? threadpool_destroy(net->pool) : 1;
+}
+
 static void _feed_forward(neuralnet *net, const double *inputs) {
   /* First layer has to be updated with the inputs */
-  for (int t = 0; t < net->config.threads; t++) {
+  for (int t = 0; t < net->jobs; t++) {
     net->l_params[t].inputs = inputs;
   }
   /* Now actually run stuff. */
   for (int layer = 0; layer < net->config.layers; layer++) {
-    layer_params *params = (net->l_params + (layer * net->config.threads));
-    threadpool_submit(net->pool, NULL, _ff_worker, (unsigned char *) params,
-        sizeof(layer_params), net->config.threads, 0);
+    unsigned long long start = trace_begin();
+    layer_params *params = (net->l_params + (layer * net->jobs));
+    /* Everyone needs all of B times the inputs before they can start */
+    if (params->lowrank) {
+      _submit(net, NULL, _lowrank_worker, (unsigned char *) params,
+          sizeof(layer_params), params->jobs, 0);
+    }
+    _submit(net, NULL, _ff_worker, (unsigned char *) params,
+        sizeof(layer_params), params->jobs, 0);
+    trace_end("feed forward", layer, start);
   }
 }
 
 static void _back_propagate(neuralnet *net, const double *inputs,
-                            const double *labels) {
+                            const double *labels, double *losses) {
   layer_params *cur_layer = net->l_params +
-    ((net->config.layers - 1) * net->config.threads);
+    ((net->config.layers - 1) * net->jobs);
   /* Gotta set the target for the output layer */
-  for (int t = 0; t < net->config.threads; t++) {
+  for (int t = 0; t < net->jobs; t++) {
     cur_layer[t].targets = labels;
   }
-  threadpool_submit(net->pool, NULL, _output_bp_worker,
-      (unsigned char *) cur_layer, sizeof(layer_params), net->config.threads,
-      0);
+  unsigned long long start = trace_begin();
+  _submit(net, (unsigned char *) losses, _output_bp_worker,
+      (unsigned char *) cur_layer, sizeof(layer_params), cur_layer->jobs,
+      sizeof(double));
+  trace_end("back propagate", net->config.layers - 1, start);
   for (int layer = net->config.layers - 2; layer >= 0; layer--) {
-    cur_layer -= net->config.threads;
-    threadpool_submit(net->pool, NULL, _bp_worker, (unsigned char *) cur_layer,
-        sizeof(layer_params), net->config.threads, 0);
+    start = trace_begin();
+    cur_layer -= net->jobs;
+    if (cur_layer->conv) {
+      _submit(net, NULL, _conv_bp_worker,
+          (unsigned char *) cur_layer, sizeof(layer_params),
+          cur_layer->jobs, 0);
+      /* The first layer has nobody to pass errors back to */
+      if (layer) {
+        _submit(net, NULL, _conv_errors_worker,
+            (unsigned char *) cur_layer, sizeof(layer_params),
+            cur_layer->jobs, 0);
+      }
+    } else {
+      _submit(net, NULL, _bp_worker,
+          (unsigned char *) cur_layer, sizeof(layer_params),
+          cur_layer->jobs, 0);
+    }
+    trace_end("back propagate", layer, start);
   }
 }
 
 static void _ff_worker(void *in, void *out) {
   layer_params *params = (layer_params *) in;
-  for (int neuron = params->start; neuron < params->end; neuron++) {
-    params->outputs[neuron] = 0;
+  if (params->conv) {
+    /* Keep what we need for training in the layer's own buffers */
+    _conv_forward(params, params->inputs, params->outputs, params->tile_start,
+                  params->tile_end, params->conv->col, params->conv->pre,
+                  params->conv->argmax);
+  } else if (params->lowrank) {
+    _lowrank_neurons(params, params->lowrank->h, params->outputs,
+                     params->start, params->end);
+  } else if (params->samples) {
+    /* Only the outputs we're about to train get worked out */
+    for (int s = params->sample_start; s < params->sample_end; s++) {
+      int neuron = params->samples[s];
+      _ff_neurons(params, params->inputs, params->outputs, neuron, neuron + 1);
+    }
+  } else {
+    _ff_neurons(params, params->inputs, params->outputs, params->start,
+                params->end);
+  }
+}
+
+static void _eval_worker(void *in, void *out) {
+  eval_params *params = (eval_params *) in;
+  eval_totals *totals = (eval_totals *) out;
+  neuralnet *net = params->net;
+  int dim = net->config.dimensionality;
+  int out_dim = neuralnet_output_size(net);
+  totals->squared_error = 0;
+  totals->cross_entropy = 0;
+  totals->correct = 0;
+  for (int i = params->start; i < params->end; i++) {
+    const double *outputs = _forward_serial(net, &(params->inputs[i * dim]),
+                                            params->scratch);
+    const double *label = &(params->labels[i * out_dim]);
+    int best_out = 0;
+    int best_label = 0;
+    for (int o = 0; o < out_dim; o++) {
+      double error = label[o] - outputs[o];
+      totals->squared_error += error * error;
+      double clamped = outputs[o];
+      if (clamped < EVAL_EPSILON) {
+        clamped = EVAL_EPSILON;
+      } else if (clamped > 1 - EVAL_EPSILON) {
+        clamped = 1 - EVAL_EPSILON;
+      }
+      totals->cross_entropy -= label[o] * log(clamped) +
+                               (1 - label[o]) * log(1 - clamped);
+      if (outputs[o] > outputs[best_out]) {
+        best_out = o;
+      }
+      if (label[o] > label[best_label]) {
+        best_label = o;
+      }
+    }
+    if (out_dim == 1) {
+      totals->correct += (outputs[0] > 0.5) == (label[0] > 0.5);
+    } else {
+      totals->correct += best_out == best_label;
+    }
+  }
+}
+
+static int _serial_scratch(neuralnet *net) {
+  /* Two layers' worth of outputs, then whatever the conv and factored
+   * layers need */
+  return net->config.max_width * 2 + net->layer_scratch;
+}
+
+static const double *_forward_serial(neuralnet *net, const double *input,
+                                     double *scratch) {
+  int mw = net->config.max_width;
+  const double *in = input;
+  double *out = scratch;
+  for (int layer = 0; layer < net->config.layers; layer++) {
+    /* Any thread's params will do, we just want the layer's weights */
+    const layer_params *params = &(net->l_params[layer * net->jobs]);
+    _ff_layer(params, in, out, net->config.layer_sizes[layer],
+              &(scratch[mw * 2]));
+    /* Ping-pong between the two halves of the scratch */
+    in = out;
+    out = out == scratch ? &(scratch[mw]) : scratch;
+  }
+  return in;
+}
+
+static void _ff_layer(const layer_params *params, const double *inputs,
+                      double *outputs, int size, double *scratch) {
+  if (params->conv) {
+    conv_layer *conv = params->conv;
+    _conv_forward(params, inputs, outputs, 0, conv->out_h, scratch,
+                  &(scratch[conv->cols * conv->positions]), NULL);
+  } else if (params->lowrank) {
+    _lowrank_project(params, inputs, scratch, 0, params->lowrank->rank);
+    _lowrank_neurons(params, scratch, outputs, 0, size);
+  } else {
+    _ff_neurons(params, inputs, outputs, 0, size);
+  }
+}
+
+static void _ff_neurons(const layer_params *params, const double *inputs,
+                        double *outputs, int start, int end) {
+  for (int neuron = start; neuron < end; neuron++) {
+    outputs[neuron] = 0;
     int input;
     for (input = 0; input < params->w_count; input++) {
       /* It's the zeroth layer because params->weight already points at the
        * weigths for this layer (not for the entire network) */
-      params->outputs[neuron] += GET_WEIGHT(params->weights,
-          params->config->max_width, 0, neuron, input) * params->inputs[input];
+      outputs[neuron] += GET_WEIGHT(params->weights,
+          params->config->max_width, 0, neuron, input) * inputs[input];
     }
     /* Now add in the bias */
-    params->outputs[neuron] += GET_WEIGHT(params->weights,
+    outputs[neuron] += GET_WEIGHT(params->weights,
         params->config->max_width, 0, neuron, input);
-    /* Run it through the activation function */
-    params->outputs[neuron] = params->config->activation(params->ifactor *
-        params->outputs[neuron]);
   }
+  _activate(params, outputs, start, end);
+}
+
+static void _activate(const layer_params *params, double *outputs, int start,
+                      int end) {
+  for (int neuron = start; neuron < end; neuron++) {
+    outputs[neuron] *= params->ifactor;
+  }
+  /* Run it all through the activation function, in one go if we can so
+   * that it vectorizes */
+  if (params->activation_array) {
+    params->activation_array(&(outputs[start]), &(outputs[start]),
+                             end - start);
+  } else {
+    for (int neuron = start; neuron < end; neuron++) {
+      outputs[neuron] = params->config->activation(outputs[neuron]);
+    }
+  }
+}
+
+static void _lowrank_project(const layer_params *params, const double *inputs,
+                             double *h, int start, int end) {
+  int in = params->w_count;
+  matrix_gemm(0, 0, end - start, 1, in, 1, &(params->lowrank->b[start * in]),
+              in, inputs, 1, 0, &(h[start]), 1);
+}
+
+static void _lowrank_neurons(const layer_params *params, const double *h,
+                             double *outputs, int start, int end) {
+  int rank = params->lowrank->rank;
+  matrix_gemm(0, 0, end - start, 1, rank, 1,
+              &(params->lowrank->a[start * rank]), rank, h, 1, 0,
+              &(outputs[start]), 1);
+  for (int neuron = start; neuron < end; neuron++) {
+    outputs[neuron] += params->lowrank->bias[neuron];
+  }
+  _activate(params, outputs, start, end);
+}
+
+static void _lowrank_worker(void *in, void *out) {
+  layer_params *params = (layer_params *) in;
+  _lowrank_project(params, params->inputs, params->lowrank->h,
+                   params->rank_start, params->rank_end);
+}
+
+static void _assign_stages(neuralnet *net, pipeline_stage *stages,
+                           int count) {
+  const netconfig *config = &(net->config);
+  double total = 0;
+  for (int layer = 0; layer < config->layers; layer++) {
+    total += _layer_cost(config, layer);
+  }
+  double done = 0;
+  int layer = 0;
+  for (int s = 0; s < count; s++) {
+    double target = total * (s + 1) / count;
+    /* Every stage needs at least one layer, so leave enough for the rest */
+    int limit = config->layers - (count - s - 1);
+    stages[s].first = layer;
+    while (layer < limit) {
+      double cost = _layer_cost(config, layer);
+      /* Take the layer if that gets us closer to the target than not */
+      if (layer != stages[s].first && s != count - 1 &&
+          done + cost / 2 > target) {
+        break;
+      }
+      done += cost;
+      layer++;
+    }
+    stages[s].last = layer;
+  }
+}
+
+static void *_stage_func(void *the_stage) {
+  pipeline_stage *stage = (pipeline_stage *) the_stage;
+  neuralnet *net = stage->net;
+  int mw = net->config.max_width;
+  int last_layer = net->config.layers - 1;
+  int out_dim = net->config.layer_sizes[last_layer];
+  pipeline_slot *slot;
+  while ((slot = _ring_pop(stage->in))) {
+    for (int layer = stage->first; layer < stage->last; layer++) {
+      /* Any thread's params will do, we just want the layer's weights */
+      const layer_params *params = &(net->l_params[layer * net->jobs]);
+      const double *in = layer ? &(slot->out[(layer - 1) * mw]) : slot->input;
+      double *out = &(slot->out[layer * mw]);
+      if (layer == last_layer) {
+        out = &(stage->results[slot->index * out_dim]);
+      }
+      _ff_layer(params, in, out, net->config.layer_sizes[layer],
+                stage->scratch);
+    }
+    _ring_push(stage->out, slot);
+  }
+  /* Pass the stop marker on */
+  _ring_push(stage->out, NULL);
+  return NULL;
+}
+
+static void _ring_push(spsc_ring *ring, void *item) {
+  unsigned int tail = ring->tail;
+  int spins = 0;
+  while (tail - __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE) >=
+         ring->capacity) {
+    if (++spins > PIPELINE_SPINS) {
+      sched_yield();
+    }
+  }
+  ring->items[tail % ring->capacity] = item;
+  /* Release so the consumer sees the item before it sees the new tail */
+  __atomic_store_n(&(ring->tail), tail + 1, __ATOMIC_RELEASE);
+}
+
+static void *_ring_pop(spsc_ring *ring) {
+  unsigned int head = ring->head;
+  int spins = 0;
+  while (__atomic_load_n(&(ring->tail), __ATOMIC_ACQUIRE) == head) {
+    if (++spins > PIPELINE_SPINS) {
+      sched_yield();
+    }
+  }
+  void *item = ring->items[head % ring->capacity];
+  __atomic_store_n(&(ring->head), head + 1, __ATOMIC_RELEASE);
+  return item;
 }
 
 static void _output_bp_worker(void *in, void *out) {
   layer_params *params = (layer_params *) in;
-  int mw = params->config->max_width;
-  for (int neuron = params->start; neuron < params->end; neuron++) {
-    double out = params->outputs[neuron];
-    double error = params->targets[neuron] - out;
-    /* I double dog dare you to differentiate the error */
-    double derr = error * params->config->activation_prime(out);
-    params->derr_w[neuron] = derr;
-    int input;
-    for (input = 0; input < params->w_count; input++) {
-      GET_WEIGHT(params->oldw_w, mw, 0, neuron, input) =
-        GET_WEIGHT(params->weights, mw, 0, neuron, input);
-      GET_WEIGHT(params->weights, mw, 0, neuron, input) +=
-        params->config->alpha * derr * params->inputs[input];
+  /* We've got the error right here, so keeping track of it is free */
+  double loss = 0;
+  if (params->samples) {
+    for (int s = params->sample_start; s < params->sample_end; s++) {
+      loss += _output_bp_neuron(params, params->samples[s]);
+    }
+  } else {
+    for (int neuron = params->start; neuron < params->end; neuron++) {
+      loss += _output_bp_neuron(params, neuron);
     }
-    /* The bias */
+  }
+  if (out) {
+    *((double *) out) = loss;
+  }
+}
+
+static double _output_bp_neuron(layer_params *params, int neuron) {
+  int mw = params->config->max_width;
+  double output = params->outputs[neuron];
+  double error = params->targets[neuron] - output;
+  /* I double dog dare you to differentiate the error */
+  double derr = error * params->config->activation_prime(output);
+  params->derr_w[neuron] = derr;
+  int input;
+  for (input = 0; input < params->w_count; input++) {
     GET_WEIGHT(params->oldw_w, mw, 0, neuron, input) =
       GET_WEIGHT(params->weights, mw, 0, neuron, input);
     GET_WEIGHT(params->weights, mw, 0, neuron, input) +=
-      params->config->alpha * derr;
+      params->config->alpha * derr * params->inputs[input];
   }
+  /* The bias */
+  GET_WEIGHT(params->oldw_w, mw, 0, neuron, input) =
+    GET_WEIGHT(params->weights, mw, 0, neuron, input);
+  GET_WEIGHT(params->weights, mw, 0, neuron, input) +=
+    params->config->alpha * derr;
+  return error * error;
 }
 
-static void _bp_worker(void *in, void *out) {
-  layer_params *params = (layer_params *) in;
+static void _bp_errors(layer_params *params) {
   int mw = params->config->max_width;
-  /* This has to be three separate loops to prevent the mortal sin of
+  /* A conv layer after us already did the hard work */
+  if (params->next_errors) {
+    for (int neuron = params->start; neuron < params->end; neuron++) {
+      params->derr_w[neuron] = params->next_errors[neuron];
+    }
+    return;
+  }
+  /* This has to be separate loops to prevent the mortal sin of
    * iterating column-wise over an array. */
   /* Start by setting the derivatives to 0; this is so we can reuse the array
    * without having to allocate a new one in here */
   for (int neuron = params->start; neuron < params->end; neuron++) {
     params->derr_w[neuron] = 0;
   }
-  /* Now calculate ERRORS (not dErrors) for each neuron */
+  /* Now calculate ERRORS (not dErrors) for each neuron. Outputs that weren't
+   * sampled have no error to pass back */
+  if (params->next_samples) {
+    for (int s = 0; s < params->next_sample_count; s++) {
+      int next = params->next_samples[s];
+      for (int neuron = params->start; neuron < params->end; neuron++) {
+        params->derr_w[neuron] += params->derr_r[next] *
+          GET_WEIGHT(params->oldw_r, mw, 0, next, neuron);
+      }
+    }
+    return;
+  }
   for (int next = 0; next < params->wnext_count; next++) {
     for (int neuron = params->start; neuron < params->end; neuron++) {
       params->derr_w[neuron] += params->derr_r[next] *
         GET_WEIGHT(params->oldw_r, mw, 0, next, neuron);
     }
   }
+}
+
+static void _bp_worker(void *in, void *out) {
+  layer_params *params = (layer_params *) in;
+  int mw = params->config->max_width;
+  _bp_errors(params);
   /* That was the worst of it. Now just adjust the weights as normal */
   for (int neuron = params->start; neuron < params->end; neuron++) {
     double out = params->outputs[neuron];
@@ -375,21 +2040,751 @@ static void _bp_worker(void *in, void *out) {
   }
 }
 
+static int _sample_outputs(neuralnet *net, const double *labels,
+                           int *samples, char *marks) {
+  int last = net->config.layers - 1;
+  int out_dim = net->config.layer_sizes[last];
+  int count = 0;
+  for (int neuron = 0; neuron < out_dim; neuron++) {
+    if (labels[neuron] != 0) {
+      samples[count++] = neuron;
+      marks[neuron] = 1;
+    }
+  }
+  int wanted = out_dim - count;
+  if (net->config.output_samples < wanted) {
+    wanted = net->config.output_samples;
+  }
+  wanted += count;
+  while (count < wanted) {
+    int neuron = (int) (rng_next(&(net->sampler)) % out_dim);
+    if (!marks[neuron]) {
+      samples[count++] = neuron;
+      marks[neuron] = 1;
+    }
+  }
+  for (int s = 0; s < count; s++) {
+    marks[samples[s]] = 0;
+  }
+  /* In order, so the rows get visited the way they would be without
+   * sampling and the errors add up in the same order */
+  qsort(samples, count, sizeof(int), _compare_ints);
+  layer_params *params = &(net->l_params[last * net->jobs]);
+  for (int t = 0; t < params->jobs; t++) {
+    params[t].samples = samples;
+    params[t].sample_start = (int) ((long) count * t / params->jobs);
+    params[t].sample_end = (int) ((long) count * (t + 1) / params->jobs);
+  }
+  if (last) {
+    params -= net->jobs;
+    for (int t = 0; t < params->jobs; t++) {
+      params[t].next_samples = samples;
+      params[t].next_sample_count = count;
+    }
+  }
+  return count;
+}
+
+static void _stop_sampling(neuralnet *net) {
+  for (int i = 0; i < net->config.layers * net->jobs; i++) {
+    net->l_params[i].samples = NULL;
+    net->l_params[i].next_samples = NULL;
+  }
+}
+
+static int _compare_ints(const void *a, const void *b) {
+  int x = *((const int *) a);
+  int y = *((const int *) b);
+  return (x > y) - (x < y);
+}
+
+static void _conv_forward(const layer_params *params, const double *inputs,
+                          double *outputs, int start, int end, double *col,
+                          double *pre, int *argmax) {
+  const conv_layer *conv = params->conv;
+  int mw = params->config->max_width;
+  int filters = conv->spec->filters;
+  int positions = conv->positions;
+  int pool = conv->pool;
+  int plane = conv->out_h * conv->out_w;
+  /* Output rows [start, end) are pooled from a contiguous run of positions */
+  int first = start * pool * conv->conv_w;
+  int last = end * pool * conv->conv_w;
+  if (first >= last) {
+    return;
+  }
+  _im2col(conv, inputs, col, first, last);
+  /* Every filter at once, as one matrix multiply */
+  matrix_gemm(0, 0, filters, last - first, conv->cols, 1, params->weights, mw,
+              &(col[first]), positions, 0, &(pre[first]), positions);
+  for (int f = 0; f < filters; f++) {
+    double bias = GET_WEIGHT(params->weights, mw, 0, f, conv->cols);
+    double *fpre = &(pre[f * positions]);
+    /* Activate before pooling: the activation needn't be monotonic, so
+     * pooling first could pick the wrong output */
+    for (int pos = first; pos < last; pos++) {
+      fpre[pos] = (fpre[pos] + bias) * params->ifactor;
+    }
+    if (params->activation_array) {
+      params->activation_array(&(fpre[first]), &(fpre[first]), last - first);
+    } else {
+      for (int pos = first; pos < last; pos++) {
+        fpre[pos] = params->config->activation(fpre[pos]);
+      }
+    }
+    for (int y = start; y < end; y++) {
+      for (int x = 0; x < conv->out_w; x++) {
+        int best = -1;
+        double best_value = 0;
+        for (int py = 0; py < pool; py++) {
+          for (int px = 0; px < pool; px++) {
+            int pos = (y * pool + py) * conv->conv_w + x * pool + px;
+            if (best < 0 || fpre[pos] > best_value) {
+              best = pos;
+              best_value = fpre[pos];
+            }
+          }
+        }
+        int out = f * plane + y * conv->out_w + x;
+        outputs[out] = best_value;
+        if (argmax) {
+          argmax[out] = best;
+        }
+      }
+    }
+  }
+}
+
+static void _im2col(const conv_layer *conv, const double *inputs,
+                    double *col, int start, int end) {
+  const conv_spec *spec = conv->spec;
+  int kernel = spec->kernel;
+  for (int row = 0; row < conv->cols; row++) {
+    int channel = row / (kernel * kernel);
+    int ky = (row / kernel) % kernel;
+    int kx = row % kernel;
+    const double *plane = &(inputs[channel * spec->height * spec->width]);
+    double *out = &(col[row * conv->positions]);
+    for (int pos = start; pos < end; pos++) {
+      int iy = (pos / conv->conv_w) * conv->stride + ky - spec->padding;
+      int ix = (pos % conv->conv_w) * conv->stride + kx - spec->padding;
+      if (iy < 0 || iy >= spec->height || ix < 0 || ix >= spec->width) {
+        out[pos] = 0;
+      } else {
+        out[pos] = plane[iy * spec->width + ix];
+      }
+    }
+  }
+}
+
+static void _conv_bp_worker(void *in, void *out) {
+  layer_params *params = (layer_params *) in;
+  conv_layer *conv = params->conv;
+  int mw = params->config->max_width;
+  int positions = conv->positions;
+  int plane = conv->out_h * conv->out_w;
+  _bp_errors(params);
+  for (int neuron = params->start; neuron < params->end; neuron++) {
+    params->derr_w[neuron] *=
+      params->config->activation_prime(params->outputs[neuron]);
+  }
+  for (int f = params->chan_start; f < params->chan_end; f++) {
+    /* Each output only came from the position it was pooled from */
+    double *dconv = &(conv->dconv[f * positions]);
+    memset(dconv, 0, sizeof(double) * positions);
+    double dbias = 0;
+    for (int o = f * plane; o < (f + 1) * plane; o++) {
+      dconv[conv->argmax[o]] = params->derr_w[o];
+      dbias += params->derr_w[o];
+    }
+    /* The layer before needs our weights as they were, like in _bp_worker */
+    memcpy(&(GET_WEIGHT(params->oldw_w, mw, 0, f, 0)),
+           &(GET_WEIGHT(params->weights, mw, 0, f, 0)),
+           sizeof(double) * (conv->cols + 1));
+    GET_WEIGHT(params->weights, mw, 0, f, conv->cols) +=
+      params->config->alpha * dbias;
+  }
+  int count = params->chan_end - params->chan_start;
+  if (count) {
+    /* Every weight moves by alpha * its input times the derivative, summed
+     * over every position the filter was applied at */
+    matrix_gemm(0, 1, count, conv->cols, positions, params->config->alpha,
+                &(conv->dconv[params->chan_start * positions]), positions,
+                conv->col, positions, 1,
+                &(GET_WEIGHT(params->weights, mw, 0, params->chan_start, 0)),
+                mw);
+  }
+}
+
+static void _conv_errors_worker(void *in, void *out) {
+  layer_params *params = (layer_params *) in;
+  conv_layer *conv = params->conv;
+  const conv_spec *spec = conv->spec;
+  int mw = params->config->max_width;
+  int positions = conv->positions;
+  int area = spec->kernel * spec->kernel;
+  int first = params->in_start * area;
+  int last = params->in_end * area;
+  if (first >= last) {
+    return;
+  }
+  /* Push the derivatives back through the old filters to each entry of the
+   * im2col matrix... */
+  matrix_gemm(1, 0, last - first, positions, spec->filters, 1,
+              &(GET_WEIGHT(params->oldw_w, mw, 0, 0, first)), mw,
+              conv->dconv, positions, 0, &(conv->dcol[first * positions]),
+              positions);
+  /* ...then add up every entry that came from the same input */
+  int size = spec->height * spec->width;
+  memset(&(conv->errors[params->in_start * size]), 0,
+         sizeof(double) * (params->in_end - params->in_start) * size);
+  for (int row = first; row < last; row++) {
+    int channel = row / area;
+    int ky = (row / spec->kernel) % spec->kernel;
+    int kx = row % spec->kernel;
+    double *errors = &(conv->errors[channel * size]);
+    const double *dcol = &(conv->dcol[row * positions]);
+    for (int pos = 0; pos < positions; pos++) {
+      int iy = (pos / conv->conv_w) * conv->stride + ky - spec->padding;
+      int ix = (pos % conv->conv_w) * conv->stride + kx - spec->padding;
+      if (iy >= 0 && iy < spec->height && ix >= 0 && ix < spec->width) {
+        errors[iy * spec->width + ix] += dcol[pos];
+      }
+    }
+  }
+}
+
+static int _save_header(neuralnet *net, FILE *stream, int lowrank) {
+  const activation_info *act = activation_find(net->config.activation);
+  if (!act) {
+    fprintf(stderr, "neuralnet_save: unknown activation function\n");
+    return 0;
+  }
+  char act_name[MODEL_ACTIVATION_LEN] = { 0 };
+  strncpy(act_name, act->name, MODEL_ACTIVATION_LEN - 1);
+  int version = net->conv ? MODEL_VERSION_CONV : MODEL_VERSION;
+  if (lowrank) {
+    version = MODEL_VERSION_LOWRANK;
+  }
+  /* We store the max width the user asked for, not our padded one */
+  int header[4] = { version, net->config.layers, net->config.dimensionality,
+                    net->config.max_width - 1 };
+  double params[2] = { net->config.alpha, net->config.iscale };
+  return fwrite(MODEL_MAGIC, 1, strlen(MODEL_MAGIC), stream) ==
+           strlen(MODEL_MAGIC) &&
+         fwrite(header, sizeof(int), 4, stream) == 4 &&
+         fwrite(params, sizeof(double), 2, stream) == 2 &&
+         fwrite(act_name, 1, MODEL_ACTIVATION_LEN, stream) ==
+           MODEL_ACTIVATION_LEN &&
+         fwrite(net->config.layer_sizes, sizeof(int), net->config.layers,
+                stream) == net->config.layers &&
+         _save_conv(net, stream, lowrank);
+}
+
+static int _save_conv(neuralnet *net, FILE *stream, int always) {
+  if (!net->conv && !always) {
+    return 1;
+  }
+  for (int layer = 0; layer < net->config.layers; layer++) {
+    /* Dense layers get an all zero spec */
+    int spec[MODEL_CONV_INTS] = { 0 };
+    if (_is_conv(&(net->config), layer)) {
+      const conv_spec *conv = &(net->config.conv[layer]);
+      spec[0] = conv->filters;
+      spec[1] = conv->channels;
+      spec[2] = conv->height;
+      spec[3] = conv->width;
+      spec[4] = conv->kernel;
+      spec[5] = conv->stride;
+      spec[6] = conv->padding;
+      spec[7] = conv->pool;
+    }
+    if (fwrite(spec, sizeof(int), MODEL_CONV_INTS, stream) !=
+        MODEL_CONV_INTS) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int _layer_inputs(const netconfig *config, int layer) {
+  return layer ? config->layer_sizes[layer - 1] : config->dimensionality;
+}
+
+static int _is_conv(const netconfig *config, int layer) {
+  return config->conv && config->conv[layer].filters;
+}
+
+static int _layer_rows(const netconfig *config, int layer) {
+  if (_is_conv(config, layer)) {
+    return config->conv[layer].filters;
+  }
+  return config->layer_sizes[layer];
+}
+
+static int _layer_weights(const netconfig *config, int layer) {
+  if (_is_conv(config, layer)) {
+    const conv_spec *spec = &(config->conv[layer]);
+    return spec->channels * spec->kernel * spec->kernel;
+  }
+  return _layer_inputs(config, layer);
+}
+
+static double _layer_cost(const netconfig *config, int layer) {
+  double cost = (double) _layer_rows(config, layer) *
+                (_layer_weights(config, layer) + 1);
+  if (_is_conv(config, layer)) {
+    /* Every filter gets applied at every position */
+    conv_layer conv;
+    _conv_shape(&(config->conv[layer]), &conv);
+    cost *= conv.positions;
+  }
+  return cost;
+}
+
+static int _check_conv(const netconfig *config) {
+  if (!config->conv) {
+    return 1;
+  }
+  if (_is_conv(config, config->layers - 1)) {
+    fprintf(stderr, "neuralnet_create: the last layer has to be dense\n");
+    return 0;
+  }
+  for (int layer = 0; layer < config->layers; layer++) {
+    if (!_is_conv(config, layer)) {
+      continue;
+    }
+    const conv_spec *spec = &(config->conv[layer]);
+    if (spec->filters < 0 || spec->channels <= 0 || spec->height <= 0 ||
+        spec->width <= 0 || spec->kernel <= 0 || spec->stride < 0 ||
+        spec->padding < 0 || spec->pool < 0 ||
+        spec->kernel > spec->height + 2 * spec->padding ||
+        spec->kernel > spec->width + 2 * spec->padding) {
+      fprintf(stderr, "neuralnet_create: bad conv spec for layer %d\n",
+              layer);
+      return 0;
+    }
+    if (spec->channels * spec->height * spec->width !=
+        _layer_inputs(config, layer)) {
+      fprintf(stderr, "neuralnet_create: layer %d's input shape doesn't "
+              "match its inputs\n", layer);
+      return 0;
+    }
+    conv_layer conv;
+    _conv_shape(spec, &conv);
+    if (conv.out_h <= 0 || conv.out_w <= 0 ||
+        spec->filters * conv.out_h * conv.out_w !=
+          config->layer_sizes[layer]) {
+      fprintf(stderr, "neuralnet_create: layer %d should have size %d\n",
+              layer, spec->filters * conv.out_h * conv.out_w);
+      return 0;
+    }
+    if (conv.cols > config->max_width || spec->filters > config->max_width) {
+      fprintf(stderr, "neuralnet_create: layer %d's filters don't fit in "
+              "max_width\n", layer);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void _conv_shape(const conv_spec *spec, conv_layer *conv) {
+  conv->spec = spec;
+  conv->stride = spec->stride ? spec->stride : 1;
+  conv->pool = spec->pool ? spec->pool : 1;
+  conv->conv_h = (spec->height + 2 * spec->padding - spec->kernel) /
+                 conv->stride + 1;
+  conv->conv_w = (spec->width + 2 * spec->padding - spec->kernel) /
+                 conv->stride + 1;
+  /* Whatever doesn't fill a whole pooling window gets dropped */
+  conv->out_h = conv->conv_h / conv->pool;
+  conv->out_w = conv->conv_w / conv->pool;
+  conv->cols = spec->channels * spec->kernel * spec->kernel;
+  conv->positions = conv->out_h * conv->pool * conv->conv_w;
+}
+
+static int _init_conv(neuralnet *net) {
+  const netconfig *config = &(net->config);
+  int any = 0;
+  for (int layer = 0; layer < config->layers; layer++) {
+    any |= _is_conv(config, layer);
+  }
+  /* A net whose specs are all dense is just a dense net */
+  if (!any) {
+    return 1;
+  }
+  net->conv = calloc(config->layers, sizeof(conv_layer));
+  if (!net->conv) {
+    return 0;
+  }
+  for (int layer = 0; layer < config->layers; layer++) {
+    if (!_is_conv(config, layer)) {
+      continue;
+    }
+    const conv_spec *spec = &(config->conv[layer]);
+    conv_layer *conv = &(net->conv[layer]);
+    _conv_shape(spec, conv);
+    int filter_size = conv->cols * conv->positions;
+    int out_size = spec->filters * conv->positions;
+    conv->col = malloc(sizeof(double) * filter_size);
+    conv->pre = malloc(sizeof(double) * out_size);
+    if (!conv->col || !conv->pre) {
+      return 0;
+    }
+    if (filter_size + out_size > net->layer_scratch) {
+      net->layer_scratch = filter_size + out_size;
+    }
+    /* Only back propagation needs the rest */
+    if (config->inference_only) {
+      continue;
+    }
+    conv->argmax = malloc(sizeof(int) * config->layer_sizes[layer]);
+    conv->dconv = malloc(sizeof(double) * out_size);
+    conv->dcol = malloc(sizeof(double) * filter_size);
+    conv->errors = malloc(sizeof(double) * _layer_inputs(config, layer));
+    if (!conv->argmax || !conv->dconv || !conv->dcol || !conv->errors) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void _free_conv(neuralnet *net) {
+  if (!net->conv) {
+    return;
+  }
+  for (int layer = 0; layer < net->config.layers; layer++) {
+    conv_layer *conv = &(net->conv[layer]);
+    free(conv->col);
+    free(conv->pre);
+    free(conv->argmax);
+    free(conv->dconv);
+    free(conv->dcol);
+    free(conv->errors);
+  }
+  free(net->conv);
+  net->conv = NULL;
+}
+
+static int _layer_svd(neuralnet *net, int layer, double **us, double **s,
+                      double **v, const char *who) {
+  int rows = _layer_rows(&(net->config), layer);
+  int in = _layer_inputs(&(net->config), layer);
+  *us = malloc(sizeof(double) * rows * in);
+  *s = malloc(sizeof(double) * in);
+  *v = malloc(sizeof(double) * in * in);
+  double *row = malloc(sizeof(double) * (in + 1));
+  if (!*us || !*s || !*v || !row) {
+    perror(who);
+    free(*us);
+    free(*s);
+    free(*v);
+    free(row);
+    return 0;
+  }
+  /* Factoring a factored layer again factors its A * B */
+  for (int neuron = 0; neuron < rows; neuron++) {
+    _dense_row(net, layer, neuron, row);
+    memcpy(&((*us)[neuron * in]), row, sizeof(double) * in);
+  }
+  free(row);
+  if (!matrix_svd(rows, in, *us, in, *s, *v, in)) {
+    fprintf(stderr, "%s: SVD of layer %d didn't converge\n", who, layer);
+    free(*us);
+    free(*s);
+    free(*v);
+    return 0;
+  }
+  return 1;
+}
+
+static int _set_lowrank(neuralnet *net, int layer, int rank,
+                        const double *us, const double *v, const char *who) {
+  int mw = net->config.max_width;
+  int rows = _layer_rows(&(net->config), layer);
+  int in = _layer_inputs(&(net->config), layer);
+  double *a = malloc(sizeof(double) * rows * rank);
+  double *b = malloc(sizeof(double) * rank * in);
+  double *bias = malloc(sizeof(double) * rows);
+  if (!a || !b || !bias) {
+    perror(who);
+    free(a);
+    free(b);
+    free(bias);
+    return 0;
+  }
+  /* A is the first rank columns of US, B the first rank columns of V
+   * turned on their side */
+  for (int neuron = 0; neuron < rows; neuron++) {
+    memcpy(&(a[neuron * rank]), &(us[neuron * in]), sizeof(double) * rank);
+  }
+  for (int k = 0; k < rank; k++) {
+    for (int input = 0; input < in; input++) {
+      b[k * in + input] = v[input * in + k];
+    }
+  }
+  for (int neuron = 0; neuron < rows; neuron++) {
+    bias[neuron] = _is_factored(net, layer) ?
+                   net->lowrank[layer].bias[neuron] :
+                   GET_WEIGHT(_weights_of(net, layer), mw, 0, neuron, in);
+  }
+  return _use_lowrank(net, layer, rank, a, b, bias, who);
+}
+
+static int _use_lowrank(neuralnet *net, int layer, int rank, double *a,
+                        double *b, double *bias, const char *who) {
+  if (!net->lowrank) {
+    net->lowrank = calloc(net->config.layers, sizeof(lowrank_layer));
+  }
+  double *h = malloc(sizeof(double) * rank);
+  if (!net->lowrank || !h) {
+    perror(who);
+    free(a);
+    free(b);
+    free(bias);
+    free(h);
+    return 0;
+  }
+  lowrank_layer *lr = &(net->lowrank[layer]);
+  free(lr->a);
+  free(lr->b);
+  free(lr->bias);
+  free(lr->h);
+  lr->rank = rank;
+  lr->a = a;
+  lr->b = b;
+  lr->bias = bias;
+  lr->h = h;
+  layer_params *params = &(net->l_params[layer * net->jobs]);
+  for (int t = 0; t < params->jobs; t++) {
+    params[t].lowrank = lr;
+    params[t].rank_start = (int) ((long) rank * t / params->jobs);
+    params[t].rank_end = (int) ((long) rank * (t + 1) / params->jobs);
+  }
+  /* Feeding forward serially keeps B times the inputs in the scratch */
+  if (net->layer_scratch < rank) {
+    net->layer_scratch = rank;
+  }
+  return 1;
+}
+
+static int _is_factored(const neuralnet *net, int layer) {
+  return net->lowrank && net->lowrank[layer].rank;
+}
+
+static double *_weights_of(neuralnet *net, int layer) {
+  return net->l_params[layer * net->jobs].weights;
+}
+
+static void _dense_row(neuralnet *net, int layer, int neuron, double *row) {
+  int count = _layer_weights(&(net->config), layer);
+  if (!_is_factored(net, layer)) {
+    memcpy(row, &(GET_WEIGHT(_weights_of(net, layer), net->config.max_width,
+                             0, neuron, 0)),
+           sizeof(double) * (count + 1));
+    return;
+  }
+  const lowrank_layer *lr = &(net->lowrank[layer]);
+  matrix_gemm(0, 0, 1, count, lr->rank, 1, &(lr->a[neuron * lr->rank]),
+              lr->rank, lr->b, count, 0, row, count);
+  row[count] = lr->bias[neuron];
+}
+
+static int _pack_weights(neuralnet *net, int all, const char *who) {
+  int mw = net->config.max_width;
+  int dense = 0;
+  int changed = 0;
+  for (int layer = 0; layer < net->config.layers; layer++) {
+    int keep = all || !_is_factored(net, layer);
+    dense += keep;
+    changed |= keep != (_weights_of(net, layer) != NULL);
+  }
+  if (!changed) {
+    return 1;
+  }
+  /* calloc so the padding past each neuron's bias is 0, like
+   * neuralnet_create leaves it */
+  double *w = calloc((size_t) mw * mw * dense, sizeof(double));
+  if (!w && dense) {
+    perror(who);
+    return 0;
+  }
+  int slab = 0;
+  for (int layer = 0; layer < net->config.layers; layer++) {
+    layer_params *params = &(net->l_params[layer * net->jobs]);
+    double *weights = NULL;
+    if (all || !_is_factored(net, layer)) {
+      weights = &(GET_WEIGHT(w, mw, slab++, 0, 0));
+      if (params->weights) {
+        memcpy(weights, params->weights, sizeof(double) * mw * mw);
+      }
+    }
+    for (int t = 0; t < params->jobs; t++) {
+      params[t].weights = weights;
+    }
+  }
+  free(net->w);
+  net->w = w;
+  return 1;
+}
+
+static int _save_lowrank(neuralnet *net, int layer, FILE *stream) {
+  const lowrank_layer *lr = &(net->lowrank[layer]);
+  if (fwrite(&(lr->rank), sizeof(int), 1, stream) != 1) {
+    return 0;
+  }
+  if (!lr->rank) {
+    return 1;
+  }
+  int rows = _layer_rows(&(net->config), layer);
+  int in = _layer_inputs(&(net->config), layer);
+  return fwrite(lr->a, sizeof(double), rows * lr->rank, stream) ==
+           rows * lr->rank &&
+         fwrite(lr->b, sizeof(double), lr->rank * in, stream) ==
+           lr->rank * in &&
+         fwrite(lr->bias, sizeof(double), rows, stream) == rows;
+}
+
+static int _load_lowrank(neuralnet *net, int layer, FILE *stream,
+                         const char *who) {
+  int rank;
+  if (fread(&rank, sizeof(int), 1, stream) != 1) {
+    fprintf(stderr, "%s: truncated model\n", who);
+    return 0;
+  }
+  if (!rank) {
+    return 1;
+  }
+  if (!_check_lowrank(net, layer, rank, who)) {
+    return 0;
+  }
+  int rows = _layer_rows(&(net->config), layer);
+  int in = _layer_inputs(&(net->config), layer);
+  double *a = malloc(sizeof(double) * rows * rank);
+  double *b = malloc(sizeof(double) * rank * in);
+  double *bias = malloc(sizeof(double) * rows);
+  if (!a || !b || !bias) {
+    perror(who);
+    free(a);
+    free(b);
+    free(bias);
+    return 0;
+  }
+  if (fread(a, sizeof(double), rows * rank, stream) != rows * rank ||
+      fread(b, sizeof(double), rank * in, stream) != rank * in ||
+      fread(bias, sizeof(double), rows, stream) != rows) {
+    fprintf(stderr, "%s: truncated model\n", who);
+    free(a);
+    free(b);
+    free(bias);
+    return 0;
+  }
+  return _use_lowrank(net, layer, rank, a, b, bias, who);
+}
+
+static double _reconstruction(const double *s, int count, int rank) {
+  double total = 0;
+  double dropped = 0;
+  for (int k = 0; k < count; k++) {
+    total += s[k] * s[k];
+    if (k >= rank) {
+      dropped += s[k] * s[k];
+    }
+  }
+  return total > 0 ? sqrt(dropped / total) : 0;
+}
+
+static int _check_lowrank(neuralnet *net, int layer, int rank,
+                          const char *who) {
+  if (layer < 0 || layer >= net->config.layers) {
+    fprintf(stderr, "%s: no layer %d\n", who, layer);
+    return 0;
+  }
+  if (_is_conv(&(net->config), layer)) {
+    fprintf(stderr, "%s: layer %d is convolutional\n", who, layer);
+    return 0;
+  }
+  int rows = _layer_rows(&(net->config), layer);
+  int in = _layer_inputs(&(net->config), layer);
+  int most = rows < in ? rows : in;
+  if (rank < 1 || rank > most) {
+    fprintf(stderr, "%s: rank %d isn't between 1 and %d\n", who, rank, most);
+    return 0;
+  }
+  return 1;
+}
+
+static void _drop_lowrank(neuralnet *net, int layer) {
+  if (!net->lowrank) {
+    return;
+  }
+  lowrank_layer *lr = &(net->lowrank[layer]);
+  free(lr->a);
+  free(lr->b);
+  free(lr->bias);
+  free(lr->h);
+  lr->rank = 0;
+  lr->a = NULL;
+  lr->b = NULL;
+  lr->bias = NULL;
+  lr->h = NULL;
+  layer_params *params = &(net->l_params[layer * net->jobs]);
+  for (int t = 0; t < params->jobs; t++) {
+    params[t].lowrank = NULL;
+  }
+  /* Training is fine again once nothing's factored */
+  for (int l = 0; l < net->config.layers; l++) {
+    if (net->lowrank[l].rank) {
+      return;
+    }
+  }
+  free(net->lowrank);
+  net->lowrank = NULL;
+}
+
+static void _free_lowrank(neuralnet *net) {
+  if (!net->lowrank) {
+    return;
+  }
+  for (int layer = 0; layer < net->config.layers; layer++) {
+    free(net->lowrank[layer].a);
+    free(net->lowrank[layer].b);
+    free(net->lowrank[layer].bias);
+    free(net->lowrank[layer].h);
+  }
+  free(net->lowrank);
+  net->lowrank = NULL;
+}
+
+static void _export_dot(FILE *stream, const char *inputs, int from, int to) {
+  for (int input = from; input < to; input++) {
+    fprintf(stream, "    acc += w[%d] * %s[%d];\n", input, inputs, input);
+  }
+}
+
 void neuralnet_dump(neuralnet *net, FILE *stream) {
   fprintf(stream, "Dumping neural net\n");
   int mw = net->config.max_width;
+  double *row = malloc(sizeof(double) * mw);
+  if (!row) {
+    perror("neuralnet_dump");
+    return;
+  }
   for (int layer = 0; layer < net->config.layers; layer++) {
     fprintf(stream, "\tDumping layer %d\n", layer);
-    for (int neuron = 0; neuron < net->config.layer_sizes[layer]; neuron++) {
+    for (int neuron = 0; neuron < _layer_rows(&(net->config), layer);
+         neuron++) {
       fprintf(stream, "\t\tDumping neuron %d\n", neuron);
       fprintf(stream, "\t\t\tWeights\n\t\t\t");
-      int total = layer ? net->config.layer_sizes[layer - 1] : net->config.dimensionality;
+      int total = _layer_weights(&(net->config), layer);
+      _dense_row(net, layer, neuron, row);
       int input;
       for (input = 0; input < total; input++) {
-        fprintf(stream, "%f * ", GET_WEIGHT(net->w, mw, layer, neuron, input));
+        fprintf(stream, "%f * ", row[input]);
       }
-      fprintf(stream, "%f\n", GET_WEIGHT(net->w, mw, layer, neuron, input));
+      fprintf(stream, "%f\n", row[input]);
       fprintf(stream, "\t\t\tOutput: %f\n", net->out[(mw * layer) + neuron]);
     }
   }
+  free(row);
 }
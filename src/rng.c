@@ -0,0 +1,62 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "rng.h"
+
+/**
+ * The golden ratio increment SplitMix64 steps its state by.
+ */
+#define GOLDEN_GAMMA 0x9E3779B97F4A7C15ULL
+
+/**
+ * 2^-53: turns the top 53 bits of a random number into a double in [0, 1).
+ */
+#define DOUBLE_UNIT (1.0 / 9007199254740992.0)
+
+/**
+ * The SplitMix64 finalizer.
+ */
+static unsigned long long _mix(unsigned long long z);
+
+unsigned long long rng_at(unsigned long long seed,
+                          unsigned long long counter) {
+  /* Hash the seed first, so that nearby seeds give unrelated streams rather
+   * than the same stream shifted over by a bit */
+  return _mix(_mix(seed) + (counter + 1) * GOLDEN_GAMMA);
+}
+
+double rng_uniform_at(unsigned long long seed, unsigned long long counter) {
+  return (rng_at(seed, counter) >> 11) * DOUBLE_UNIT;
+}
+
+void rng_init(rng *r, unsigned long long seed) {
+  r->seed = seed;
+  r->counter = 0;
+}
+
+unsigned long long rng_next(rng *r) {
+  return rng_at(r->seed, r->counter++);
+}
+
+double rng_uniform(rng *r) {
+  return rng_uniform_at(r->seed, r->counter++);
+}
+
+static unsigned long long _mix(unsigned long long z) {
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
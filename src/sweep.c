@@ -0,0 +1,253 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "sweep.h"
+#include "activations.h"
+#include "threadpool.h"
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/**
+ * One configuration being swept.
+ */
+typedef struct _candidate {
+  neuralnet *net; /* The net, or NULL once it's been cut */
+  const sweepconfig *config; /* How we're sweeping */
+  const double *inputs; /* The shared inputs */
+  const double *labels; /* The shared labels */
+  int input_count; /* How many inputs there are */
+  int epochs; /* How many epochs to train for this rung */
+  sweepresult *result; /* Where to keep track of how it's doing */
+} candidate;
+
+/**
+ * Train one candidate for its epochs, then see how it does. Meant for a
+ * threadpool, one candidate per job.
+ */
+static void _train_worker(void *in, void *out);
+
+/**
+ * qsort comparator putting the candidates with the lowest mse first.
+ */
+static int _compare_candidates(const void *a, const void *b);
+
+/**
+ * Which of two results is better, in the sense of qsort: negative if a is.
+ * Configurations that trained longer come first, then the lowest mse.
+ */
+static int _compare_results(const sweepresult *a, const sweepresult *b);
+
+/**
+ * qsort comparator ordering pointers to results by _compare_results.
+ */
+static int _compare_result_ptrs(const void *a, const void *b);
+
+int sweep_run(const netconfig *configs, int count, const double *inputs,
+              const double *labels, int input_count, sweepconfig config,
+              sweepresult *results) {
+  if (count <= 0 || input_count <= 0 || config.epochs <= 0 ||
+      config.batch_size <= 0 || config.rung_epochs <= 0 ||
+      config.keep <= 0 || config.keep > 1 || config.threads <= 0) {
+    fprintf(stderr, "sweep_run: invalid configuration\n");
+    return 0;
+  }
+  if (!config.val_inputs) {
+    config.val_inputs = inputs;
+    config.val_labels = labels;
+    config.val_count = input_count;
+  }
+  candidate *cands = calloc(count, sizeof(candidate));
+  candidate **alive = malloc(sizeof(candidate *) * count);
+  threadpool *pool = NULL;
+  if (!cands || !alive || !threadpool_create(&pool, config.threads)) {
+    perror("sweep_run");
+    free(cands);
+    free(alive);
+    return 0;
+  }
+  int alive_count = 0;
+  for (int i = 0; i < count; i++) {
+    netconfig conf = configs[i];
+    /* The sweep does the threading, one net per worker */
+    conf.threads = 0;
+    conf.pool = NULL;
+    conf.inference_only = 0;
+    sweepresult *result = &(results[i]);
+    result->epochs = 0;
+    result->stopped = 0;
+    result->ok = neuralnet_create(&(cands[i].net), conf);
+    result->metrics.mse = NAN;
+    result->metrics.cross_entropy = NAN;
+    result->metrics.accuracy = 0;
+    result->metrics.count = 0;
+    if (!result->ok) {
+      cands[i].net = NULL;
+      continue;
+    }
+    cands[i].config = &config;
+    cands[i].inputs = inputs;
+    cands[i].labels = labels;
+    cands[i].input_count = input_count;
+    cands[i].result = result;
+    alive[alive_count++] = &(cands[i]);
+  }
+  int trained = 0;
+  while (trained < config.epochs && alive_count) {
+    int rung = config.epochs - trained;
+    if (rung > config.rung_epochs) {
+      rung = config.rung_epochs;
+    }
+    for (int i = 0; i < alive_count; i++) {
+      alive[i]->epochs = rung;
+    }
+    threadpool_submit(pool, NULL, _train_worker, (unsigned char *) alive,
+                      sizeof(candidate *), alive_count, 0);
+    trained += rung;
+    /* Whatever broke is out, whatever's left gets ranked */
+    int kept = 0;
+    for (int i = 0; i < alive_count; i++) {
+      if (alive[i]->result->ok) {
+        alive[kept++] = alive[i];
+      } else {
+        neuralnet_destroy(alive[i]->net);
+        alive[i]->net = NULL;
+      }
+    }
+    alive_count = kept;
+    if (trained >= config.epochs) {
+      break;
+    }
+    qsort(alive, alive_count, sizeof(candidate *), _compare_candidates);
+    kept = (int) ceil(alive_count * config.keep);
+    if (kept < 1) {
+      kept = 1;
+    }
+    /* Free the losers now, no point holding on to them */
+    for (int i = kept; i < alive_count; i++) {
+      alive[i]->result->stopped = 1;
+      neuralnet_destroy(alive[i]->net);
+      alive[i]->net = NULL;
+    }
+    if (kept < alive_count) {
+      alive_count = kept;
+    }
+  }
+  threadpool_destroy(pool);
+  for (int i = 0; i < count; i++) {
+    if (cands[i].net) {
+      neuralnet_destroy(cands[i].net);
+    }
+  }
+  free(alive);
+  free(cands);
+  return 1;
+}
+
+void sweep_report(const netconfig *configs, int count,
+                  const sweepresult *results, FILE *stream) {
+  const sweepresult **order = malloc(sizeof(sweepresult *) * count);
+  if (!order) {
+    perror("sweep_report");
+    return;
+  }
+  for (int i = 0; i < count; i++) {
+    order[i] = &(results[i]);
+  }
+  qsort(order, count, sizeof(sweepresult *), _compare_result_ptrs);
+  fprintf(stream, "%-5s %-9s %-9s %-14s %-20s %-7s %-11s %-11s %-9s %s\n",
+          "rank", "alpha", "iscale", "activation", "layers", "epochs", "mse",
+          "xent", "accuracy", "status");
+  for (int r = 0; r < count; r++) {
+    const sweepresult *result = order[r];
+    const netconfig *conf = &(configs[result - results]);
+    const activation_info *act = activation_find(conf->activation);
+    /* Lay the shape out like 2-4-1, inputs first */
+    char layers[21];
+    int len = snprintf(layers, sizeof(layers), "%d", conf->dimensionality);
+    for (int l = 0; l < conf->layers && len < (int) sizeof(layers); l++) {
+      len += snprintf(layers + len, sizeof(layers) - len, "-%d",
+                      conf->layer_sizes[l]);
+    }
+    const char *status = "done";
+    if (!result->ok) {
+      status = "failed";
+    } else if (result->stopped) {
+      status = "cut";
+    }
+    fprintf(stream,
+            "%-5d %-9g %-9g %-14s %-20s %-7d %-11.6g %-11.6g %-9.4f %s\n",
+            r + 1, conf->alpha, conf->iscale, act ? act->name : "custom",
+            layers, result->epochs, result->metrics.mse,
+            result->metrics.cross_entropy, result->metrics.accuracy, status);
+  }
+  free(order);
+}
+
+static void _train_worker(void *in, void *out) {
+  candidate *cand = *((candidate **) in);
+  const sweepconfig *config = cand->config;
+  int in_dim = neuralnet_input_size(cand->net);
+  int out_dim = neuralnet_output_size(cand->net);
+  int ok = 1;
+  for (int e = 0; e < cand->epochs && ok; e++) {
+    for (int start = 0; start < cand->input_count;
+         start += config->batch_size) {
+      int batch = cand->input_count - start;
+      if (batch > config->batch_size) {
+        batch = config->batch_size;
+      }
+      ok &= neuralnet_train(cand->net, &(cand->inputs[start * in_dim]),
+                            &(cand->labels[start * out_dim]), batch);
+    }
+    cand->result->epochs++;
+  }
+  ok &= neuralnet_evaluate(cand->net, config->val_inputs, config->val_labels,
+                           config->val_count, &(cand->result->metrics));
+  cand->result->ok = ok;
+}
+
+static int _compare_candidates(const void *a, const void *b) {
+  const candidate *ca = *((const candidate **) a);
+  const candidate *cb = *((const candidate **) b);
+  int cmp = _compare_results(ca->result, cb->result);
+  /* Ties go to whichever came first, so the cut doesn't depend on qsort */
+  return cmp ? cmp : (ca > cb) - (ca < cb);
+}
+
+static int _compare_results(const sweepresult *a, const sweepresult *b) {
+  if (a->ok != b->ok) {
+    return b->ok - a->ok;
+  }
+  if (a->epochs != b->epochs) {
+    return b->epochs - a->epochs;
+  }
+  /* A net that blew up is as bad as it gets */
+  if (isnan(a->metrics.mse) || isnan(b->metrics.mse)) {
+    return !!isnan(a->metrics.mse) - !!isnan(b->metrics.mse);
+  }
+  if (a->metrics.mse != b->metrics.mse) {
+    return a->metrics.mse < b->metrics.mse ? -1 : 1;
+  }
+  return 0;
+}
+
+static int _compare_result_ptrs(const void *a, const void *b) {
+  const sweepresult *ra = *((const sweepresult **) a);
+  const sweepresult *rb = *((const sweepresult **) b);
+  int cmp = _compare_results(ra, rb);
+  return cmp ? cmp : (ra > rb) - (ra < rb);
+}
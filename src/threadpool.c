@@ -15,34 +15,42 @@
  * along with helios.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "threadpool.h"
+#include "trace.h"
 #include <pthread.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
 
-enum _status {
-  STOPPED = 0,
-  RUNNABLE,
-  RUNNING,
+/**
+ * One call to threadpool_submit. Lives on the submitter's stack.
+ */
+struct _batch {
+  void (*func) (void *, void *); /* The job function */
+  unsigned char *arguments; /* The jobs' arguments */
+  size_t arg_size; /* The size of each argument */
+  unsigned char *retvals; /* The jobs' return values, or NULL */
+  size_t retval_size; /* The size of each return value */
+  int count; /* How many jobs there are */
+  int next; /* The next job to hand out */
+  int done; /* How many jobs have finished */
+  struct _batch *next_batch; /* The next batch waiting for a worker */
 };
 
 struct _worker {
-  enum _status status; /* The status */
-  void (*func) (void *, void *); /* The job function */
-  void *arg; /* The job's argument */
-  void *retval; /* The job's return value */
   threadpool *parent; /* The threadpool that created this */
   pthread_t thread; /* The posix thread for this worker */
-  int job_index; /* The index of the running job */
-  int done; /* Whether this job has just finished and hasn't been harvested */
 };
 
 struct _threadpool {
   int count; /* How many threads? */
-  int running; /* Am I running a job? */
+  int running; /* How many submissions are in flight */
+  int stopping; /* Whether the workers should exit */
   struct _worker *workers; /* The worker structs */
+  struct _batch *head; /* The batches with jobs left to hand out, */
+  struct _batch *tail; /* taken round robin from the head */
   pthread_mutex_t lock; /* The pool's lock */
-  pthread_cond_t cv; /* The pool's cv - indicates change of thread state */
+  pthread_cond_t cv; /* The pool's cv - there's work, or we're stopping */
+  pthread_cond_t done_cv; /* Some batch just finished */
   int initializing; /* How many workers are initializing */
 };
 
@@ -66,34 +74,48 @@ int threadpool_create(threadpool **retval, int threadcount) {
     pthread_mutex_destroy(&(pool->lock));
     return 0;
   }
+  if (pthread_cond_init(&(pool->done_cv), NULL)) {
+    free(pool);
+    pthread_cond_destroy(&(pool->cv));
+    pthread_mutex_destroy(&(pool->lock));
+    return 0;
+  }
   pool->workers = calloc(threadcount, sizeof(struct _worker));
   if (pool->workers == NULL) {
     free(pool);
+    pthread_cond_destroy(&(pool->done_cv));
     pthread_cond_destroy(&(pool->cv));
     pthread_mutex_destroy(&(pool->lock));
     return 0;
   }
   pool->count = threadcount;
   pool->initializing = 0;
+  pool->running = 0;
+  pool->stopping = 0;
+  pool->head = NULL;
+  pool->tail = NULL;
   pthread_mutex_lock(&(pool->lock));
   for (int i = 0; i < threadcount; i++) {
     struct _worker *w = &(pool->workers[i]);
+    /* The worker reads this as soon as it starts, so it has to be set
+     * before it exists */
+    w->parent = pool;
     if(pthread_create(&(w->thread), NULL, _worker_func, (void *) w)) {
+      /* Only the workers we did start need stopping */
+      pool->count = i;
       /* Gotta be initialized to be able to destroy */
       while (pool->initializing) {
-        pthread_cond_wait(&(pool->cv), &(pool->lock));
+        pthread_cond_wait(&(pool->done_cv), &(pool->lock));
       }
       /* destroy is gonna lock it again */
       pthread_mutex_unlock(&(pool->lock));
       threadpool_destroy(pool);
       return 0;
     }
-    w->parent = pool;
-    w->status = RUNNABLE;
     pool->initializing++;
   }
   while (pool->initializing) {
-    pthread_cond_wait(&(pool->cv), &(pool->lock));
+    pthread_cond_wait(&(pool->done_cv), &(pool->lock));
   }
   pthread_mutex_unlock(&(pool->lock));
   /* At this stage all the threads will collapse into their waits */
@@ -104,102 +126,114 @@ int threadpool_create(threadpool **retval, int threadcount) {
 int threadpool_destroy(threadpool *pool) {
   assert(pool != NULL);
   pthread_mutex_lock(&(pool->lock));
+  /* Let anyone still submitting finish */
   while (pool->running) {
-    pthread_cond_wait(&(pool->cv), &(pool->lock));
-  }
-  /* It's not supposed to be running any more jobs, but let's just make sure 
-   * here aren't any runaway threads, then stop them one by one */
-  int t;
-  for (t = 0; t < pool->count; t++) {
-    struct _worker *w = &(pool->workers[t]);
-    while (w->status == RUNNING) {
-      pthread_cond_wait(&(pool->cv), &(pool->lock));
-    }
-    w->status = STOPPED;
+    pthread_cond_wait(&(pool->done_cv), &(pool->lock));
   }
+  pool->stopping = 1;
   pthread_cond_broadcast(&(pool->cv));
   pthread_mutex_unlock(&(pool->lock));
   /* They're all gonna exit now, so just join them */
-  for (t = 0; t < pool->count; t++) {
+  for (int t = 0; t < pool->count; t++) {
     struct _worker *w = &(pool->workers[t]);
     pthread_join(w->thread, NULL);
   }
   free(pool->workers);
+  pthread_cond_destroy(&(pool->done_cv));
   pthread_cond_destroy(&(pool->cv));
   pthread_mutex_destroy(&(pool->lock));
   free(pool);
   return 1;
 }
 
+int threadpool_size(threadpool *pool) {
+  return pool->count;
+}
+
 int threadpool_submit(threadpool *pool, unsigned char *retvals,
     void (*mapper)(void *, void *), unsigned char *arguments, size_t arg_size,
     int arg_count, size_t retval_size) {
-  int submitted = 0;
-  int done = 0;
-  int t = 0;
+  if (arg_count <= 0) {
+    return 1;
+  }
+  unsigned long long start = trace_begin();
+  struct _batch batch;
+  batch.func = mapper;
+  batch.arguments = arguments;
+  batch.arg_size = arg_size;
+  batch.retvals = retvals;
+  batch.retval_size = retval_size;
+  batch.count = arg_count;
+  batch.next = 0;
+  batch.done = 0;
+  batch.next_batch = NULL;
   pthread_mutex_lock(&(pool->lock));
-  pool->running = 1;
-  /* We're only gonna signal once per big loop, and we don't wanna do it
-   * unless we've actually woken up a thread */
-  int signal = 0;
-  while (done < arg_count) {
-    for (t = 0; t < pool->count; t++) {
-      struct _worker *w = &(pool->workers[t]);
-      if (w->status == RUNNABLE) {
-        if (w->done) {
-          done++;
-          w->done = 0;
-        }
-        if (submitted < arg_count) {
-          signal = 1;
-          w->job_index = submitted;
-          w->func = mapper;
-          if (retvals) {
-            w->retval = (void *) (retvals + (submitted * retval_size));
-          } else {
-            w->retval = NULL;
-          }
-          w->arg = (void *) (arguments + (submitted * arg_size));
-          w->status = RUNNING;
-          submitted++;
-        }
-      }
-    }
-    if (signal) {
-      pthread_cond_broadcast(&(pool->cv));
-    }
-    /* If we're all done, we're not getting a wake-up call */
-    if (done < arg_count) {
-      pthread_cond_wait(&(pool->cv), &(pool->lock));
-    }
+  pool->running++;
+  if (pool->tail) {
+    pool->tail->next_batch = &batch;
+  } else {
+    pool->head = &batch;
   }
-  pool->running = 0;
+  pool->tail = &batch;
   pthread_cond_broadcast(&(pool->cv));
+  while (batch.done < arg_count) {
+    pthread_cond_wait(&(pool->done_cv), &(pool->lock));
+  }
+  pool->running--;
+  /* destroy might be waiting on us */
+  if (!pool->running) {
+    pthread_cond_broadcast(&(pool->done_cv));
+  }
   pthread_mutex_unlock(&(pool->lock));
+  trace_end("threadpool_submit", arg_count, start);
   return 1;
 }
 
 static void *_worker_func(void *the_worker) {
   struct _worker *worker = (struct _worker *) the_worker;
-  pthread_mutex_t *lock = &(worker->parent->lock);
-  pthread_cond_t *cv = &(worker->parent->cv);
-  pthread_mutex_lock(lock);
+  threadpool *pool = worker->parent;
+  pthread_mutex_lock(&(pool->lock));
   /* We have the lock so we're "initialized" - let the parent know */
-  worker->parent->initializing--;
-  pthread_cond_broadcast(cv);
-  while (worker->status == RUNNABLE) {
-    while (worker->status == RUNNABLE) {
-      pthread_cond_wait(cv, lock);
+  pool->initializing--;
+  pthread_cond_broadcast(&(pool->done_cv));
+  for (;;) {
+    while (!pool->head && !pool->stopping) {
+      pthread_cond_wait(&(pool->cv), &(pool->lock));
+    }
+    if (!pool->head) {
+      break;
+    }
+    /* Take one job from the batch at the front, then send it to the back
+     * so that every submitter gets a turn */
+    struct _batch *batch = pool->head;
+    int job_index = batch->next++;
+    pool->head = batch->next_batch;
+    if (!pool->head) {
+      pool->tail = NULL;
     }
-    if (worker->status == RUNNING) {
-      pthread_mutex_unlock(lock);
-      worker->func(worker->arg, worker->retval);
-      pthread_mutex_lock(lock);
-      worker->status = RUNNABLE;
-      worker->done = 1;
+    batch->next_batch = NULL;
+    if (batch->next < batch->count) {
+      if (pool->tail) {
+        pool->tail->next_batch = batch;
+      } else {
+        pool->head = batch;
+      }
+      pool->tail = batch;
+    }
+    pthread_mutex_unlock(&(pool->lock));
+    unsigned long long start = trace_begin();
+    void *retval = NULL;
+    if (batch->retvals) {
+      retval = (void *) (batch->retvals + (job_index * batch->retval_size));
+    }
+    batch->func((void *) (batch->arguments + (job_index * batch->arg_size)),
+                retval);
+    trace_end("job", job_index, start);
+    pthread_mutex_lock(&(pool->lock));
+    if (++batch->done == batch->count) {
+      pthread_cond_broadcast(&(pool->done_cv));
     }
-    pthread_cond_broadcast(cv);
   }
-  pthread_mutex_unlock(lock);
+  pthread_mutex_unlock(&(pool->lock));
   pthread_exit(NULL);
 }
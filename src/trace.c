@@ -0,0 +1,277 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "trace.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Something that happened.
+ */
+typedef struct _trace_event {
+  const char *name; /* What it was */
+  int arg; /* The number that goes with it */
+  unsigned long long start; /* When it started, in ns */
+  unsigned long long end; /* When it ended, in ns */
+} trace_event;
+
+/**
+ * A thread's ring of events.
+ */
+typedef struct _trace_buffer {
+  trace_event *events; /* The ring */
+  int capacity; /* How many events fit in the ring */
+  unsigned long long written; /* How many events were ever recorded; the
+                               * ring holds the last capacity of them */
+  int tid; /* Which thread this is in the trace */
+  int exited; /* Has the thread exited? */
+  struct _trace_buffer *next; /* The next buffer */
+} trace_buffer;
+
+/**
+ * Is tracing on?
+ */
+static int _enabled = 0;
+
+/**
+ * How many events new buffers get room for.
+ */
+static int _capacity = 0;
+
+/**
+ * The time the trace starts at, in ns.
+ */
+static unsigned long long _origin = 0;
+
+/**
+ * Every buffer there is, so we can dump them.
+ */
+static trace_buffer *_buffers = NULL;
+
+/**
+ * The id the next thread to record something gets.
+ */
+static int _next_tid = 1;
+
+/**
+ * Protects everything above but _enabled, and the buffers' exited.
+ */
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Where each thread keeps its buffer.
+ */
+static pthread_key_t _key;
+
+/**
+ * Makes sure the key is only created once.
+ */
+static pthread_once_t _key_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Did creating the key work?
+ */
+static int _key_ok = 0;
+
+/**
+ * Create the key.
+ */
+static void _make_key(void);
+
+/**
+ * Mark the buffer of a thread that's exiting, so trace_reset can free it.
+ */
+static void _thread_exit(void *buffer);
+
+/**
+ * Get the calling thread's buffer, creating it if need be.
+ * @return the buffer, or NULL if it couldn't be created
+ */
+static trace_buffer *_my_buffer(void);
+
+/**
+ * The time right now, in ns.
+ */
+static unsigned long long _now(void);
+
+/**
+ * Write the string given out as a JSON string.
+ */
+static void _write_string(FILE *stream, const char *str);
+
+int trace_enable(int capacity) {
+  if (capacity <= 0) {
+    fprintf(stderr, "trace_enable: capacity must be positive\n");
+    return 0;
+  }
+  pthread_once(&_key_once, _make_key);
+  if (!_key_ok) {
+    fprintf(stderr, "trace_enable: could not create thread key\n");
+    return 0;
+  }
+  pthread_mutex_lock(&_lock);
+  _capacity = capacity;
+  if (!_origin) {
+    _origin = _now();
+  }
+  pthread_mutex_unlock(&_lock);
+  __atomic_store_n(&_enabled, 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+void trace_disable(void) {
+  __atomic_store_n(&_enabled, 0, __ATOMIC_RELEASE);
+}
+
+int trace_enabled(void) {
+  return __atomic_load_n(&_enabled, __ATOMIC_ACQUIRE);
+}
+
+unsigned long long trace_begin(void) {
+  if (!trace_enabled()) {
+    return 0;
+  }
+  return _now();
+}
+
+void trace_end(const char *name, int arg, unsigned long long start) {
+  if (!start || !trace_enabled()) {
+    return;
+  }
+  trace_buffer *b = _my_buffer();
+  if (!b) {
+    return;
+  }
+  trace_event *e = &(b->events[b->written % b->capacity]);
+  e->name = name;
+  e->arg = arg;
+  e->start = start;
+  e->end = _now();
+  __atomic_store_n(&(b->written), b->written + 1, __ATOMIC_RELEASE);
+}
+
+int trace_dump(FILE *stream) {
+  pthread_mutex_lock(&_lock);
+  int pid = (int) getpid();
+  int first = 1;
+  fprintf(stream, "{\"traceEvents\":[");
+  for (trace_buffer *b = _buffers; b; b = b->next) {
+    unsigned long long written = __atomic_load_n(&(b->written),
+                                                 __ATOMIC_ACQUIRE);
+    unsigned long long count = written;
+    if (count > (unsigned long long) b->capacity) {
+      count = b->capacity;
+    }
+    /* Oldest first */
+    for (unsigned long long i = written - count; i < written; i++) {
+      trace_event *e = &(b->events[i % b->capacity]);
+      fprintf(stream, "%s\n{\"name\":", first ? "" : ",");
+      _write_string(stream, e->name);
+      /* Chrome wants microseconds */
+      fprintf(stream, ",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,"
+              "\"dur\":%.3f,\"args\":{\"arg\":%d}}", pid, b->tid,
+              (double) (long long) (e->start - _origin) / 1000.0,
+              (double) (e->end - e->start) / 1000.0, e->arg);
+      first = 0;
+    }
+  }
+  fprintf(stream, "\n],\"displayTimeUnit\":\"ns\"}\n");
+  pthread_mutex_unlock(&_lock);
+  if (fflush(stream) || ferror(stream)) {
+    perror("trace_dump");
+    return 0;
+  }
+  return 1;
+}
+
+void trace_reset(void) {
+  pthread_mutex_lock(&_lock);
+  trace_buffer **link = &_buffers;
+  while (*link) {
+    trace_buffer *b = *link;
+    if (b->exited) {
+      /* Nobody's going to record into this one again */
+      *link = b->next;
+      free(b->events);
+      free(b);
+    } else {
+      b->written = 0;
+      link = &(b->next);
+    }
+  }
+  _origin = trace_enabled() ? _now() : 0;
+  pthread_mutex_unlock(&_lock);
+}
+
+static void _make_key(void) {
+  _key_ok = !pthread_key_create(&_key, _thread_exit);
+}
+
+static void _thread_exit(void *buffer) {
+  pthread_mutex_lock(&_lock);
+  ((trace_buffer *) buffer)->exited = 1;
+  pthread_mutex_unlock(&_lock);
+}
+
+static trace_buffer *_my_buffer(void) {
+  trace_buffer *b = pthread_getspecific(_key);
+  if (b) {
+    return b;
+  }
+  b = calloc(1, sizeof(trace_buffer));
+  if (!b) {
+    return NULL;
+  }
+  pthread_mutex_lock(&_lock);
+  b->capacity = _capacity;
+  b->events = malloc(sizeof(trace_event) * b->capacity);
+  if (!b->events || pthread_setspecific(_key, b)) {
+    pthread_mutex_unlock(&_lock);
+    free(b->events);
+    free(b);
+    return NULL;
+  }
+  b->tid = _next_tid++;
+  b->next = _buffers;
+  _buffers = b;
+  pthread_mutex_unlock(&_lock);
+  return b;
+}
+
+static unsigned long long _now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void _write_string(FILE *stream, const char *str) {
+  fputc('"', stream);
+  for (; *str; str++) {
+    if (*str == '"' || *str == '\\') {
+      fputc('\\', stream);
+      fputc(*str, stream);
+    } else if ((unsigned char) *str < 0x20) {
+      fprintf(stream, "\\u%04x", (unsigned char) *str);
+    } else {
+      fputc(*str, stream);
+    }
+  }
+  fputc('"', stream);
+}
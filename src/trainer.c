@@ -0,0 +1,239 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "trainer.h"
+#include "rng.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * One batch's worth of prepared examples.
+ */
+typedef struct _batch {
+  double *inputs; /* The prepared inputs */
+  double *labels; /* The prepared labels */
+  int count; /* How many examples are actually in here */
+} batch;
+
+/**
+ * The state shared between the producer and the training thread.
+ * The slots form a ring: the training thread consumes from head, the
+ * producer fills at tail, and filled counts the slots between them
+ * (including the one currently training, so the producer can't clobber it).
+ */
+typedef struct _feeder {
+  const trainconfig *config; /* How we're training */
+  const double *inputs; /* All the inputs */
+  const double *labels; /* All the labels */
+  int input_count; /* How many inputs there are */
+  int in_dim; /* The dimensionality of an input */
+  int out_dim; /* The dimensionality of a label */
+  int *order; /* The order to visit the inputs in */
+  rng rng; /* The shuffle's random state */
+  batch *slots; /* The batch buffers */
+  int slot_count; /* How many batch buffers there are */
+  int head; /* The next slot to train on */
+  int tail; /* The next slot to fill */
+  int filled; /* How many slots are full or training */
+  int finished; /* Has the producer made every batch? */
+  int stopped; /* Has the training thread given up? */
+  pthread_mutex_t lock; /* Protects the ring */
+  pthread_cond_t cv; /* Signals a change in the ring */
+} feeder;
+
+/**
+ * The producer thread: makes every batch for every epoch.
+ */
+static void *_producer_func(void *the_feeder);
+
+/**
+ * Fill the batch given with the examples in order[start, start + count).
+ */
+static void _fill_batch(feeder *f, batch *b, int start, int count);
+
+/**
+ * Shuffle the feeder's order.
+ */
+static void _shuffle(feeder *f);
+
+/**
+ * Free everything the feeder given allocated.
+ */
+static void _feeder_free(feeder *f);
+
+int trainer_train(neuralnet *net, const double *inputs, const double *labels,
+                  int input_count, trainconfig config) {
+  if (config.batch_size <= 0 || config.depth <= 0 || config.epochs < 0 ||
+      input_count < 0) {
+    fprintf(stderr, "trainer_train: invalid configuration\n");
+    return 0;
+  }
+  feeder f;
+  memset(&f, 0, sizeof(feeder));
+  f.config = &config;
+  f.inputs = inputs;
+  f.labels = labels;
+  f.input_count = input_count;
+  f.in_dim = neuralnet_input_size(net);
+  f.out_dim = neuralnet_output_size(net);
+  rng_init(&(f.rng), config.seed);
+  /* One slot for the batch training plus depth ready to go */
+  f.slot_count = config.depth + 1;
+  f.order = malloc(sizeof(int) * (input_count + 1));
+  f.slots = calloc(f.slot_count, sizeof(batch));
+  if (!f.order || !f.slots) {
+    perror("trainer_train");
+    _feeder_free(&f);
+    return 0;
+  }
+  for (int i = 0; i < input_count; i++) {
+    f.order[i] = i;
+  }
+  for (int s = 0; s < f.slot_count; s++) {
+    f.slots[s].inputs = malloc(sizeof(double) * config.batch_size * f.in_dim);
+    f.slots[s].labels = malloc(sizeof(double) * config.batch_size * f.out_dim);
+    if (!f.slots[s].inputs || !f.slots[s].labels) {
+      perror("trainer_train");
+      _feeder_free(&f);
+      return 0;
+    }
+  }
+  if (pthread_mutex_init(&(f.lock), NULL)) {
+    _feeder_free(&f);
+    return 0;
+  }
+  if (pthread_cond_init(&(f.cv), NULL)) {
+    pthread_mutex_destroy(&(f.lock));
+    _feeder_free(&f);
+    return 0;
+  }
+  pthread_t producer;
+  if (pthread_create(&producer, NULL, _producer_func, &f)) {
+    perror("trainer_train");
+    pthread_cond_destroy(&(f.cv));
+    pthread_mutex_destroy(&(f.lock));
+    _feeder_free(&f);
+    return 0;
+  }
+  int rc = 1;
+  pthread_mutex_lock(&(f.lock));
+  while (1) {
+    while (!f.filled && !f.finished) {
+      pthread_cond_wait(&(f.cv), &(f.lock));
+    }
+    if (!f.filled) {
+      break;
+    }
+    batch *b = &(f.slots[f.head]);
+    /* The producer won't touch this slot until we give it back */
+    pthread_mutex_unlock(&(f.lock));
+    rc = neuralnet_train(net, b->inputs, b->labels, b->count);
+    pthread_mutex_lock(&(f.lock));
+    f.head = (f.head + 1) % f.slot_count;
+    f.filled--;
+    if (!rc) {
+      f.stopped = 1;
+    }
+    pthread_cond_broadcast(&(f.cv));
+    if (!rc) {
+      break;
+    }
+  }
+  pthread_mutex_unlock(&(f.lock));
+  pthread_join(producer, NULL);
+  pthread_cond_destroy(&(f.cv));
+  pthread_mutex_destroy(&(f.lock));
+  _feeder_free(&f);
+  return rc;
+}
+
+static void *_producer_func(void *the_feeder) {
+  feeder *f = (feeder *) the_feeder;
+  int batch_size = f->config->batch_size;
+  for (int epoch = 0; epoch < f->config->epochs; epoch++) {
+    if (f->config->shuffle) {
+      _shuffle(f);
+    }
+    for (int start = 0; start < f->input_count; start += batch_size) {
+      pthread_mutex_lock(&(f->lock));
+      while (f->filled == f->slot_count && !f->stopped) {
+        pthread_cond_wait(&(f->cv), &(f->lock));
+      }
+      if (f->stopped) {
+        pthread_mutex_unlock(&(f->lock));
+        return NULL;
+      }
+      batch *b = &(f->slots[f->tail]);
+      pthread_mutex_unlock(&(f->lock));
+      int count = f->input_count - start;
+      if (count > batch_size) {
+        count = batch_size;
+      }
+      _fill_batch(f, b, start, count);
+      pthread_mutex_lock(&(f->lock));
+      f->tail = (f->tail + 1) % f->slot_count;
+      f->filled++;
+      pthread_cond_broadcast(&(f->cv));
+      pthread_mutex_unlock(&(f->lock));
+    }
+  }
+  pthread_mutex_lock(&(f->lock));
+  f->finished = 1;
+  pthread_cond_broadcast(&(f->cv));
+  pthread_mutex_unlock(&(f->lock));
+  return NULL;
+}
+
+static void _fill_batch(feeder *f, batch *b, int start, int count) {
+  for (int i = 0; i < count; i++) {
+    int index = f->order[start + i];
+    const double *input = &(f->inputs[index * f->in_dim]);
+    const double *label = &(f->labels[index * f->out_dim]);
+    double *input_out = &(b->inputs[i * f->in_dim]);
+    double *label_out = &(b->labels[i * f->out_dim]);
+    if (f->config->prepare) {
+      f->config->prepare(f->config->prepare_ctx, index, input, label,
+                         input_out, label_out);
+    } else {
+      memcpy(input_out, input, sizeof(double) * f->in_dim);
+      memcpy(label_out, label, sizeof(double) * f->out_dim);
+    }
+  }
+  b->count = count;
+}
+
+static void _shuffle(feeder *f) {
+  /* Fisher-Yates */
+  for (int i = f->input_count - 1; i > 0; i--) {
+    int j = (int) ((rng_next(&(f->rng)) >> 11) % (i + 1));
+    int tmp = f->order[i];
+    f->order[i] = f->order[j];
+    f->order[j] = tmp;
+  }
+}
+
+static void _feeder_free(feeder *f) {
+  if (f->slots) {
+    for (int s = 0; s < f->slot_count; s++) {
+      free(f->slots[s].inputs);
+      free(f->slots[s].labels);
+    }
+  }
+  free(f->slots);
+  free(f->order);
+}
@@ -0,0 +1,211 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "transport.h"
+#include <sched.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * The size of a cache line, so the barrier's counters don't share one.
+ */
+#define CACHE_LINE 64
+
+/**
+ * How many times to spin on the barrier before we start yielding.
+ */
+#define BARRIER_SPINS 256
+
+/**
+ * The start of the shared memory segment. The segment starts out zeroed,
+ * which is a valid initial state, so nobody needs to initialize it.
+ */
+typedef struct _shm_header {
+  unsigned int arrived; /* How many processes are waiting at the barrier */
+  char pad[CACHE_LINE - sizeof(unsigned int)];
+  unsigned int generation; /* Bumped every time the barrier opens */
+  char pad2[CACHE_LINE - sizeof(unsigned int)];
+} shm_header;
+
+/**
+ * Our end of a shared memory transport.
+ */
+typedef struct _shm_impl {
+  void *base; /* Where the segment is mapped */
+  size_t length; /* How long the segment is */
+  shm_header *header; /* The barrier, at the start of the segment */
+  double *slots; /* Every process' values: size rows of max_count */
+  double *result; /* The sums */
+  int max_count; /* How many values fit in a slot */
+} shm_impl;
+
+/**
+ * The shared memory all-reduce.
+ */
+static int _shm_allreduce(transport *t, double *values, int count);
+
+/**
+ * The shared memory barrier.
+ */
+static int _shm_barrier(transport *t);
+
+/**
+ * Unmap the shared memory segment and free the transport.
+ */
+static int _shm_destroy(transport *t);
+
+static const transport_ops _shm_ops = {
+  _shm_allreduce,
+  _shm_barrier,
+  _shm_destroy,
+};
+
+int transport_allreduce(transport *t, double *values, int count) {
+  return t->ops->allreduce(t, values, count);
+}
+
+int transport_barrier(transport *t) {
+  return t->ops->barrier(t);
+}
+
+int transport_destroy(transport *t) {
+  return t->ops->destroy(t);
+}
+
+int transport_shm_create(transport **retval, const char *name, int rank,
+                         int size, int max_count) {
+  if (size <= 0 || rank < 0 || rank >= size || max_count <= 0) {
+    fprintf(stderr, "transport_shm_create: invalid arguments\n");
+    return 0;
+  }
+  transport *t = malloc(sizeof(transport));
+  shm_impl *impl = malloc(sizeof(shm_impl));
+  if (!t || !impl) {
+    perror("transport_shm_create");
+    free(t);
+    free(impl);
+    return 0;
+  }
+  impl->max_count = max_count;
+  impl->length = sizeof(shm_header) +
+                 sizeof(double) * (size_t) max_count * (size + 1);
+  int fd = shm_open(name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    perror("transport_shm_create");
+    free(t);
+    free(impl);
+    return 0;
+  }
+  /* Everybody sizes it, so nobody maps it before it's big enough. Growing
+   * it zero fills, and everyone asks for the same size, so this is safe */
+  if (ftruncate(fd, impl->length)) {
+    perror("transport_shm_create");
+    close(fd);
+    free(t);
+    free(impl);
+    return 0;
+  }
+  impl->base = mmap(NULL, impl->length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0);
+  close(fd);
+  if (impl->base == MAP_FAILED) {
+    perror("transport_shm_create");
+    free(t);
+    free(impl);
+    return 0;
+  }
+  impl->header = (shm_header *) impl->base;
+  impl->slots = (double *) ((unsigned char *) impl->base + sizeof(shm_header));
+  impl->result = &(impl->slots[(size_t) max_count * size]);
+  t->ops = &_shm_ops;
+  t->rank = rank;
+  t->size = size;
+  t->impl = impl;
+  /* Once everybody's mapped it the name isn't needed any more, and getting
+   * rid of it now means we can't leak it however we exit */
+  _shm_barrier(t);
+  if (!rank) {
+    shm_unlink(name);
+  }
+  *retval = t;
+  return 1;
+}
+
+static int _shm_allreduce(transport *t, double *values, int count) {
+  shm_impl *impl = (shm_impl *) t->impl;
+  for (int offset = 0; offset < count; offset += impl->max_count) {
+    int n = count - offset;
+    if (n > impl->max_count) {
+      n = impl->max_count;
+    }
+    memcpy(&(impl->slots[(size_t) impl->max_count * t->rank]),
+           &(values[offset]), sizeof(double) * n);
+    _shm_barrier(t);
+    /* Reduce-scatter: we sum our own slice of everyone's values. We always
+     * add in rank order so everybody gets bit for bit the same answer */
+    int start = (int) ((long) n * t->rank / t->size);
+    int end = (int) ((long) n * (t->rank + 1) / t->size);
+    for (int i = start; i < end; i++) {
+      double sum = 0;
+      for (int r = 0; r < t->size; r++) {
+        sum += impl->slots[(size_t) impl->max_count * r + i];
+      }
+      impl->result[i] = sum;
+    }
+    _shm_barrier(t);
+    /* All-gather. Nobody can touch the result until we've all been through
+     * the first barrier of the next round, which we can't get to before
+     * we're done copying. */
+    memcpy(&(values[offset]), impl->result, sizeof(double) * n);
+  }
+  return 1;
+}
+
+static int _shm_barrier(transport *t) {
+  shm_header *header = ((shm_impl *) t->impl)->header;
+  unsigned int generation = __atomic_load_n(&(header->generation),
+                                            __ATOMIC_ACQUIRE);
+  if (__atomic_add_fetch(&(header->arrived), 1, __ATOMIC_ACQ_REL) ==
+      (unsigned int) t->size) {
+    /* Last one in resets the count and lets everyone go */
+    __atomic_store_n(&(header->arrived), 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&(header->generation), generation + 1,
+                     __ATOMIC_RELEASE);
+    return 1;
+  }
+  int spins = 0;
+  while (__atomic_load_n(&(header->generation), __ATOMIC_ACQUIRE) ==
+         generation) {
+    if (++spins > BARRIER_SPINS) {
+      sched_yield();
+    }
+  }
+  return 1;
+}
+
+static int _shm_destroy(transport *t) {
+  shm_impl *impl = (shm_impl *) t->impl;
+  int rc = !munmap(impl->base, impl->length);
+  free(impl);
+  free(t);
+  return rc;
+}
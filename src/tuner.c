@@ -0,0 +1,291 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "tuner.h"
+#include "activations.h"
+#include "rng.h"
+#include "threadpool.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* How long a cache key can get */
+#define TUNER_KEY_LEN 1024
+
+/* How long a CPU model name can get */
+#define TUNER_CPU_LEN 256
+
+/* How many times to time each candidate; the fastest counts */
+#define TUNER_REPS 3
+
+/* The seed for the random inputs we time on */
+#define TUNER_SEED 0x74756e65
+
+/**
+ * Describe the net given (and how it'll be run) as a cache key.
+ * @return 0 if it didn't fit in size
+ */
+static int _key(const netconfig *config, int batch_size, char *key,
+                size_t size);
+
+/**
+ * Find out the CPU's model name, or "unknown" if we can't tell.
+ */
+static void _cpu_model(char *model, size_t size);
+
+/**
+ * Time the plan given on the batch given.
+ * @return the fastest time of TUNER_REPS, in seconds, or a negative number
+ *         if the net couldn't be made
+ */
+static double _time_plan(netconfig config, const int *layer_jobs,
+                         const double *inputs, const double *labels,
+                         double *results, int batch_size);
+
+/**
+ * The time right now, in seconds.
+ */
+static double _now(void);
+
+int tuner_tune(netconfig config, int batch_size, int *layer_jobs) {
+  if (batch_size <= 0 || config.layers <= 0) {
+    fprintf(stderr, "tuner_tune: invalid configuration\n");
+    return 0;
+  }
+  int threads = config.threads;
+  for (int layer = 0; layer < config.layers; layer++) {
+    layer_jobs[layer] = threads > 0 ? threads : 1;
+  }
+  /* Without threads there's nothing to choose */
+  if (threads <= 1) {
+    return 1;
+  }
+  int in_dim = config.dimensionality;
+  int out_dim = config.layer_sizes[config.layers - 1];
+  double *inputs = malloc(sizeof(double) * batch_size * in_dim);
+  double *labels = malloc(sizeof(double) * batch_size * out_dim);
+  double *results = malloc(sizeof(double) * batch_size * out_dim);
+  threadpool *pool = NULL;
+  if (!inputs || !labels || !results || !threadpool_create(&pool, threads)) {
+    perror("tuner_tune");
+    free(inputs);
+    free(labels);
+    free(results);
+    return 0;
+  }
+  rng r;
+  rng_init(&r, TUNER_SEED);
+  for (int i = 0; i < batch_size * in_dim; i++) {
+    inputs[i] = rng_uniform(&r);
+  }
+  for (int i = 0; i < batch_size * out_dim; i++) {
+    labels[i] = rng_uniform(&r);
+  }
+  /* Every candidate runs on the same pool, so we only pay for the threads
+   * once */
+  config.pool = pool;
+  int ok = 1;
+  /* One layer at a time, keeping the best split of the ones before */
+  for (int layer = 0; layer < config.layers && ok; layer++) {
+    int best = layer_jobs[layer];
+    double best_time = -1;
+    for (int jobs = 1; ok; jobs = jobs * 2 < threads ? jobs * 2 : threads) {
+      layer_jobs[layer] = jobs;
+      double t = _time_plan(config, layer_jobs, inputs, labels, results,
+                            batch_size);
+      if (t < 0) {
+        ok = 0;
+      } else if (best_time < 0 || t < best_time) {
+        best = jobs;
+        best_time = t;
+      }
+      /* No point splitting further than there are neurons to go round */
+      if (jobs == threads || jobs >= config.layer_sizes[layer]) {
+        break;
+      }
+    }
+    layer_jobs[layer] = best;
+  }
+  threadpool_destroy(pool);
+  free(inputs);
+  free(labels);
+  free(results);
+  return ok;
+}
+
+int tuner_lookup(const char *path, const netconfig *config, int batch_size,
+                 int *layer_jobs) {
+  char key[TUNER_KEY_LEN];
+  char cpu[TUNER_CPU_LEN];
+  if (!_key(config, batch_size, key, sizeof(key))) {
+    return 0;
+  }
+  _cpu_model(cpu, sizeof(cpu));
+  FILE *in = fopen(path, "r");
+  if (!in) {
+    return 0;
+  }
+  char *line = NULL;
+  size_t line_size = 0;
+  int found = 0;
+  /* Keep going to the end, the last plan for a key is the one that counts */
+  while (getline(&line, &line_size, in) != -1) {
+    char *line_cpu = strtok(line, "\t");
+    char *line_key = strtok(NULL, "\t");
+    char *plan = strtok(NULL, "\t\n");
+    if (!line_cpu || !line_key || !plan || strcmp(line_cpu, cpu) ||
+        strcmp(line_key, key)) {
+      continue;
+    }
+    int layer = 0;
+    int ok = 1;
+    for (char *jobs = strtok(plan, ","); jobs && ok; jobs = strtok(NULL, ",")) {
+      ok = layer < config->layers && (layer_jobs[layer++] = atoi(jobs)) > 0;
+    }
+    /* A broken line just doesn't count */
+    found |= ok && layer == config->layers;
+  }
+  free(line);
+  fclose(in);
+  return found;
+}
+
+int tuner_store(const char *path, const netconfig *config, int batch_size,
+                const int *layer_jobs) {
+  char key[TUNER_KEY_LEN];
+  char cpu[TUNER_CPU_LEN];
+  if (!_key(config, batch_size, key, sizeof(key))) {
+    fprintf(stderr, "tuner_store: net too big to key\n");
+    return 0;
+  }
+  _cpu_model(cpu, sizeof(cpu));
+  FILE *out = fopen(path, "a");
+  if (!out) {
+    perror(path);
+    return 0;
+  }
+  fprintf(out, "%s\t%s\t", cpu, key);
+  for (int layer = 0; layer < config->layers; layer++) {
+    fprintf(out, layer ? ",%d" : "%d", layer_jobs[layer]);
+  }
+  fprintf(out, "\n");
+  if (fclose(out)) {
+    perror(path);
+    return 0;
+  }
+  return 1;
+}
+
+int tuner_plan(const char *path, const netconfig *config, int batch_size,
+               int *layer_jobs) {
+  if (path && tuner_lookup(path, config, batch_size, layer_jobs)) {
+    return 1;
+  }
+  if (!tuner_tune(*config, batch_size, layer_jobs)) {
+    return 0;
+  }
+  return path ? tuner_store(path, config, batch_size, layer_jobs) : 1;
+}
+
+static int _key(const netconfig *config, int batch_size, char *key,
+                size_t size) {
+  size_t len = snprintf(key, size, "in=%d layers=%d", config->dimensionality,
+                        config->layer_sizes[0]);
+  for (int layer = 1; layer < config->layers && len < size; layer++) {
+    len += snprintf(key + len, size - len, "-%d", config->layer_sizes[layer]);
+  }
+  for (int layer = 0; config->conv && layer < config->layers && len < size;
+       layer++) {
+    const conv_spec *spec = &(config->conv[layer]);
+    if (spec->filters) {
+      len += snprintf(key + len, size - len, " conv%d=%dx%dx%dx%d/%d/%d/%d/%d",
+                      layer, spec->filters, spec->channels, spec->height,
+                      spec->width, spec->kernel, spec->stride, spec->padding,
+                      spec->pool);
+    }
+  }
+  /* Sampling changes how much of the output layer gets worked out, and
+   * the activation how long each neuron takes */
+  const activation_info *act = activation_find(config->activation);
+  if (len < size) {
+    len += snprintf(key + len, size - len,
+                    " act=%s samples=%d threads=%d batch=%d%s",
+                    act ? act->name : "custom", config->output_samples,
+                    config->threads, batch_size,
+                    config->inference_only ? " inference" : "");
+  }
+  return len < size;
+}
+
+static void _cpu_model(char *model, size_t size) {
+  snprintf(model, size, "unknown");
+  FILE *in = fopen("/proc/cpuinfo", "r");
+  if (!in) {
+    return;
+  }
+  char *line = NULL;
+  size_t line_size = 0;
+  while (getline(&line, &line_size, in) != -1) {
+    char *colon = strchr(line, ':');
+    if (strncmp(line, "model name", strlen("model name")) || !colon) {
+      continue;
+    }
+    snprintf(model, size, "%s", colon + 2);
+    /* Tabs separate the cache's fields, and newlines its lines */
+    for (char *c = model; *c; c++) {
+      if (*c == '\t' || *c == '\n') {
+        *c = *c == '\t' ? ' ' : '\0';
+      }
+    }
+    break;
+  }
+  free(line);
+  fclose(in);
+}
+
+static double _time_plan(netconfig config, const int *layer_jobs,
+                         const double *inputs, const double *labels,
+                         double *results, int batch_size) {
+  config.layer_jobs = layer_jobs;
+  neuralnet *net;
+  if (!neuralnet_create(&net, config)) {
+    return -1;
+  }
+  double best = -1;
+  /* One extra round first, to warm the caches up */
+  for (int rep = 0; rep <= TUNER_REPS; rep++) {
+    double start = _now();
+    if (config.inference_only) {
+      neuralnet_classify(net, inputs, results, batch_size);
+    } else {
+      neuralnet_train(net, inputs, labels, batch_size);
+    }
+    double t = _now() - start;
+    if (rep && (best < 0 || t < best)) {
+      best = t;
+    }
+  }
+  neuralnet_destroy(net);
+  return best;
+}
+
+static double _now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
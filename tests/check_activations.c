@@ -0,0 +1,113 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <check.h>
+#include <stdlib.h>
+#include <math.h>
+#include "activations.h"
+
+/* The range to check the approximations over */
+#define ERROR_RANGE 40.0
+
+/* How far apart to check them */
+#define ERROR_STEP 1e-4
+
+/* How many elements to check the array forms with */
+#define ARRAY_COUNT 1001
+
+/**
+ * Check that approx is within bound of exact over the whole range.
+ */
+static void check_error_bound(double (*approx)(double), double (*exact)(double),
+                              double bound) {
+  double worst = 0;
+  double worst_x = 0;
+  for (double x = -ERROR_RANGE; x <= ERROR_RANGE; x += ERROR_STEP) {
+    double error = fabs(approx(x) - exact(x));
+    if (error > worst) {
+      worst = error;
+      worst_x = x;
+    }
+  }
+  ck_assert_msg(worst <= bound, "Error %g at %f is over %g\n", worst, worst_x,
+                bound);
+}
+
+/**
+ * Check that the array form gives the same answers as the scalar form.
+ */
+static void check_array_form(double (*func)(double),
+                             void (*array)(const double *, double *, int)) {
+  double in[ARRAY_COUNT];
+  double out[ARRAY_COUNT];
+  for (int i = 0; i < ARRAY_COUNT; i++) {
+    in[i] = (i - ARRAY_COUNT / 2) / 50.0;
+  }
+  array(in, out, ARRAY_COUNT);
+  for (int i = 0; i < ARRAY_COUNT; i++) {
+    ck_assert_msg(out[i] == func(in[i]), "At %f got %f expected %f\n", in[i],
+                  out[i], func(in[i]));
+  }
+  /* In place has to work too */
+  array(in, in, ARRAY_COUNT);
+  for (int i = 0; i < ARRAY_COUNT; i++) {
+    ck_assert_msg(in[i] == out[i], "In place got %f expected %f\n", in[i],
+                  out[i]);
+  }
+}
+
+START_TEST(test_activations_error_bounds) {
+  check_error_bound(sigmoid_fast, sigmoid, 5e-5);
+  check_error_bound(sigmoid_table, sigmoid, 2e-5);
+  check_error_bound(tanh_fast, tanh, 1e-4);
+  check_error_bound(tanh_table, tanh, 3e-5);
+}
+END_TEST
+
+START_TEST(test_activations_array_forms) {
+  check_array_form(sigmoid, sigmoid_array);
+  check_array_form(sigmoid_fast, sigmoid_fast_array);
+  check_array_form(sigmoid_table, sigmoid_table_array);
+  check_array_form(tanh, tanh_array);
+  check_array_form(tanh_fast, tanh_fast_array);
+  check_array_form(tanh_table, tanh_table_array);
+}
+END_TEST
+
+START_TEST(test_activations_registry) {
+  const activation_info *info = activation_find(sigmoid_fast);
+  ck_assert_ptr_ne(info, NULL);
+  ck_assert_ptr_eq(info->array, sigmoid_fast_array);
+  ck_assert_ptr_eq(activation_find_name(info->name), info);
+  ck_assert_ptr_eq(activation_find_name("tanh")->func, tanh);
+  ck_assert_ptr_eq(activation_find_name("no such thing"), NULL);
+  ck_assert_ptr_eq(activation_find(cos), NULL);
+}
+END_TEST
+
+Suite *activations_suite(void) {
+  Suite *s;
+  s = suite_create("activations");
+
+  TCase *tc_approx = tcase_create("approx");
+  tcase_add_test(tc_approx, test_activations_error_bounds);
+  tcase_add_test(tc_approx, test_activations_array_forms);
+  tcase_add_test(tc_approx, test_activations_registry);
+
+  suite_add_tcase(s, tc_approx);
+
+  return s;
+}
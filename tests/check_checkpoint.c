@@ -0,0 +1,118 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <check.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "checkpoint.h"
+#include "neuralnet.h"
+#include "activations.h"
+
+/* How many times to checkpoint while training */
+#define CHECKPOINTS 20
+
+START_TEST(test_checkpoint_latest_wins) {
+  static const int layer_sizes[2] = { 3, 1 };
+  netconfig conf = { 0 };
+  conf.layers = 2;
+  conf.layer_sizes = layer_sizes;
+  conf.dimensionality = 2;
+  conf.activation = sigmoid;
+  conf.activation_prime = sigmoid_prime;
+  conf.threads = 2;
+  conf.alpha = 0.1;
+  conf.iscale = 0.1;
+  conf.max_width = 3;
+  neuralnet *net;
+  ck_assert_int_eq(neuralnet_create(&net, conf), 1);
+  double inputs[8] = { 0, 0,
+                       0, 1,
+                       1, 0,
+                       1, 1 };
+  double labels[4] = { 0, 1, 1, 0 };
+  /* With a directory in the path, so that's what gets synced */
+  char path[64];
+  snprintf(path, sizeof(path), "./check_checkpoint-%d.model", (int) getpid());
+  checkpointer *c;
+  ck_assert_int_eq(checkpointer_create(&c, net, path), 1);
+  for (int i = 0; i < CHECKPOINTS; i++) {
+    ck_assert_int_eq(neuralnet_train(net, inputs, labels, 4), 1);
+    ck_assert_int_eq(checkpointer_save(c), 1);
+  }
+  ck_assert_int_eq(checkpointer_wait(c), 1);
+  /* The last snapshot has to be the one on disk */
+  FILE *f = fopen(path, "rb");
+  ck_assert_ptr_ne(f, NULL);
+  neuralnet *loaded;
+  ck_assert_int_eq(neuralnet_load(&loaded, f, 1), 1);
+  fclose(f);
+  int count = neuralnet_param_count(net);
+  double *expected = malloc(sizeof(double) * count);
+  double *got = malloc(sizeof(double) * count);
+  neuralnet_get_params(net, expected);
+  neuralnet_get_params(loaded, got);
+  for (int i = 0; i < count; i++) {
+    ck_assert_msg(expected[i] == got[i], "Expected %f got %f\n", expected[i],
+                  got[i]);
+  }
+  /* Destroying flushes anything still outstanding */
+  ck_assert_int_eq(neuralnet_train(net, inputs, labels, 4), 1);
+  ck_assert_int_eq(checkpointer_save(c), 1);
+  ck_assert_int_eq(checkpointer_destroy(c), 1);
+  ck_assert_int_eq(remove(path), 0);
+  free(expected);
+  free(got);
+  neuralnet_destroy(loaded);
+  neuralnet_destroy(net);
+}
+END_TEST
+
+START_TEST(test_checkpoint_bad_path) {
+  static const int layer_sizes[1] = { 1 };
+  netconfig conf = { 0 };
+  conf.layers = 1;
+  conf.layer_sizes = layer_sizes;
+  conf.dimensionality = 2;
+  conf.activation = sigmoid;
+  conf.activation_prime = sigmoid_prime;
+  conf.threads = 1;
+  conf.alpha = 0.1;
+  conf.iscale = 0.1;
+  conf.max_width = 2;
+  neuralnet *net;
+  ck_assert_int_eq(neuralnet_create(&net, conf), 1);
+  checkpointer *c;
+  ck_assert_int_eq(checkpointer_create(&c, net, "no/such/dir/model"), 1);
+  ck_assert_int_eq(checkpointer_save(c), 1);
+  ck_assert_int_eq(checkpointer_wait(c), 0);
+  ck_assert_int_eq(checkpointer_destroy(c), 0);
+  neuralnet_destroy(net);
+}
+END_TEST
+
+Suite *checkpoint_suite(void) {
+  Suite *s;
+  s = suite_create("checkpoint");
+
+  TCase *tc_simple = tcase_create("simple");
+  tcase_add_test(tc_simple, test_checkpoint_latest_wins);
+  tcase_add_test(tc_simple, test_checkpoint_bad_path);
+
+  suite_add_tcase(s, tc_simple);
+
+  return s;
+}
@@ -0,0 +1,172 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <check.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "dataparallel.h"
+#include "transport.h"
+#include "neuralnet.h"
+#include "activations.h"
+
+/* How many processes to spread the work over */
+#define DP_PROCESSES 3
+
+/* How many values to all-reduce; bigger than the segment on purpose */
+#define DP_VALUES 1000
+
+/* How many values fit in the segment */
+#define DP_MAX_COUNT 64
+
+/**
+ * Fork off the ranks other than 0, which is left to the caller. Each child
+ * runs the function given with its rank and exits with its return value;
+ * the children can't use ck_assert since they're not the test process.
+ */
+static void dp_spawn(int (*child)(const char *, int), const char *name) {
+  for (int rank = 1; rank < DP_PROCESSES; rank++) {
+    pid_t pid = fork();
+    ck_assert_int_ne(pid, -1);
+    if (!pid) {
+      _exit(child(name, rank));
+    }
+  }
+}
+
+/**
+ * Wait for all the children and make sure they all exited cleanly.
+ */
+static void dp_reap(void) {
+  for (int rank = 1; rank < DP_PROCESSES; rank++) {
+    int status;
+    ck_assert_int_ne(wait(&status), -1);
+    ck_assert_msg(WIFEXITED(status) && !WEXITSTATUS(status),
+                  "A child failed with status %d\n", status);
+  }
+}
+
+/**
+ * Every rank contributes rank + 1 (plus the index) and checks the sums.
+ */
+static int dp_allreduce_child(const char *name, int rank) {
+  transport *t;
+  if (!transport_shm_create(&t, name, rank, DP_PROCESSES, DP_MAX_COUNT)) {
+    return 1;
+  }
+  double values[DP_VALUES];
+  for (int i = 0; i < DP_VALUES; i++) {
+    values[i] = rank + 1 + i;
+  }
+  int rc = transport_allreduce(t, values, DP_VALUES) ? 0 : 2;
+  double base = DP_PROCESSES * (DP_PROCESSES + 1) / 2;
+  for (int i = 0; i < DP_VALUES; i++) {
+    if (values[i] != base + DP_PROCESSES * i) {
+      rc = 3;
+    }
+  }
+  transport_destroy(t);
+  return rc;
+}
+
+/**
+ * Every rank trains a replica on its own (differently sized) shard of OR
+ * and checks that the replicas agree at the end.
+ */
+static int dp_train_child(const char *name, int rank) {
+  static const int layer_sizes[2] = { 3, 1 };
+  double inputs[8] = { 0, 0,
+                       0, 1,
+                       1, 0,
+                       1, 1 };
+  double labels[4] = { 0, 1, 1, 1 };
+  netconfig conf = { 0 };
+  conf.layers = 2;
+  conf.layer_sizes = layer_sizes;
+  conf.dimensionality = 2;
+  conf.activation = sigmoid;
+  conf.activation_prime = sigmoid_prime;
+  conf.threads = 1;
+  conf.alpha = 0.1;
+  conf.iscale = 0.1;
+  conf.max_width = 3;
+  /* Make sure the replicas start out different */
+  conf.seed = rank + 1;
+  neuralnet *net;
+  transport *t;
+  if (!neuralnet_create(&net, conf)) {
+    return 1;
+  }
+  if (!transport_shm_create(&t, name, rank, DP_PROCESSES, DP_MAX_COUNT)) {
+    return 1;
+  }
+  int rc = 0;
+  if (!dataparallel_train(net, t, inputs + rank * 2, labels + rank,
+                          4 - rank, 1)) {
+    rc = 2;
+  }
+  /* Everyone should have the same weights, so their average is ours */
+  int count = neuralnet_param_count(net);
+  double *mine = malloc(sizeof(double) * count);
+  double *sums = malloc(sizeof(double) * count);
+  neuralnet_get_params(net, mine);
+  neuralnet_get_params(net, sums);
+  transport_allreduce(t, sums, count);
+  for (int i = 0; i < count; i++) {
+    if (sums[i] != mine[i] * DP_PROCESSES) {
+      rc = 3;
+    }
+  }
+  free(mine);
+  free(sums);
+  transport_destroy(t);
+  neuralnet_destroy(net);
+  return rc;
+}
+
+START_TEST(test_transport_shm_allreduce) {
+  char name[64];
+  snprintf(name, sizeof(name), "/helios-check-ar-%d", (int) getpid());
+  dp_spawn(dp_allreduce_child, name);
+  ck_assert_int_eq(dp_allreduce_child(name, 0), 0);
+  dp_reap();
+}
+END_TEST
+
+START_TEST(test_dataparallel_train) {
+  char name[64];
+  snprintf(name, sizeof(name), "/helios-check-dp-%d", (int) getpid());
+  dp_spawn(dp_train_child, name);
+  ck_assert_int_eq(dp_train_child(name, 0), 0);
+  dp_reap();
+}
+END_TEST
+
+Suite *dataparallel_suite(void) {
+  Suite *s;
+  s = suite_create("dataparallel");
+
+  TCase *tc_shm = tcase_create("shm");
+  tcase_add_test(tc_shm, test_transport_shm_allreduce);
+  tcase_add_test(tc_shm, test_dataparallel_train);
+  tcase_set_timeout(tc_shm, 30);
+
+  suite_add_tcase(s, tc_shm);
+
+  return s;
+}
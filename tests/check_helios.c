@@ -21,12 +21,26 @@
 #include <stdlib.h>
 #include "check_threadpool.c"
 #include "check_neuralnet.c"
+#include "check_trainer.c"
+#include "check_dataparallel.c"
+#include "check_checkpoint.c"
+#include "check_activations.c"
+#include "check_trace.c"
+#include "check_sweep.c"
+#include "check_tuner.c"
 
 int main(int argc, char **argv) {
   int number_failed;
   SRunner *sr;
   sr = srunner_create(threadpool_suite());
   srunner_add_suite(sr, neuralnet_suite());
+  srunner_add_suite(sr, trainer_suite());
+  srunner_add_suite(sr, dataparallel_suite());
+  srunner_add_suite(sr, checkpoint_suite());
+  srunner_add_suite(sr, activations_suite());
+  srunner_add_suite(sr, trace_suite());
+  srunner_add_suite(sr, sweep_suite());
+  srunner_add_suite(sr, tuner_suite());
   srunner_run_all(sr, CK_NORMAL);
   number_failed = srunner_ntests_failed(sr);
   srunner_free(sr);
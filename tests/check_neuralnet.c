@@ -16,19 +16,72 @@
  */
 #include <check.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "neuralnet.h"
 #include "activations.h"
 
 #define ITERATIONS 200000
 
-START_TEST(test_neuralnet_or) {
-  netconfig conf;
+/* How many seeds to learn XOR from, and how long to train each one */
+#define XOR_SEEDS 8
+#define XOR_ITERATIONS 20000
+
+/* The net whose training gets checked by hand: 2 -> 3 -> 5 -> 1, so one
+ * hidden layer is narrower than the one after it and one is wider */
+#define GRAD_LAYERS 3
+#define GRAD_SEED 1234
+
+/* Its max_width, plus the one the net adds for the biases */
+#define GRAD_WIDTH 6
+
+/* How many parameters it has: 3 * (2 + 1) + 5 * (3 + 1) + 1 * (5 + 1) */
+#define GRAD_PARAMS 35
+
+/* How many inputs to classify with the exported nets */
+#define EXPORT_INPUTS 9
+
+/* How many inputs to push through the pipelined classifier */
+#define PIPELINE_INPUTS 37
+
+/* How many inputs to evaluate */
+#define EVAL_INPUTS 25
+
+/* How many parameters the nets in the init tests have: 5 * (4 + 1) + 3 * 6 */
+#define INIT_PARAMS 43
+
+/* How many nets share a pool, and how many times they each train */
+#define SHARED_NETS 3
+#define SHARED_ITERATIONS 20
+
+/* How many times to train the conv net on the bars */
+#define CONV_ITERATIONS 3000
+
+/* How many outputs the sampled nets have, and how many parameters:
+ * 8 * (5 + 1) + 12 * (8 + 1) */
+#define SAMPLED_OUTPUTS 12
+#define SAMPLED_PARAMS 156
+
+/* How many times to train the sampled net to learn its classes */
+#define SAMPLED_ITERATIONS 3000
+
+/* How many parameters the factored nets have: 5 * (6 + 1) + 3 * (5 + 1) */
+#define LOWRANK_PARAMS 53
+
+/**
+ * Train a net to learn OR with the activation given and check that it did.
+ */
+static void check_or(activation_func activation,
+                     activation_func activation_prime) {
+  netconfig conf = { 0 };
   int layer_sizes[1] = { 1 };
   conf.layers = 1;
   conf.layer_sizes = layer_sizes;
   conf.dimensionality = 2;
-  conf.activation = sigmoid;
-  conf.activation_prime = sigmoid_prime;
+  conf.activation = activation;
+  conf.activation_prime = activation_prime;
   conf.threads = 2;
   conf.alpha = 0.1;
   conf.iscale = 0.1;
@@ -51,11 +104,84 @@ START_TEST(test_neuralnet_or) {
   ck_assert_msg(labels[3] > 0.95, "Got %f\n", labels[3]);
   neuralnet_destroy(net);
 }
+
+START_TEST(test_neuralnet_or) {
+  check_or(sigmoid, sigmoid_prime);
+}
+END_TEST
+
+START_TEST(test_neuralnet_or_sigmoid_fast) {
+  check_or(sigmoid_fast, sigmoid_prime);
+}
+END_TEST
+
+START_TEST(test_neuralnet_or_sigmoid_table) {
+  check_or(sigmoid_table, sigmoid_prime);
+}
 END_TEST
 
+/**
+ * Train nets to learn XOR with the activation given and check that they
+ * did, whatever seed they start from.
+ */
+static void check_xor(activation_func activation,
+                      activation_func activation_prime) {
+  netconfig conf = { 0 };
+  /* With a few spare hidden neurons and Xavier's start, XOR doesn't get
+   * stuck whichever seed we pick */
+  int layer_sizes[2] = { 6, 1 };
+  conf.layers = 2;
+  conf.layer_sizes = layer_sizes;
+  conf.dimensionality = 2;
+  conf.activation = activation;
+  conf.activation_prime = activation_prime;
+  conf.threads = 2;
+  conf.alpha = 0.5;
+  conf.iscale = 1;
+  conf.max_width = 6;
+  conf.init = INIT_XAVIER;
+  double inputs[8] = { 0, 0,
+                       0, 1,
+                       1, 0,
+                       1, 1 };
+  for (int seed = 0; seed < XOR_SEEDS; seed++) {
+    conf.seed = seed;
+    neuralnet *net;
+    ck_assert_int_eq(neuralnet_create(&net, conf), 1);
+    double labels[4] = { 0, 1, 1, 0 };
+    for (int i = 0; i < XOR_ITERATIONS; i++) {
+      ck_assert_int_eq(neuralnet_train(net, inputs, labels, 4), 1);
+    }
+    ck_assert_int_eq(neuralnet_classify(net, inputs, labels, 4), 1);
+    ck_assert_msg(labels[0] < 0.05, "Seed %d: got %f\n", seed, labels[0]);
+    ck_assert_msg(labels[1] > 0.95, "Seed %d: got %f\n", seed, labels[1]);
+    ck_assert_msg(labels[2] > 0.95, "Seed %d: got %f\n", seed, labels[2]);
+    ck_assert_msg(labels[3] < 0.05, "Seed %d: got %f\n", seed, labels[3]);
+    neuralnet_destroy(net);
+  }
+}
+
 START_TEST(test_neuralnet_xor) {
-  netconfig conf;
-  int layer_sizes[2] = { 3, 1 };
+  check_xor(sigmoid, sigmoid_prime);
+}
+END_TEST
+
+START_TEST(test_neuralnet_xor_sigmoid_fast) {
+  check_xor(sigmoid_fast, sigmoid_prime);
+}
+END_TEST
+
+START_TEST(test_neuralnet_xor_sigmoid_table) {
+  check_xor(sigmoid_table, sigmoid_prime);
+}
+END_TEST
+
+/**
+ * Make a small, untrained, two layer net.
+ */
+static neuralnet *make_small_net(void) {
+  static const int layer_sizes[2] = { 3, 2 };
+  netconfig conf = { 0 };
   conf.layers = 2;
   conf.layer_sizes = layer_sizes;
   conf.dimensionality = 2;
@@ -66,20 +192,1363 @@ START_TEST(test_neuralnet_xor) {
   conf.iscale = 0.1;
   conf.max_width = 3;
   neuralnet *net;
-  neuralnet_create(&net, conf);
+  ck_assert_int_eq(neuralnet_create(&net, conf), 1);
+  return net;
+}
+
+START_TEST(test_neuralnet_save_load) {
+  neuralnet *net = make_small_net();
   double inputs[8] = { 0, 0,
                        0, 1,
                        1, 0,
                        1, 1 };
-  double labels[4] = { 0, 1, 1, 0 };
-  for (int i = 0; i < ITERATIONS; i++) {
-    ck_assert_int_eq(neuralnet_train(net, inputs, labels, 4), 1);
+  double labels[8] = { 0, 1, 1, 0, 1, 0, 0, 1 };
+  ck_assert_int_eq(neuralnet_train(net, inputs, labels, 4), 1);
+  FILE *f = tmpfile();
+  ck_assert_int_eq(neuralnet_save(net, f), 1);
+  rewind(f);
+  neuralnet *loaded;
+  ck_assert_int_eq(neuralnet_load(&loaded, f, 3), 1);
+  fclose(f);
+  double expected[8];
+  double got[8];
+  ck_assert_int_eq(neuralnet_classify(net, inputs, expected, 4), 1);
+  ck_assert_int_eq(neuralnet_classify(loaded, inputs, got, 4), 1);
+  for (int i = 0; i < 8; i++) {
+    ck_assert_msg(expected[i] == got[i], "Expected %f got %f\n", expected[i],
+                  got[i]);
   }
-  ck_assert_int_eq(neuralnet_classify(net, inputs, labels, 4), 1);
-  ck_assert_msg(labels[0] < 0.05, "Got %f\n", labels[0]);
-  ck_assert_msg(labels[1] > 0.95, "Got %f\n", labels[1]);
-  ck_assert_msg(labels[2] > 0.95, "Got %f\n", labels[2]);
-  ck_assert_msg(labels[3] < 0.05, "Got %f\n", labels[3]);
+  neuralnet_destroy(loaded);
+  neuralnet_destroy(net);
+}
+END_TEST
+
+START_TEST(test_neuralnet_load_garbage) {
+  FILE *f = tmpfile();
+  fprintf(f, "definitely not a model");
+  rewind(f);
+  neuralnet *net;
+  ck_assert_int_eq(neuralnet_load(&net, f, 1), 0);
+  fclose(f);
+}
+END_TEST
+
+/**
+ * Export the net to C, compile it with a main that classifies the inputs
+ * given, run that and check it gets the same answers as the net.
+ */
+static void check_export_classify(neuralnet *net, const double *inputs,
+                                  int input_count) {
+  int in_dim = neuralnet_input_size(net);
+  int out_dim = neuralnet_output_size(net);
+  char source[64];
+  char program[64];
+  char results[64];
+  snprintf(source, sizeof(source), "check_export-%d.c", (int) getpid());
+  snprintf(program, sizeof(program), "check_export-%d", (int) getpid());
+  snprintf(results, sizeof(results), "check_export-%d.out", (int) getpid());
+  FILE *f = fopen(source, "w");
+  ck_assert_ptr_ne(f, NULL);
+  ck_assert_int_eq(neuralnet_export_c(net, f, "check_net"), 1);
+  fprintf(f, "\n#include <stdio.h>\n\n");
+  fprintf(f, "static const double inputs[] = {");
+  for (int i = 0; i < input_count * in_dim; i++) {
+    fprintf(f, " %a,", inputs[i]);
+  }
+  fprintf(f, " };\n\nint main(void) {\n");
+  fprintf(f, "  double output[CHECK_NET_OUTPUTS];\n");
+  fprintf(f, "  for (int i = 0; i < %d; i++) {\n", input_count);
+  fprintf(f, "    check_net_classify(&(inputs[i * CHECK_NET_INPUTS]), "
+             "output);\n");
+  fprintf(f, "    for (int o = 0; o < CHECK_NET_OUTPUTS; o++) {\n");
+  fprintf(f, "      printf(\"%%a\\n\", output[o]);\n");
+  fprintf(f, "    }\n  }\n  return 0;\n}\n");
+  fclose(f);
+  char command[512];
+  snprintf(command, sizeof(command), "%s -std=c99 -o %s %s -lm && ./%s > %s",
+           HELIOS_CC, program, source, program, results);
+  ck_assert_int_eq(system(command), 0);
+  double *expected = malloc(sizeof(double) * input_count * out_dim);
+  ck_assert_ptr_ne(expected, NULL);
+  ck_assert_int_eq(neuralnet_classify(net, inputs, expected, input_count), 1);
+  f = fopen(results, "r");
+  ck_assert_ptr_ne(f, NULL);
+  for (int i = 0; i < input_count * out_dim; i++) {
+    double got;
+    ck_assert_int_eq(fscanf(f, "%lf", &got), 1);
+    ck_assert_msg(fabs(expected[i] - got) < 1e-12,
+                  "Output %d: expected %f got %f\n", i, expected[i], got);
+  }
+  fclose(f);
+  free(expected);
+  remove(source);
+  remove(program);
+  remove(results);
+}
+
+START_TEST(test_neuralnet_export_c) {
+  neuralnet *net = make_small_net();
+  FILE *f = tmpfile();
+  ck_assert_int_eq(neuralnet_export_c(net, f, "xor_net"), 1);
+  long len = ftell(f);
+  rewind(f);
+  char *source = calloc(len + 1, 1);
+  ck_assert_int_eq(fread(source, 1, len, f), len);
+  fclose(f);
+  ck_assert_ptr_ne(strstr(source, "void xor_net_classify("), NULL);
+  ck_assert_ptr_ne(strstr(source, "#define XOR_NET_OUTPUTS 2"), NULL);
+  ck_assert_ptr_ne(strstr(source, "xor_net_w1[2][4]"), NULL);
+  free(source);
+  f = tmpfile();
+  ck_assert_int_eq(neuralnet_export_c(net, f, "not a prefix"), 0);
+  fclose(f);
+  /* The exported source classifies like the net */
+  double inputs[EXPORT_INPUTS * 12];
+  for (int i = 0; i < EXPORT_INPUTS * 12; i++) {
+    inputs[i] = (i % 7) / 6.0;
+  }
+  check_export_classify(net, inputs, EXPORT_INPUTS);
+  neuralnet_destroy(net);
+  /* Wide enough that the dot products get unrolled */
+  static const int layer_sizes[2] = { 10, 3 };
+  netconfig conf = { 0 };
+  conf.layers = 2;
+  conf.layer_sizes = layer_sizes;
+  conf.dimensionality = 12;
+  conf.activation = tanh;
+  conf.activation_prime = tanh_prime;
+  conf.threads = 2;
+  conf.alpha = 0.1;
+  conf.iscale = 0.5;
+  conf.max_width = 12;
+  ck_assert_int_eq(neuralnet_create(&net, conf), 1);
+  check_export_classify(net, inputs, EXPORT_INPUTS);
+  neuralnet_destroy(net);
+}
+END_TEST
+
+START_TEST(test_neuralnet_classify_pipelined) {
+  int layer_sizes[4] = { 7, 5, 6, 3 };
+  netconfig conf = { 0 };
+  conf.layers = 4;
+  conf.layer_sizes = layer_sizes;
+  conf.dimensionality = 4;
+  conf.activation = sigmoid;
+  conf.activation_prime = sigmoid_prime;
+  conf.threads = 2;
+  conf.alpha = 0.1;
+  conf.iscale = 0.5;
+  conf.max_width = 7;
+  neuralnet *net;
+  ck_assert_int_eq(neuralnet_create(&net, conf), 1);
+  double inputs[PIPELINE_INPUTS * 4];
+  for (int i = 0; i < PIPELINE_INPUTS * 4; i++) {
+    inputs[i] = (i % 11) / 10.0;
+  }
+  double expected[PIPELINE_INPUTS * 3];
+  double got[PIPELINE_INPUTS * 3];
+  ck_assert_int_eq(neuralnet_classify(net, inputs, expected, PIPELINE_INPUTS),
+                   1);
+  /* 9 stages gets clamped to one per layer */
+  int stages[4] = { 1, 2, 3, 9 };
+  for (int s = 0; s < 4; s++) {
+    memset(got, 0, sizeof(got));
+    ck_assert_int_eq(neuralnet_classify_pipelined(net, inputs, got,
+                                                  PIPELINE_INPUTS, stages[s]),
+                     1);
+    for (int i = 0; i < PIPELINE_INPUTS * 3; i++) {
+      ck_assert_msg(expected[i] == got[i], "%d stages: expected %f got %f\n",
+                    stages[s], expected[i], got[i]);
+    }
+  }
+  neuralnet_destroy(net);
+}
+END_TEST
+
+START_TEST(test_neuralnet_evaluate) {
+  int layer_sizes[2] = { 4, 3 };
+  netconfig conf = { 0 };
+  conf.layers = 2;
+  conf.layer_sizes = layer_sizes;
+  conf.dimensionality = 2;
+  conf.activation = sigmoid;
+  conf.activation_prime = sigmoid_prime;
+  conf.alpha = 0.1;
+  conf.iscale = 0.5;
+  conf.max_width = 4;
+  conf.seed = 1;
+  double inputs[EVAL_INPUTS * 2];
+  double labels[EVAL_INPUTS * 3] = { 0 };
+  for (int i = 0; i < EVAL_INPUTS; i++) {
+    inputs[i * 2] = (i % 5) / 5.0;
+    inputs[i * 2 + 1] = (i % 3) / 3.0;
+    labels[i * 3 + (i % 3)] = 1;
+  }
+  /* Work out what the metrics should be the slow way */
+  double results[EVAL_INPUTS * 3];
+  double sse = 0;
+  double ce = 0;
+  int correct = 0;
+  int threads[3] = { 1, 2, 3 };
+  neuralnet *net = NULL;
+  for (int t = 0; t < 3; t++) {
+    conf.threads = threads[t];
+    ck_assert_int_eq(neuralnet_create(&net, conf), 1);
+    if (!t) {
+      ck_assert_int_eq(neuralnet_classify(net, inputs, results, EVAL_INPUTS),
+                       1);
+      for (int i = 0; i < EVAL_INPUTS; i++) {
+        int best = 0;
+        for (int o = 0; o < 3; o++) {
+          double out = results[i * 3 + o];
+          double label = labels[i * 3 + o];
+          sse += (label - out) * (label - out);
+          ce -= label * log(out) + (1 - label) * log(1 - out);
+          if (out > results[i * 3 + best]) {
+            best = o;
+          }
+        }
+        correct += labels[i * 3 + best] == 1;
+      }
+    }
+    netmetrics metrics;
+    ck_assert_int_eq(neuralnet_evaluate(net, inputs, labels, EVAL_INPUTS,
+                                        &metrics), 1);
+    ck_assert_int_eq(metrics.count, EVAL_INPUTS);
+    ck_assert_msg(fabs(metrics.mse - sse / (EVAL_INPUTS * 3)) < 1e-12,
+                  "Got mse %f\n", metrics.mse);
+    ck_assert_msg(fabs(metrics.cross_entropy - ce / EVAL_INPUTS) < 1e-12,
+                  "Got cross entropy %f\n", metrics.cross_entropy);
+    ck_assert_msg(metrics.accuracy == correct / (double) EVAL_INPUTS,
+                  "Got accuracy %f\n", metrics.accuracy);
+    neuralnet_destroy(net);
+  }
+}
+END_TEST
+
+/**
+ * Create a 4-5-3 net with the threads and pool given, optionally inference
+ * only.
+ */
+static neuralnet *make_pooled_net(int threads, threadpool *pool,
+                                  int inference_only) {
+  static const int layer_sizes[2] = { 5, 3 };
+  netconfig conf = { 0 };
+  conf.layers = 2;
+  conf.layer_sizes = layer_sizes;
+  conf.dimensionality = 4;
+  conf.activation = sigmoid;
+  conf.activation_prime = sigmoid_prime;
+  conf.threads = threads;
+  conf.alpha = 0.1;
+  conf.iscale = 0.5;
+  conf.max_width = 5;
+  conf.seed = 9;
+  conf.inference_only = inference_only;
+  conf.pool = pool;
+  neuralnet *net;
+  ck_assert_int_eq(neuralnet_create(&net, conf), 1);
+  return net;
+}
+
+/**
+ * Create a 4-5-3 net with the threads given, optionally inference only.
+ */
+static neuralnet *make_inference_net(int threads, int inference_only) {
+  return make_pooled_net(threads, NULL, inference_only);
+}
+
+START_TEST(test_neuralnet_inference_only) {
+  double inputs[EVAL_INPUTS * 4];
+  double labels[EVAL_INPUTS * 3] = { 0 };
+  for (int i = 0; i < EVAL_INPUTS; i++) {
+    for (int d = 0; d < 4; d++) {
+      inputs[i * 4 + d] = ((i + d) % 7) / 7.0;
+    }
+    labels[i * 3 + (i % 3)] = 1;
+  }
+  neuralnet *full = make_inference_net(2, 0);
+  double expected[EVAL_INPUTS * 3];
+  ck_assert_int_eq(neuralnet_classify(full, inputs, expected, EVAL_INPUTS), 1);
+  netmetrics want;
+  ck_assert_int_eq(neuralnet_evaluate(full, inputs, labels, EVAL_INPUTS,
+                                      &want), 1);
+  int threads[2] = { 0, 2 };
+  for (int t = 0; t < 2; t++) {
+    neuralnet *net = make_inference_net(threads[t], 1);
+    double got[EVAL_INPUTS * 3];
+    ck_assert_int_eq(neuralnet_classify(net, inputs, got, EVAL_INPUTS), 1);
+    ck_assert_int_eq(memcmp(expected, got, sizeof(expected)), 0);
+    memset(got, 0, sizeof(got));
+    ck_assert_int_eq(neuralnet_classify_pipelined(net, inputs, got,
+                                                  EVAL_INPUTS, 2), 1);
+    ck_assert_int_eq(memcmp(expected, got, sizeof(expected)), 0);
+    netmetrics metrics;
+    ck_assert_int_eq(neuralnet_evaluate(net, inputs, labels, EVAL_INPUTS,
+                                        &metrics), 1);
+    ck_assert_msg(fabs(metrics.mse - want.mse) < 1e-12, "Got mse %f\n",
+                  metrics.mse);
+    ck_assert(metrics.accuracy == want.accuracy);
+    /* No training without the buffers for it */
+    ck_assert_int_eq(neuralnet_train(net, inputs, labels, EVAL_INPUTS), 0);
+    neuralnet_destroy(net);
+  }
+  /* A trained net can be shipped to an inference only one */
+  ck_assert_int_eq(neuralnet_train(full, inputs, labels, EVAL_INPUTS), 1);
+  ck_assert_int_eq(neuralnet_classify(full, inputs, expected, EVAL_INPUTS), 1);
+  FILE *f = tmpfile();
+  ck_assert_int_eq(neuralnet_save(full, f), 1);
+  rewind(f);
+  neuralnet *loaded;
+  ck_assert_int_eq(neuralnet_load_inference(&loaded, f, 0), 1);
+  fclose(f);
+  double got[EVAL_INPUTS * 3];
+  ck_assert_int_eq(neuralnet_classify(loaded, inputs, got, EVAL_INPUTS), 1);
+  ck_assert_int_eq(memcmp(expected, got, sizeof(expected)), 0);
+  ck_assert_int_eq(neuralnet_train(loaded, inputs, labels, EVAL_INPUTS), 0);
+  neuralnet_destroy(loaded);
+  neuralnet_destroy(full);
+}
+END_TEST
+
+START_TEST(test_neuralnet_no_threads) {
+  double inputs[EVAL_INPUTS * 4];
+  double labels[EVAL_INPUTS * 3] = { 0 };
+  for (int i = 0; i < EVAL_INPUTS; i++) {
+    for (int d = 0; d < 4; d++) {
+      inputs[i * 4 + d] = ((i * d) % 5) / 5.0;
+    }
+    labels[i * 3 + (i % 3)] = 1;
+  }
+  /* Running on the calling thread is just one job done there */
+  neuralnet *pooled = make_inference_net(1, 0);
+  neuralnet *inline_net = make_inference_net(0, 0);
+  for (int i = 0; i < 10; i++) {
+    ck_assert_int_eq(neuralnet_train(pooled, inputs, labels, EVAL_INPUTS), 1);
+    ck_assert_int_eq(neuralnet_train(inline_net, inputs, labels, EVAL_INPUTS),
+                     1);
+  }
+  double expected[INIT_PARAMS];
+  double got[INIT_PARAMS];
+  neuralnet_get_params(pooled, expected);
+  neuralnet_get_params(inline_net, got);
+  ck_assert_int_eq(memcmp(expected, got, sizeof(expected)), 0);
+  neuralnet_destroy(inline_net);
+  neuralnet_destroy(pooled);
+}
+END_TEST
+
+START_TEST(test_neuralnet_train_stats) {
+  double inputs[EVAL_INPUTS * 4];
+  double labels[EVAL_INPUTS * 3] = { 0 };
+  for (int i = 0; i < EVAL_INPUTS; i++) {
+    for (int d = 0; d < 4; d++) {
+      inputs[i * 4 + d] = ((i + 2 * d) % 5) / 5.0;
+    }
+    labels[i * 3 + (i % 3)] = 1;
+  }
+  int threads[3] = { 0, 2, 3 };
+  for (int t = 0; t < 3; t++) {
+    /* Work the loss out the slow way: classify each input just before
+     * training on it */
+    neuralnet *slow = make_inference_net(threads[t], 0);
+    double loss = 0;
+    for (int i = 0; i < EVAL_INPUTS; i++) {
+      double out[3];
+      ck_assert_int_eq(neuralnet_classify(slow, &(inputs[i * 4]), out, 1), 1);
+      for (int o = 0; o < 3; o++) {
+        loss += (labels[i * 3 + o] - out[o]) * (labels[i * 3 + o] - out[o]);
+      }
+      ck_assert_int_eq(neuralnet_train(slow, &(inputs[i * 4]),
+                                       &(labels[i * 3]), 1), 1);
+    }
+    neuralnet *net = make_inference_net(threads[t], 0);
+    trainstats stats;
+    ck_assert_int_eq(neuralnet_train_stats(net, inputs, labels, EVAL_INPUTS,
+                                           &stats), 1);
+    ck_assert_int_eq(stats.count, EVAL_INPUTS);
+    ck_assert_msg(fabs(stats.loss - loss) < 1e-12, "Expected %f got %f\n",
+                  loss, stats.loss);
+    ck_assert_msg(fabs(stats.mse - loss / (EVAL_INPUTS * 3)) < 1e-12,
+                  "Got mse %f\n", stats.mse);
+    /* And keeping track doesn't change the training */
+    double expected[INIT_PARAMS];
+    double got[INIT_PARAMS];
+    neuralnet_get_params(slow, expected);
+    neuralnet_get_params(net, got);
+    ck_assert_int_eq(memcmp(expected, got, sizeof(expected)), 0);
+    neuralnet_destroy(net);
+    neuralnet_destroy(slow);
+  }
+}
+END_TEST
+
+/**
+ * What one of the nets sharing a pool trains on.
+ */
+typedef struct {
+  neuralnet *net;
+  double inputs[EVAL_INPUTS * 4];
+  double labels[EVAL_INPUTS * 3];
+  int ok;
+} shared_trainer;
+
+static void *train_shared(void *arg) {
+  shared_trainer *trainer = (shared_trainer *) arg;
+  trainer->ok = 1;
+  for (int i = 0; i < SHARED_ITERATIONS; i++) {
+    trainer->ok &= neuralnet_train(trainer->net, trainer->inputs,
+                                   trainer->labels, EVAL_INPUTS);
+  }
+  return NULL;
+}
+
+START_TEST(test_neuralnet_shared_pool) {
+  threadpool *pool;
+  ck_assert_int_eq(threadpool_create(&pool, 2), 1);
+  shared_trainer trainers[SHARED_NETS];
+  pthread_t threads[SHARED_NETS];
+  for (int n = 0; n < SHARED_NETS; n++) {
+    shared_trainer *trainer = &(trainers[n]);
+    memset(trainer->labels, 0, sizeof(trainer->labels));
+    for (int i = 0; i < EVAL_INPUTS; i++) {
+      for (int d = 0; d < 4; d++) {
+        trainer->inputs[i * 4 + d] = ((i + d * n) % 6) / 6.0;
+      }
+      trainer->labels[i * 3 + ((i + n) % 3)] = 1;
+    }
+    /* More jobs than the pool has threads is fine */
+    trainer->net = make_pooled_net(n ? 3 : 0, pool, 0);
+    ck_assert_int_eq(pthread_create(&(threads[n]), NULL, train_shared,
+                                    trainer), 0);
+  }
+  for (int n = 0; n < SHARED_NETS; n++) {
+    pthread_join(threads[n], NULL);
+    ck_assert(trainers[n].ok);
+  }
+  /* Each net should have come out just like one trained on its own pool */
+  for (int n = 0; n < SHARED_NETS; n++) {
+    neuralnet *alone = make_inference_net(n ? 3 : 2, 0);
+    for (int i = 0; i < SHARED_ITERATIONS; i++) {
+      ck_assert_int_eq(neuralnet_train(alone, trainers[n].inputs,
+                                       trainers[n].labels, EVAL_INPUTS), 1);
+    }
+    double expected[INIT_PARAMS];
+    double got[INIT_PARAMS];
+    neuralnet_get_params(alone, expected);
+    neuralnet_get_params(trainers[n].net, got);
+    for (int i = 0; i < INIT_PARAMS; i++) {
+      ck_assert_msg(fabs(expected[i] - got[i]) < 1e-12,
+                    "Net %d param %d: expected %f got %f\n", n, i,
+                    expected[i], got[i]);
+    }
+    neuralnet_destroy(alone);
+  }
+  /* The nets don't own the pool, so it's still fine to load onto it */
+  FILE *f = tmpfile();
+  ck_assert_int_eq(neuralnet_save(trainers[0].net, f), 1);
+  rewind(f);
+  neuralnet *loaded;
+  ck_assert_int_eq(neuralnet_load_shared(&loaded, f, pool, 0, 1), 1);
+  fclose(f);
+  for (int n = 0; n < SHARED_NETS; n++) {
+    neuralnet_destroy(trainers[n].net);
+  }
+  double results[EVAL_INPUTS * 3];
+  ck_assert_int_eq(neuralnet_classify(loaded, trainers[0].inputs, results,
+                                      EVAL_INPUTS), 1);
+  neuralnet_destroy(loaded);
+  threadpool_destroy(pool);
+}
+END_TEST
+
+/**
+ * Create a 4-5-3 net with the seed, init, threads and max width given and
+ * get its parameters.
+ */
+static void init_params(unsigned long seed, weight_init init, int threads,
+                        int max_width, double *params) {
+  int layer_sizes[2] = { 5, 3 };
+  netconfig conf = { 0 };
+  conf.layers = 2;
+  conf.layer_sizes = layer_sizes;
+  conf.dimensionality = 4;
+  conf.activation = sigmoid;
+  conf.activation_prime = sigmoid_prime;
+  conf.threads = threads;
+  conf.alpha = 0.1;
+  conf.iscale = 0.5;
+  conf.max_width = max_width;
+  conf.seed = seed;
+  conf.init = init;
+  neuralnet *net;
+  ck_assert_int_eq(neuralnet_create(&net, conf), 1);
+  ck_assert_int_eq(neuralnet_param_count(net), INIT_PARAMS);
+  neuralnet_get_params(net, params);
+  neuralnet_destroy(net);
+}
+
+START_TEST(test_neuralnet_init_threads) {
+  double expected[INIT_PARAMS];
+  double got[INIT_PARAMS];
+  init_params(3, INIT_UNIFORM, 1, 5, expected);
+  for (int i = 0; i < INIT_PARAMS; i++) {
+    ck_assert_msg(expected[i] >= 0 && expected[i] < 1, "Got %f\n",
+                  expected[i]);
+  }
+  int threads[3] = { 2, 3, 4 };
+  for (int t = 0; t < 3; t++) {
+    /* Neither the thread count nor the padding should matter */
+    init_params(3, INIT_UNIFORM, threads[t], 5 + t, got);
+    ck_assert_int_eq(memcmp(expected, got, sizeof(expected)), 0);
+  }
+}
+END_TEST
+
+START_TEST(test_neuralnet_init_seed) {
+  double first[INIT_PARAMS];
+  double again[INIT_PARAMS];
+  double other[INIT_PARAMS];
+  init_params(11, INIT_XAVIER, 2, 5, first);
+  init_params(11, INIT_XAVIER, 2, 5, again);
+  init_params(12, INIT_XAVIER, 2, 5, other);
+  ck_assert_int_eq(memcmp(first, again, sizeof(first)), 0);
+  int same = 0;
+  for (int i = 0; i < INIT_PARAMS; i++) {
+    same += first[i] == other[i];
+  }
+  /* Only the biases, which are all 0 */
+  ck_assert_int_eq(same, 8);
+}
+END_TEST
+
+START_TEST(test_neuralnet_init_xavier_he) {
+  double params[INIT_PARAMS];
+  weight_init inits[2] = { INIT_XAVIER, INIT_HE };
+  /* The first layer's limits, then the second's */
+  double limits[2][2] = { { sqrt(6.0 / 9), sqrt(6.0 / 8) },
+                          { sqrt(6.0 / 4), sqrt(6.0 / 5) } };
+  for (int k = 0; k < 2; k++) {
+    init_params(5, inits[k], 2, 5, params);
+    for (int i = 0; i < INIT_PARAMS; i++) {
+      int layer = i >= 25;
+      int inputs = layer ? 5 : 4;
+      int index = layer ? (i - 25) % 6 : i % 5;
+      if (index == inputs) {
+        ck_assert_msg(params[i] == 0, "Bias %d is %f\n", i, params[i]);
+      } else {
+        ck_assert_msg(fabs(params[i]) <= limits[k][layer],
+                      "Weight %d is %f\n", i, params[i]);
+      }
+    }
+  }
+  /* Unknown inits are refused */
+  int layer_sizes[1] = { 1 };
+  netconfig conf = { 0 };
+  conf.layers = 1;
+  conf.layer_sizes = layer_sizes;
+  conf.dimensionality = 1;
+  conf.activation = sigmoid;
+  conf.activation_prime = sigmoid_prime;
+  conf.threads = 1;
+  conf.max_width = 1;
+  conf.init = (weight_init) 42;
+  neuralnet *net;
+  ck_assert_int_eq(neuralnet_create(&net, conf), 0);
+}
+END_TEST
+
+/**
+ * An activation that leaves everything alone, so we can see what pooling
+ * did.
+ */
+static double identity(double x) {
+  return x;
+}
+
+/**
+ * An activation that isn't monotonic.
+ */
+static double square(double x) {
+  return x * x;
+}
+
+/**
+ * Create a net with the layers given, and give it a sample to chew on.
+ */
+static neuralnet *make_conv_net(int layers, const int *layer_sizes,
+                                const conv_spec *conv, int dim,
+                                int max_width, int threads,
+                                activation_func activation) {
+  netconfig conf = { 0 };
+  conf.layers = layers;
+  conf.layer_sizes = layer_sizes;
+  conf.dimensionality = dim;
+  conf.activation = activation;
+  conf.activation_prime = sigmoid_prime;
+  conf.threads = threads;
+  conf.alpha = 0.5;
+  conf.iscale = 1;
+  conf.max_width = max_width;
+  conf.seed = 9;
+  conf.init = INIT_XAVIER;
+  conf.conv = conv;
+  neuralnet *net;
+  ck_assert_int_eq(neuralnet_create(&net, conf), 1);
+  return net;
+}
+
+START_TEST(test_neuralnet_conv_as_dense) {
+  /* 6 inputs -> 2x3x4 -> conv (3 filters of 3x3, stride 2, padding 1) ->
+   * 3x2x2 -> 2 outputs, next to the same thing with the conv layer written
+   * out as a dense one */
+  static const int sizes[3] = { 24, 12, 2 };
+  conv_spec conv[3] = { { 0 } };
+  conv[1].filters = 3;
+  conv[1].channels = 2;
+  conv[1].height = 3;
+  conv[1].width = 4;
+  conv[1].kernel = 3;
+  conv[1].stride = 2;
+  conv[1].padding = 1;
+  int conv_count = 24 * 7 + 3 * 19 + 2 * 13;
+  int dense_count = 24 * 7 + 12 * 25 + 2 * 13;
+  double conv_params[24 * 7 + 3 * 19 + 2 * 13];
+  double dense_params[24 * 7 + 12 * 25 + 2 * 13];
+  double input[6] = { 0.1, 0.9, 0.4, 0.3, 0.8, 0.2 };
+  double label[2] = { 1, 0 };
+  for (int threads = 1; threads <= 3; threads++) {
+    neuralnet *cnet = make_conv_net(3, sizes, conv, 6, 24, threads, sigmoid);
+    neuralnet *dnet = make_conv_net(3, sizes, NULL, 6, 24, threads, sigmoid);
+    ck_assert_int_eq(neuralnet_param_count(cnet), conv_count);
+    ck_assert_int_eq(neuralnet_param_count(dnet), dense_count);
+    neuralnet_get_params(cnet, conv_params);
+    /* Lay the filters out as a dense layer */
+    memset(dense_params, 0, sizeof(dense_params));
+    memcpy(dense_params, conv_params, sizeof(double) * 24 * 7);
+    memcpy(&(dense_params[24 * 7 + 12 * 25]), &(conv_params[24 * 7 + 3 * 19]),
+           sizeof(double) * 2 * 13);
+    double *filters = &(conv_params[24 * 7]);
+    double *dense = &(dense_params[24 * 7]);
+    for (int f = 0; f < 3; f++) {
+      for (int pos = 0; pos < 4; pos++) {
+        double *row = &(dense[(f * 4 + pos) * 25]);
+        row[24] = filters[f * 19 + 18];
+        for (int c = 0; c < 2; c++) {
+          for (int ky = 0; ky < 3; ky++) {
+            for (int kx = 0; kx < 3; kx++) {
+              int iy = (pos / 2) * 2 + ky - 1;
+              int ix = (pos % 2) * 2 + kx - 1;
+              if (iy >= 0 && iy < 3 && ix >= 0 && ix < 4) {
+                row[c * 12 + iy * 4 + ix] = filters[f * 19 + c * 9 + ky * 3 +
+                                                    kx];
+              }
+            }
+          }
+        }
+      }
+    }
+    neuralnet_set_params(dnet, dense_params);
+    double conv_out[2];
+    double dense_out[2];
+    ck_assert_int_eq(neuralnet_classify(cnet, input, conv_out, 1), 1);
+    ck_assert_int_eq(neuralnet_classify(dnet, input, dense_out, 1), 1);
+    for (int o = 0; o < 2; o++) {
+      ck_assert_msg(fabs(conv_out[o] - dense_out[o]) < 1e-12,
+                    "Expected %f got %f\n", dense_out[o], conv_out[o]);
+    }
+    /* One step of training has to move everything the same way */
+    ck_assert_int_eq(neuralnet_train(cnet, input, label, 1), 1);
+    ck_assert_int_eq(neuralnet_train(dnet, input, label, 1), 1);
+    double conv_after[24 * 7 + 3 * 19 + 2 * 13];
+    double dense_after[24 * 7 + 12 * 25 + 2 * 13];
+    neuralnet_get_params(cnet, conv_after);
+    neuralnet_get_params(dnet, dense_after);
+    for (int i = 0; i < 24 * 7; i++) {
+      ck_assert_msg(fabs(conv_after[i] - dense_after[i]) < 1e-12,
+                    "First layer param %d: expected %f got %f\n", i,
+                    dense_after[i], conv_after[i]);
+    }
+    for (int i = 0; i < 2 * 13; i++) {
+      double got = conv_after[24 * 7 + 3 * 19 + i];
+      double expected = dense_after[24 * 7 + 12 * 25 + i];
+      ck_assert_msg(fabs(got - expected) < 1e-12,
+                    "Last layer param %d: expected %f got %f\n", i, expected,
+                    got);
+    }
+    /* The filters move by the sum of what their copies did */
+    double moved[3 * 19] = { 0 };
+    for (int f = 0; f < 3; f++) {
+      for (int pos = 0; pos < 4; pos++) {
+        int row = 24 * 7 + (f * 4 + pos) * 25;
+        moved[f * 19 + 18] += dense_after[row + 24] - dense_params[row + 24];
+        for (int c = 0; c < 2; c++) {
+          for (int ky = 0; ky < 3; ky++) {
+            for (int kx = 0; kx < 3; kx++) {
+              int iy = (pos / 2) * 2 + ky - 1;
+              int ix = (pos % 2) * 2 + kx - 1;
+              if (iy >= 0 && iy < 3 && ix >= 0 && ix < 4) {
+                int w = row + c * 12 + iy * 4 + ix;
+                moved[f * 19 + c * 9 + ky * 3 + kx] += dense_after[w] -
+                                                       dense_params[w];
+              }
+            }
+          }
+        }
+      }
+    }
+    for (int i = 0; i < 3 * 19; i++) {
+      double got = conv_after[24 * 7 + i] - conv_params[24 * 7 + i];
+      ck_assert_msg(fabs(got - moved[i]) < 1e-12,
+                    "Filter param %d: expected to move %g, moved %g\n", i,
+                    moved[i], got);
+    }
+    neuralnet_destroy(cnet);
+    neuralnet_destroy(dnet);
+  }
+}
+END_TEST
+
+START_TEST(test_neuralnet_conv_pool) {
+  /* 1x6x6 -> 2 filters of 3x3, padding 1 -> 2x6x6, pooled 2x2 -> 2x3x3.
+   * The last layers just pass the conv layers' outputs through, so we can
+   * look at them */
+  static const int sizes[2] = { 72, 72 };
+  static const int pooled_sizes[2] = { 18, 18 };
+  conv_spec conv[2] = { { 0 } };
+  conv[0].filters = 2;
+  conv[0].channels = 1;
+  conv[0].height = 6;
+  conv[0].width = 6;
+  conv[0].kernel = 3;
+  conv[0].padding = 1;
+  double input[36];
+  for (int i = 0; i < 36; i++) {
+    input[i] = ((i * 7) % 11) / 10.0 - 0.5;
+  }
+  /* Squaring isn't monotonic, so it has to be done before pooling to
+   * pick the biggest output */
+  activation_func activations[2] = { identity, square };
+  for (int a = 0; a < 2; a++) {
+    conv[0].pool = 0;
+    neuralnet *plain = make_conv_net(2, sizes, conv, 36, 72, 2,
+                                     activations[a]);
+    conv[0].pool = 2;
+    neuralnet *pooled = make_conv_net(2, pooled_sizes, conv, 36, 72, 3,
+                                      activations[a]);
+    double plain_params[2 * 10 + 72 * 73] = { 0 };
+    double pooled_params[2 * 10 + 18 * 19] = { 0 };
+    neuralnet_get_params(plain, plain_params);
+    memset(&(plain_params[2 * 10]), 0, sizeof(double) * 72 * 73);
+    memcpy(pooled_params, plain_params, sizeof(double) * 2 * 10);
+    for (int o = 0; o < 72; o++) {
+      plain_params[2 * 10 + o * 73 + o] = 1;
+    }
+    for (int o = 0; o < 18; o++) {
+      pooled_params[2 * 10 + o * 19 + o] = 1;
+    }
+    neuralnet_set_params(plain, plain_params);
+    neuralnet_set_params(pooled, pooled_params);
+    double plain_out[72];
+    double pooled_out[18];
+    ck_assert_int_eq(neuralnet_classify(plain, input, plain_out, 1), 1);
+    ck_assert_int_eq(neuralnet_classify(pooled, input, pooled_out, 1), 1);
+    double best[18];
+    int biggest = 0;
+    for (int i = 0; i < 18; i++) {
+      int f = i / 9;
+      int y = (i % 9) / 3;
+      int x = i % 3;
+      best[i] = plain_out[f * 36 + 2 * y * 6 + 2 * x];
+      for (int py = 0; py < 2; py++) {
+        for (int px = 0; px < 2; px++) {
+          double value = plain_out[f * 36 + (2 * y + py) * 6 + 2 * x + px];
+          if (value > best[i]) {
+            best[i] = value;
+          }
+        }
+      }
+      if (fabs(best[i]) > fabs(best[biggest])) {
+        biggest = i;
+      }
+    }
+    /* The two only differ by the scale each net gives its conv layer */
+    double scale = pooled_out[biggest] / best[biggest];
+    ck_assert_msg(scale > 0, "Got scale %f\n", scale);
+    for (int i = 0; i < 18; i++) {
+      ck_assert_msg(fabs(pooled_out[i] - scale * best[i]) < 1e-9,
+                    "Output %d: expected %f got %f\n", i, scale * best[i],
+                    pooled_out[i]);
+    }
+    /* The pipeline runs the conv layer on one thread, the pool splits it up;
+     * they had better agree */
+    double serial[18];
+    ck_assert_int_eq(neuralnet_classify_pipelined(pooled, input, serial, 1, 2),
+                     1);
+    for (int i = 0; i < 18; i++) {
+      ck_assert(serial[i] == pooled_out[i]);
+    }
+    neuralnet_destroy(plain);
+    neuralnet_destroy(pooled);
+  }
+}
+END_TEST
+
+START_TEST(test_neuralnet_conv_bars) {
+  /* Tell horizontal bars from vertical ones in 4x4 images:
+   * 1x4x4 -> 2 filters of 3x3, padding 1, pooled 2x2 -> 2x2x2 -> 1 */
+  static const int sizes[2] = { 8, 1 };
+  conv_spec conv[2] = { { 0 } };
+  conv[0].filters = 2;
+  conv[0].channels = 1;
+  conv[0].height = 4;
+  conv[0].width = 4;
+  conv[0].kernel = 3;
+  conv[0].padding = 1;
+  conv[0].pool = 2;
+  double inputs[8 * 16] = { 0 };
+  double labels[8];
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 4; j++) {
+      inputs[i * 16 + i * 4 + j] = 1;
+      inputs[(i + 4) * 16 + j * 4 + i] = 1;
+    }
+    labels[i] = 1;
+    labels[i + 4] = 0;
+  }
+  neuralnet *net = make_conv_net(2, sizes, conv, 16, 16, 2, sigmoid);
+  for (int i = 0; i < CONV_ITERATIONS; i++) {
+    ck_assert_int_eq(neuralnet_train(net, inputs, labels, 8), 1);
+  }
+  netmetrics metrics;
+  ck_assert_int_eq(neuralnet_evaluate(net, inputs, labels, 8, &metrics), 1);
+  ck_assert_msg(metrics.accuracy == 1, "Got accuracy %f\n", metrics.accuracy);
+  ck_assert_msg(metrics.mse < 0.01, "Got mse %f\n", metrics.mse);
+  /* Conv layers survive a round trip */
+  FILE *f = tmpfile();
+  ck_assert_int_eq(neuralnet_save(net, f), 1);
+  rewind(f);
+  neuralnet *loaded;
+  ck_assert_int_eq(neuralnet_load(&loaded, f, 3), 1);
+  fclose(f);
+  double expected[8];
+  double got[8];
+  ck_assert_int_eq(neuralnet_classify(net, inputs, expected, 8), 1);
+  ck_assert_int_eq(neuralnet_classify(loaded, inputs, got, 8), 1);
+  ck_assert_int_eq(memcmp(expected, got, sizeof(expected)), 0);
+  neuralnet_destroy(loaded);
+  /* And load fine without the back propagation buffers too */
+  f = tmpfile();
+  ck_assert_int_eq(neuralnet_save(net, f), 1);
+  rewind(f);
+  ck_assert_int_eq(neuralnet_load_inference(&loaded, f, 0), 1);
+  fclose(f);
+  memset(got, 0, sizeof(got));
+  ck_assert_int_eq(neuralnet_classify(loaded, inputs, got, 8), 1);
+  ck_assert_int_eq(memcmp(expected, got, sizeof(expected)), 0);
+  /* But they can't be exported */
+  f = tmpfile();
+  ck_assert_int_eq(neuralnet_export_c(net, f, "bars"), 0);
+  fclose(f);
+  neuralnet_destroy(loaded);
+  neuralnet_destroy(net);
+}
+END_TEST
+
+START_TEST(test_neuralnet_conv_bad_spec) {
+  int sizes[2] = { 8, 1 };
+  conv_spec conv[2] = { { 0 } };
+  conv[0].filters = 2;
+  conv[0].channels = 1;
+  conv[0].height = 4;
+  conv[0].width = 4;
+  conv[0].kernel = 3;
+  conv[0].padding = 1;
+  conv[0].pool = 2;
+  netconfig conf = { 0 };
+  conf.layers = 2;
+  conf.layer_sizes = sizes;
+  conf.dimensionality = 16;
+  conf.activation = sigmoid;
+  conf.activation_prime = sigmoid_prime;
+  conf.threads = 1;
+  conf.max_width = 16;
+  conf.conv = conv;
+  neuralnet *net;
+  ck_assert_int_eq(neuralnet_create(&net, conf), 1);
+  neuralnet_destroy(net);
+  /* The wrong size for what the filters make */
+  sizes[0] = 9;
+  ck_assert_int_eq(neuralnet_create(&net, conf), 0);
+  sizes[0] = 8;
+  /* An input shape that isn't the inputs' */
+  conv[0].width = 5;
+  ck_assert_int_eq(neuralnet_create(&net, conf), 0);
+  conv[0].width = 4;
+  /* Filters that don't fit in max_width: 2x2x4 -> 4 filters of 2x3x3 */
+  conv[0].filters = 4;
+  conv[0].channels = 2;
+  conv[0].height = 2;
+  conv[0].width = 4;
+  ck_assert_int_eq(neuralnet_create(&net, conf), 0);
+  conv[0].filters = 2;
+  conv[0].channels = 1;
+  conv[0].height = 4;
+  conv[0].width = 4;
+  /* A conv output layer */
+  conv[1] = conv[0];
+  conv[1].channels = 2;
+  conv[1].height = 2;
+  conv[1].width = 2;
+  conv[1].kernel = 1;
+  conv[1].padding = 0;
+  conv[1].pool = 0;
+  conv[1].filters = 1;
+  sizes[1] = 4;
+  ck_assert_int_eq(neuralnet_create(&net, conf), 0);
+}
+END_TEST
+
+/**
+ * Create a 5 -> 8 -> 12 net that samples its outputs, and one-hot inputs
+ * and labels for it: input i is the binary code of class i.
+ */
+static neuralnet *make_sampled_net(int threads, int output_samples,
+                                   double *inputs, double *labels) {
+  static const int sizes[2] = { 8, SAMPLED_OUTPUTS };
+  for (int i = 0; i < SAMPLED_OUTPUTS; i++) {
+    for (int d = 0; d < 4; d++) {
+      inputs[i * 5 + d] = (i >> d) & 1;
+    }
+    inputs[i * 5 + 4] = 1;
+    for (int o = 0; o < SAMPLED_OUTPUTS; o++) {
+      labels[i * SAMPLED_OUTPUTS + o] = i == o;
+    }
+  }
+  netconfig conf = { 0 };
+  conf.layers = 2;
+  conf.layer_sizes = sizes;
+  conf.dimensionality = 5;
+  conf.activation = sigmoid;
+  conf.activation_prime = sigmoid_prime;
+  conf.threads = threads;
+  conf.alpha = 0.5;
+  conf.iscale = 1;
+  conf.max_width = SAMPLED_OUTPUTS;
+  conf.seed = 11;
+  conf.init = INIT_XAVIER;
+  conf.output_samples = output_samples;
+  neuralnet *net;
+  ck_assert_int_eq(neuralnet_create(&net, conf), 1);
+  return net;
+}
+
+START_TEST(test_neuralnet_output_samples) {
+  double inputs[SAMPLED_OUTPUTS * 5];
+  double labels[SAMPLED_OUTPUTS * SAMPLED_OUTPUTS];
+  int threads[3] = { 0, 2, 3 };
+  for (int t = 0; t < 3; t++) {
+    /* Sampling more outputs than there are is just training on them all */
+    neuralnet *full = make_sampled_net(threads[t], 0, inputs, labels);
+    neuralnet *all = make_sampled_net(threads[t], 100, inputs, labels);
+    trainstats want, got;
+    ck_assert_int_eq(neuralnet_train_stats(full, inputs, labels,
+                                           SAMPLED_OUTPUTS, &want), 1);
+    ck_assert_int_eq(neuralnet_train_stats(all, inputs, labels,
+                                           SAMPLED_OUTPUTS, &got), 1);
+    ck_assert(fabs(want.loss - got.loss) < 1e-12);
+    ck_assert(fabs(want.mse - got.mse) < 1e-12);
+    double expected[SAMPLED_PARAMS];
+    double params[SAMPLED_PARAMS];
+    neuralnet_get_params(full, expected);
+    neuralnet_get_params(all, params);
+    ck_assert_int_eq(memcmp(expected, params, sizeof(params)), 0);
+    neuralnet_destroy(all);
+    neuralnet_destroy(full);
+    /* Otherwise only the label's output and the sampled ones change */
+    neuralnet *net = make_sampled_net(threads[t], 3, inputs, labels);
+    neuralnet_get_params(net, expected);
+    ck_assert_int_eq(neuralnet_train_stats(net, &(inputs[5 * 5]),
+                                           &(labels[5 * SAMPLED_OUTPUTS]), 1,
+                                           &got), 1);
+    neuralnet_get_params(net, params);
+    int changed = 0;
+    for (int o = 0; o < SAMPLED_OUTPUTS; o++) {
+      int offset = 8 * 6 + o * 9;
+      if (memcmp(&(expected[offset]), &(params[offset]),
+                 sizeof(double) * 9)) {
+        changed++;
+      } else if (o == 5) {
+        ck_abort_msg("The labelled output didn't train\n");
+      }
+    }
+    ck_assert_int_eq(changed, 4);
+    ck_assert(memcmp(expected, params, sizeof(double) * 8 * 6));
+    /* The mean is over the outputs trained on: the label's and 3 more */
+    ck_assert(got.loss > 0);
+    ck_assert(got.mse == got.loss / 4);
+    ck_assert_int_eq(neuralnet_train_stats(net, inputs, labels,
+                                           SAMPLED_OUTPUTS, &got), 1);
+    ck_assert(got.mse == got.loss / (SAMPLED_OUTPUTS * 4));
+    /* Classifying works out every output */
+    double out[SAMPLED_OUTPUTS];
+    ck_assert_int_eq(neuralnet_classify(net, &(inputs[5 * 5]), out, 1), 1);
+    for (int o = 0; o < SAMPLED_OUTPUTS; o++) {
+      ck_assert(out[o] > 0 && out[o] < 1);
+    }
+    neuralnet_destroy(net);
+  }
+}
+END_TEST
+
+START_TEST(test_neuralnet_output_samples_learn) {
+  double inputs[SAMPLED_OUTPUTS * 5];
+  double labels[SAMPLED_OUTPUTS * SAMPLED_OUTPUTS];
+  /* However many threads there are, the same outputs get sampled */
+  neuralnet *net = make_sampled_net(0, 2, inputs, labels);
+  neuralnet *pooled = make_sampled_net(3, 2, inputs, labels);
+  for (int i = 0; i < SAMPLED_ITERATIONS; i++) {
+    ck_assert_int_eq(neuralnet_train(net, inputs, labels, SAMPLED_OUTPUTS),
+                     1);
+  }
+  for (int i = 0; i < 20; i++) {
+    ck_assert_int_eq(neuralnet_train(pooled, inputs, labels, SAMPLED_OUTPUTS),
+                     1);
+  }
+  neuralnet *check = make_sampled_net(0, 2, inputs, labels);
+  for (int i = 0; i < 20; i++) {
+    ck_assert_int_eq(neuralnet_train(check, inputs, labels, SAMPLED_OUTPUTS),
+                     1);
+  }
+  double expected[SAMPLED_PARAMS];
+  double params[SAMPLED_PARAMS];
+  neuralnet_get_params(check, expected);
+  neuralnet_get_params(pooled, params);
+  ck_assert_int_eq(memcmp(expected, params, sizeof(params)), 0);
+  neuralnet_destroy(check);
+  neuralnet_destroy(pooled);
+  /* And training on a few outputs at a time still learns them all */
+  netmetrics metrics;
+  ck_assert_int_eq(neuralnet_evaluate(net, inputs, labels, SAMPLED_OUTPUTS,
+                                      &metrics), 1);
+  ck_assert_msg(metrics.accuracy == 1, "Got accuracy %f\n", metrics.accuracy);
+  neuralnet_destroy(net);
+  netconfig conf = { 0 };
+  int sizes[1] = { 2 };
+  conf.layers = 1;
+  conf.layer_sizes = sizes;
+  conf.dimensionality = 2;
+  conf.activation = sigmoid;
+  conf.activation_prime = sigmoid_prime;
+  conf.max_width = 2;
+  conf.output_samples = -1;
+  ck_assert_int_eq(neuralnet_create(&net, conf), 0);
+}
+END_TEST
+
+/**
+ * Create a 6 -> 5 -> 3 net to factor, and inputs and labels for it.
+ */
+static neuralnet *make_lowrank_net(int threads, double *inputs,
+                                   double *labels) {
+  static const int sizes[2] = { 5, 3 };
+  for (int i = 0; i < EVAL_INPUTS; i++) {
+    for (int d = 0; d < 6; d++) {
+      inputs[i * 6 + d] = ((i * 3 + d * 5) % 11) / 11.0 - 0.5;
+    }
+    for (int o = 0; o < 3; o++) {
+      labels[i * 3 + o] = i % 3 == o;
+    }
+  }
+  return make_conv_net(2, sizes, NULL, 6, 6, threads, sigmoid);
+}
+
+START_TEST(test_neuralnet_factorize) {
+  double inputs[EVAL_INPUTS * 6];
+  double labels[EVAL_INPUTS * 3];
+  int threads[3] = { 0, 2, 3 };
+  for (int t = 0; t < 3; t++) {
+    /* At full rank it's the same layer */
+    neuralnet *net = make_lowrank_net(threads[t], inputs, labels);
+    double expected[EVAL_INPUTS * 3];
+    ck_assert_int_eq(neuralnet_classify(net, inputs, expected, EVAL_INPUTS),
+                     1);
+    double error;
+    ck_assert_int_eq(neuralnet_factorize(net, 0, 5, &error), 1);
+    ck_assert_msg(error < 1e-9, "Got %g\n", error);
+    ck_assert_int_eq(neuralnet_factorize(net, 1, 3, NULL), 1);
+    double got[EVAL_INPUTS * 3];
+    ck_assert_int_eq(neuralnet_classify(net, inputs, got, EVAL_INPUTS), 1);
+    for (int i = 0; i < EVAL_INPUTS * 3; i++) {
+      ck_assert_msg(fabs(expected[i] - got[i]) < 1e-9, "Expected %f got %f\n",
+                    expected[i], got[i]);
+    }
+    /* At a lower rank it's the reconstruction, whichever way it's fed
+     * forward */
+    ck_assert_int_eq(neuralnet_factorize(net, 0, 2, &error), 1);
+    ck_assert_msg(error > 1e-3 && error < 1, "Got %g\n", error);
+    double params[LOWRANK_PARAMS];
+    neuralnet_get_params(net, params);
+    neuralnet *dense = make_lowrank_net(threads[t], inputs, labels);
+    neuralnet_set_params(dense, params);
+    ck_assert_int_eq(neuralnet_classify(dense, inputs, expected, EVAL_INPUTS),
+                     1);
+    ck_assert_int_eq(neuralnet_classify(net, inputs, got, EVAL_INPUTS), 1);
+    for (int i = 0; i < EVAL_INPUTS * 3; i++) {
+      ck_assert_msg(fabs(expected[i] - got[i]) < 1e-12,
+                    "Expected %f got %f\n", expected[i], got[i]);
+    }
+    ck_assert_int_eq(neuralnet_classify_pipelined(net, inputs, got,
+                                                  EVAL_INPUTS, 2), 1);
+    for (int i = 0; i < EVAL_INPUTS * 3; i++) {
+      ck_assert_msg(fabs(expected[i] - got[i]) < 1e-12,
+                    "Expected %f got %f\n", expected[i], got[i]);
+    }
+    netmetrics want, metrics;
+    ck_assert_int_eq(neuralnet_evaluate(dense, inputs, labels, EVAL_INPUTS,
+                                        &want), 1);
+    ck_assert_int_eq(neuralnet_evaluate(net, inputs, labels, EVAL_INPUTS,
+                                        &metrics), 1);
+    ck_assert(fabs(want.mse - metrics.mse) < 1e-12);
+    /* Saving keeps the factors, so the loaded net is factored too */
+    FILE *f = tmpfile();
+    ck_assert_int_eq(neuralnet_save(net, f), 1);
+    rewind(f);
+    neuralnet *loaded;
+    ck_assert_int_eq(neuralnet_load(&loaded, f, threads[t]), 1);
+    fclose(f);
+    double loaded_params[LOWRANK_PARAMS];
+    neuralnet_get_params(loaded, loaded_params);
+    ck_assert_int_eq(memcmp(params, loaded_params, sizeof(params)), 0);
+    double reloaded[EVAL_INPUTS * 3];
+    ck_assert_int_eq(neuralnet_classify(net, inputs, got, EVAL_INPUTS), 1);
+    ck_assert_int_eq(neuralnet_classify(loaded, inputs, reloaded,
+                                        EVAL_INPUTS), 1);
+    ck_assert_int_eq(memcmp(got, reloaded, sizeof(got)), 0);
+    ck_assert_int_eq(neuralnet_train(loaded, inputs, labels, EVAL_INPUTS), 0);
+    neuralnet_destroy(loaded);
+    /* Saving the params gives a dense net */
+    f = tmpfile();
+    ck_assert_int_eq(neuralnet_save_params(net, params, f), 1);
+    rewind(f);
+    ck_assert_int_eq(neuralnet_load(&loaded, f, threads[t]), 1);
+    fclose(f);
+    ck_assert_int_eq(neuralnet_train(loaded, inputs, labels, EVAL_INPUTS), 1);
+    neuralnet_destroy(loaded);
+    /* Factored nets don't train until they're dense again */
+    ck_assert_int_eq(neuralnet_train(net, inputs, labels, EVAL_INPUTS), 0);
+    ck_assert_int_eq(neuralnet_set_params(net, params), 1);
+    ck_assert_int_eq(neuralnet_train(net, inputs, labels, EVAL_INPUTS), 1);
+    ck_assert_int_eq(neuralnet_train(dense, inputs, labels, EVAL_INPUTS), 1);
+    double trained[LOWRANK_PARAMS];
+    neuralnet_get_params(dense, params);
+    neuralnet_get_params(net, trained);
+    ck_assert_int_eq(memcmp(params, trained, sizeof(params)), 0);
+    neuralnet_destroy(dense);
+    neuralnet_destroy(net);
+  }
+}
+END_TEST
+
+START_TEST(test_neuralnet_factor_save) {
+  /* A 32 -> 32 -> 3 net, whose hidden layer is worth factoring */
+  static const int sizes[2] = { 32, 3 };
+  neuralnet *net = make_conv_net(2, sizes, NULL, 32, 32, 2, sigmoid);
+  double inputs[EVAL_INPUTS * 32];
+  for (int i = 0; i < EVAL_INPUTS * 32; i++) {
+    inputs[i] = (i % 13) / 13.0 - 0.5;
+  }
+  FILE *f = tmpfile();
+  ck_assert_int_eq(neuralnet_save(net, f), 1);
+  long dense_size = ftell(f);
+  fclose(f);
+  ck_assert_int_eq(neuralnet_factorize(net, 0, 4, NULL), 1);
+  f = tmpfile();
+  ck_assert_int_eq(neuralnet_save(net, f), 1);
+  long size = ftell(f);
+  /* Rank 4 keeps A, B and the biases rather than 32 rows of 33; the conv
+   * specs and ranks cost 9 ints a layer */
+  long saved = (32 * 33 - (32 * 4 + 4 * 32 + 32)) * sizeof(double);
+  ck_assert_int_eq(size, dense_size - saved + 2 * 9 * sizeof(int));
+  rewind(f);
+  neuralnet *loaded;
+  ck_assert_int_eq(neuralnet_load(&loaded, f, 2), 1);
+  fclose(f);
+  double expected[EVAL_INPUTS * 3];
+  double got[EVAL_INPUTS * 3];
+  ck_assert_int_eq(neuralnet_classify(net, inputs, expected, EVAL_INPUTS),
+                   1);
+  ck_assert_int_eq(neuralnet_classify(loaded, inputs, got, EVAL_INPUTS), 1);
+  ck_assert_int_eq(memcmp(expected, got, sizeof(got)), 0);
+  /* Saving it again gives the same model */
+  f = tmpfile();
+  ck_assert_int_eq(neuralnet_save(loaded, f), 1);
+  ck_assert_int_eq(ftell(f), size);
+  fclose(f);
+  neuralnet_destroy(loaded);
+  neuralnet_destroy(net);
+}
+END_TEST
+
+START_TEST(test_neuralnet_factor_report) {
+  double inputs[EVAL_INPUTS * 6];
+  double labels[EVAL_INPUTS * 3];
+  neuralnet *net = make_lowrank_net(2, inputs, labels);
+  double before[LOWRANK_PARAMS];
+  neuralnet_get_params(net, before);
+  int ranks[5] = { 1, 2, 3, 4, 5 };
+  factor_report reports[5];
+  ck_assert_int_eq(neuralnet_factor_report(net, 0, ranks, 5, inputs, labels,
+                                           EVAL_INPUTS, reports), 1);
+  for (int r = 0; r < 5; r++) {
+    ck_assert_int_eq(reports[r].rank, ranks[r]);
+    ck_assert(fabs(reports[r].cost - ranks[r] * 11 / 30.0) < 1e-12);
+    if (r) {
+      ck_assert(reports[r].reconstruction < reports[r - 1].reconstruction);
+    }
+    /* And it's the same as factoring for real */
+    neuralnet *other = make_lowrank_net(2, inputs, labels);
+    double error;
+    ck_assert_int_eq(neuralnet_factorize(other, 0, ranks[r], &error), 1);
+    ck_assert(fabs(error - reports[r].reconstruction) < 1e-12);
+    neuralnet_destroy(other);
+  }
+  ck_assert(fabs(reports[4].reconstruction) < 1e-9);
+  ck_assert(fabs(reports[4].mse_delta) < 1e-9);
+  ck_assert(reports[4].accuracy_delta == 0);
+  /* The net's left as it was */
+  double after[LOWRANK_PARAMS];
+  neuralnet_get_params(net, after);
+  ck_assert_int_eq(memcmp(before, after, sizeof(before)), 0);
+  ck_assert_int_eq(neuralnet_train(net, inputs, labels, EVAL_INPUTS), 1);
+  /* Ranks have to fit the layer, and layers can't be factored twice */
+  int bad[4] = { 0, 6, -1, 4 };
+  ck_assert_int_eq(neuralnet_factorize(net, 0, bad[0], NULL), 0);
+  ck_assert_int_eq(neuralnet_factorize(net, 0, bad[1], NULL), 0);
+  ck_assert_int_eq(neuralnet_factorize(net, 1, bad[3], NULL), 0);
+  ck_assert_int_eq(neuralnet_factorize(net, 2, 1, NULL), 0);
+  ck_assert_int_eq(neuralnet_factorize(net, -1, 1, NULL), 0);
+  ck_assert_int_eq(neuralnet_factor_report(net, 0, bad, 4, inputs, labels,
+                                           EVAL_INPUTS, reports), 0);
+  ck_assert_int_eq(neuralnet_factorize(net, 0, 3, NULL), 1);
+  ck_assert_int_eq(neuralnet_factor_report(net, 0, ranks, 1, inputs, labels,
+                                           EVAL_INPUTS, reports), 0);
+  neuralnet_destroy(net);
+  /* Conv layers aren't factored */
+  static const int sizes[2] = { 18, 2 };
+  conv_spec conv[2] = { { 0 } };
+  conv[0].filters = 3;
+  conv[0].channels = 1;
+  conv[0].height = 2;
+  conv[0].width = 3;
+  conv[0].kernel = 3;
+  conv[0].stride = 1;
+  conv[0].padding = 1;
+  net = make_conv_net(2, sizes, conv, 6, 18, 2, sigmoid);
+  ck_assert_int_eq(neuralnet_factorize(net, 0, 1, NULL), 0);
+  ck_assert_int_eq(neuralnet_factorize(net, 1, 2, NULL), 1);
+  neuralnet_destroy(net);
+}
+END_TEST
+
+/**
+ * Feed x forward through the 2 -> 3 -> 5 -> 1 net with the weights given
+ * the way the net does, keeping every layer's outputs.
+ */
+static void grad_forward(const double *w, const int *sizes, const double *x,
+                         double iscale, double out[GRAD_LAYERS][GRAD_WIDTH]) {
+  for (int layer = 0; layer < GRAD_LAYERS; layer++) {
+    const double *in = layer ? out[layer - 1] : x;
+    int in_count = layer ? sizes[layer - 1] : 2;
+    double ifactor = iscale * sizes[layer] / GRAD_WIDTH;
+    if (layer == GRAD_LAYERS - 1) {
+      ifactor = iscale;
+    }
+    for (int n = 0; n < sizes[layer]; n++) {
+      const double *row = &(w[(layer * GRAD_WIDTH + n) * GRAD_WIDTH]);
+      double sum = row[in_count];
+      for (int i = 0; i < in_count; i++) {
+        sum += row[i] * in[i];
+      }
+      out[layer][n] = sigmoid(ifactor * sum);
+    }
+  }
+}
+
+START_TEST(test_neuralnet_backprop) {
+  static const int sizes[GRAD_LAYERS] = { 3, 5, 1 };
+  netconfig conf = { 0 };
+  conf.layers = GRAD_LAYERS;
+  conf.layer_sizes = sizes;
+  conf.dimensionality = 2;
+  conf.activation = sigmoid;
+  conf.activation_prime = sigmoid_prime;
+  conf.threads = 2;
+  conf.alpha = 0.5;
+  conf.iscale = 1;
+  conf.max_width = GRAD_WIDTH - 1;
+  conf.seed = GRAD_SEED;
+  neuralnet *net;
+  ck_assert_int_eq(neuralnet_create(&net, conf), 1);
+  /* Lay the net's weights out the way it does, a row per neuron */
+  double w[GRAD_LAYERS * GRAD_WIDTH * GRAD_WIDTH] = { 0 };
+  double params[GRAD_PARAMS];
+  neuralnet_get_params(net, params);
+  const double *param = params;
+  for (int layer = 0; layer < GRAD_LAYERS; layer++) {
+    int count = (layer ? sizes[layer - 1] : 2) + 1;
+    for (int n = 0; n < sizes[layer]; n++) {
+      memcpy(&(w[(layer * GRAD_WIDTH + n) * GRAD_WIDTH]), param,
+             sizeof(double) * count);
+      param += count;
+    }
+  }
+  double inputs[4] = { 0.2, 0.9,
+                       0.7, 0.1 };
+  double labels[2] = { 1, 0 };
+  /* Two steps, so stale errors from the first would show up in the second */
+  for (int step = 0; step < 2; step++) {
+    const double *x = &(inputs[step * 2]);
+    double out[GRAD_LAYERS][GRAD_WIDTH];
+    grad_forward(w, sizes, x, conf.iscale, out);
+    /* Every layer's error derivatives come from the next layer's weights
+     * before they're adjusted */
+    double derr[GRAD_LAYERS][GRAD_WIDTH];
+    for (int layer = GRAD_LAYERS - 1; layer >= 0; layer--) {
+      for (int n = 0; n < sizes[layer]; n++) {
+        double error = 0;
+        if (layer == GRAD_LAYERS - 1) {
+          error = labels[step] - out[layer][n];
+        } else {
+          for (int next = 0; next < sizes[layer + 1]; next++) {
+            error += derr[layer + 1][next] *
+                     w[((layer + 1) * GRAD_WIDTH + next) * GRAD_WIDTH + n];
+          }
+        }
+        derr[layer][n] = error * sigmoid_prime(out[layer][n]);
+      }
+    }
+    for (int layer = 0; layer < GRAD_LAYERS; layer++) {
+      const double *in = layer ? out[layer - 1] : x;
+      int in_count = layer ? sizes[layer - 1] : 2;
+      for (int n = 0; n < sizes[layer]; n++) {
+        double *row = &(w[(layer * GRAD_WIDTH + n) * GRAD_WIDTH]);
+        for (int i = 0; i < in_count; i++) {
+          row[i] += conf.alpha * derr[layer][n] * in[i];
+        }
+        row[in_count] += conf.alpha * derr[layer][n];
+      }
+    }
+    ck_assert_int_eq(neuralnet_train(net, x, &(labels[step]), 1), 1);
+  }
+  /* The trained net and the hand trained weights have to agree */
+  double probe[2] = { 0.5, 0.3 };
+  double want[GRAD_LAYERS][GRAD_WIDTH];
+  grad_forward(w, sizes, probe, conf.iscale, want);
+  double got;
+  ck_assert_int_eq(neuralnet_classify(net, probe, &got, 1), 1);
+  ck_assert_msg(fabs(want[GRAD_LAYERS - 1][0] - got) < 1e-12,
+                "Expected %.15f got %.15f\n", want[GRAD_LAYERS - 1][0], got);
   neuralnet_destroy(net);
 }
 END_TEST
@@ -91,9 +1560,56 @@ Suite *neuralnet_suite(void) {
   TCase *tc_simple = tcase_create("simple");
   tcase_add_test(tc_simple, test_neuralnet_xor);
   tcase_add_test(tc_simple, test_neuralnet_or);
+  tcase_add_test(tc_simple, test_neuralnet_backprop);
+  tcase_add_test(tc_simple, test_neuralnet_xor_sigmoid_fast);
+  tcase_add_test(tc_simple, test_neuralnet_or_sigmoid_fast);
+  tcase_add_test(tc_simple, test_neuralnet_xor_sigmoid_table);
+  tcase_add_test(tc_simple, test_neuralnet_or_sigmoid_table);
   tcase_set_timeout(tc_simple, 30);
 
+  TCase *tc_io = tcase_create("io");
+  tcase_add_test(tc_io, test_neuralnet_save_load);
+  tcase_add_test(tc_io, test_neuralnet_load_garbage);
+  tcase_add_test(tc_io, test_neuralnet_export_c);
+
+  TCase *tc_inference = tcase_create("inference");
+  tcase_add_test(tc_inference, test_neuralnet_classify_pipelined);
+  tcase_add_test(tc_inference, test_neuralnet_evaluate);
+  tcase_add_test(tc_inference, test_neuralnet_inference_only);
+  tcase_add_test(tc_inference, test_neuralnet_no_threads);
+  tcase_add_test(tc_inference, test_neuralnet_shared_pool);
+  tcase_add_test(tc_inference, test_neuralnet_train_stats);
+  tcase_set_timeout(tc_inference, 30);
+
+  TCase *tc_init = tcase_create("init");
+  tcase_add_test(tc_init, test_neuralnet_init_threads);
+  tcase_add_test(tc_init, test_neuralnet_init_seed);
+  tcase_add_test(tc_init, test_neuralnet_init_xavier_he);
+
   suite_add_tcase(s, tc_simple);
+  suite_add_tcase(s, tc_io);
+  suite_add_tcase(s, tc_inference);
+  TCase *tc_conv = tcase_create("conv");
+  tcase_add_test(tc_conv, test_neuralnet_conv_as_dense);
+  tcase_add_test(tc_conv, test_neuralnet_conv_pool);
+  tcase_add_test(tc_conv, test_neuralnet_conv_bars);
+  tcase_add_test(tc_conv, test_neuralnet_conv_bad_spec);
+  tcase_set_timeout(tc_conv, 30);
+
+  TCase *tc_lowrank = tcase_create("lowrank");
+  tcase_add_test(tc_lowrank, test_neuralnet_factorize);
+  tcase_add_test(tc_lowrank, test_neuralnet_factor_save);
+  tcase_add_test(tc_lowrank, test_neuralnet_factor_report);
+
+  TCase *tc_sampled = tcase_create("sampled");
+  tcase_add_test(tc_sampled, test_neuralnet_output_samples);
+  tcase_add_test(tc_sampled, test_neuralnet_output_samples_learn);
+  tcase_set_timeout(tc_sampled, 30);
+
+  suite_add_tcase(s, tc_init);
+  suite_add_tcase(s, tc_conv);
+  suite_add_tcase(s, tc_lowrank);
+  suite_add_tcase(s, tc_sampled);
 
   return s;
 }
@@ -0,0 +1,195 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sweep.h"
+#include "neuralnet.h"
+#include "activations.h"
+
+/* How many configurations to sweep */
+#define SWEEP_CONFIGS 6
+
+/* How many epochs the survivors train for */
+#define SWEEP_EPOCHS 40
+
+/* How many epochs between cuts */
+#define SWEEP_RUNG 10
+
+/* How many examples there are: the OR table, twice over */
+#define SWEEP_EXAMPLES 8
+
+static const double sweep_inputs[SWEEP_EXAMPLES * 2] = { 0, 0, 0, 1,
+                                                         1, 0, 1, 1,
+                                                         0, 0, 0, 1,
+                                                         1, 0, 1, 1 };
+static const double sweep_labels[SWEEP_EXAMPLES] = { 0, 1, 1, 1,
+                                                     0, 1, 1, 1 };
+
+/**
+ * Fill in configurations learning OR with a 2-3-1 net: half of them with
+ * no learning rate at all, so they ought to get cut first.
+ */
+static void make_sweep_configs(netconfig *configs) {
+  static const int layer_sizes[2] = { 3, 1 };
+  for (int i = 0; i < SWEEP_CONFIGS; i++) {
+    netconfig conf = { 0 };
+    conf.layers = 2;
+    conf.layer_sizes = layer_sizes;
+    conf.dimensionality = 2;
+    conf.activation = sigmoid;
+    conf.activation_prime = sigmoid_prime;
+    /* The sweep has to ignore these */
+    conf.threads = 7;
+    conf.alpha = i % 2 ? 1 + i * 0.5 : 0;
+    conf.iscale = 0.5;
+    conf.max_width = 3;
+    conf.seed = 3;
+    configs[i] = conf;
+  }
+}
+
+static sweepconfig make_sweep_config(void) {
+  sweepconfig config = { 0 };
+  config.epochs = SWEEP_EPOCHS;
+  config.batch_size = 2;
+  config.rung_epochs = SWEEP_RUNG;
+  config.keep = 0.5;
+  config.threads = 3;
+  return config;
+}
+
+START_TEST(test_sweep_cuts) {
+  netconfig configs[SWEEP_CONFIGS];
+  sweepresult results[SWEEP_CONFIGS];
+  make_sweep_configs(configs);
+  ck_assert_int_eq(sweep_run(configs, SWEEP_CONFIGS, sweep_inputs,
+                             sweep_labels, SWEEP_EXAMPLES,
+                             make_sweep_config(), results), 1);
+  int survivors = 0;
+  for (int i = 0; i < SWEEP_CONFIGS; i++) {
+    ck_assert(results[i].ok);
+    ck_assert_int_eq(results[i].metrics.count, SWEEP_EXAMPLES);
+    if (!(i % 2)) {
+      /* Not learning anything loses to learning something */
+      ck_assert_msg(results[i].stopped, "Config %d wasn't cut\n", i);
+      ck_assert_int_eq(results[i].epochs, SWEEP_RUNG);
+    }
+    if (!results[i].stopped) {
+      survivors++;
+      ck_assert_int_eq(results[i].epochs, SWEEP_EPOCHS);
+    }
+  }
+  /* 6 -> 3 -> 2 -> 1, with the last rung going the distance */
+  ck_assert_int_eq(survivors, 1);
+}
+END_TEST
+
+START_TEST(test_sweep_matches_alone) {
+  netconfig configs[SWEEP_CONFIGS];
+  sweepresult results[SWEEP_CONFIGS];
+  make_sweep_configs(configs);
+  sweepconfig config = make_sweep_config();
+  /* Nobody gets cut, so everyone should match a plain training run */
+  config.keep = 1;
+  ck_assert_int_eq(sweep_run(configs, SWEEP_CONFIGS, sweep_inputs,
+                             sweep_labels, SWEEP_EXAMPLES, config, results),
+                   1);
+  for (int i = 0; i < SWEEP_CONFIGS; i++) {
+    ck_assert(!results[i].stopped);
+    ck_assert_int_eq(results[i].epochs, SWEEP_EPOCHS);
+    netconfig conf = configs[i];
+    conf.threads = 0;
+    neuralnet *net;
+    ck_assert_int_eq(neuralnet_create(&net, conf), 1);
+    for (int e = 0; e < SWEEP_EPOCHS; e++) {
+      for (int start = 0; start < SWEEP_EXAMPLES; start += 2) {
+        ck_assert_int_eq(neuralnet_train(net, &(sweep_inputs[start * 2]),
+                                         &(sweep_labels[start]), 2), 1);
+      }
+    }
+    netmetrics metrics;
+    ck_assert_int_eq(neuralnet_evaluate(net, sweep_inputs, sweep_labels,
+                                        SWEEP_EXAMPLES, &metrics), 1);
+    ck_assert_msg(metrics.mse == results[i].metrics.mse,
+                  "Config %d: expected mse %f got %f\n", i, metrics.mse,
+                  results[i].metrics.mse);
+    neuralnet_destroy(net);
+  }
+}
+END_TEST
+
+START_TEST(test_sweep_report) {
+  netconfig configs[SWEEP_CONFIGS];
+  sweepresult results[SWEEP_CONFIGS];
+  make_sweep_configs(configs);
+  ck_assert_int_eq(sweep_run(configs, SWEEP_CONFIGS, sweep_inputs,
+                             sweep_labels, SWEEP_EXAMPLES,
+                             make_sweep_config(), results), 1);
+  FILE *f = tmpfile();
+  sweep_report(configs, SWEEP_CONFIGS, results, f);
+  long len = ftell(f);
+  rewind(f);
+  char *table = calloc(len + 1, 1);
+  ck_assert_int_eq(fread(table, 1, len, f), len);
+  fclose(f);
+  ck_assert_ptr_ne(strstr(table, "rank"), NULL);
+  ck_assert_ptr_ne(strstr(table, "2-3-1"), NULL);
+  /* The survivor goes first */
+  char *first = strchr(table, '\n') + 1;
+  char *end = strchr(first, '\n');
+  *end = '\0';
+  ck_assert_ptr_ne(strstr(first, "done"), NULL);
+  ck_assert_ptr_ne(strstr(end + 1, "cut"), NULL);
+  free(table);
+}
+END_TEST
+
+START_TEST(test_sweep_bad_config) {
+  netconfig configs[SWEEP_CONFIGS];
+  sweepresult results[SWEEP_CONFIGS];
+  make_sweep_configs(configs);
+  sweepconfig config = make_sweep_config();
+  config.keep = 0;
+  ck_assert_int_eq(sweep_run(configs, SWEEP_CONFIGS, sweep_inputs,
+                             sweep_labels, SWEEP_EXAMPLES, config, results),
+                   0);
+  /* A configuration that can't be made just comes out failed */
+  config = make_sweep_config();
+  configs[1].init = (weight_init) 42;
+  ck_assert_int_eq(sweep_run(configs, SWEEP_CONFIGS, sweep_inputs,
+                             sweep_labels, SWEEP_EXAMPLES, config, results),
+                   1);
+  ck_assert(!results[1].ok);
+  ck_assert_int_eq(results[1].epochs, 0);
+  for (int i = 2; i < SWEEP_CONFIGS; i++) {
+    ck_assert(results[i].ok);
+  }
+}
+END_TEST
+
+Suite *sweep_suite(void) {
+  Suite *s = suite_create("sweep");
+  TCase *tc_sweep = tcase_create("sweep");
+  tcase_add_test(tc_sweep, test_sweep_cuts);
+  tcase_add_test(tc_sweep, test_sweep_matches_alone);
+  tcase_add_test(tc_sweep, test_sweep_report);
+  tcase_add_test(tc_sweep, test_sweep_bad_config);
+  suite_add_tcase(s, tc_sweep);
+  return s;
+}
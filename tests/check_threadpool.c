@@ -16,11 +16,18 @@
  */
 #include <check.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include "threadpool.h"
 
 /* How many elements to map over */
 #define NUM_ELEMENTS 100
 
+/* How many threads submit to the same pool at once */
+#define SUBMITTERS 4
+
+/* How many times each of them submits */
+#define ROUNDS 50
+
 void mapper(void *arg, void *retval) {
   ck_assert_ptr_eq(retval, NULL);
   int *a = (int *) arg;
@@ -69,6 +76,55 @@ START_TEST(test_threadpool_retval_basic) {
 }
 END_TEST
 
+/**
+ * What one of the concurrent submitters works on.
+ */
+typedef struct {
+  threadpool *pool;
+  int base;
+  int args[NUM_ELEMENTS];
+  int retvals[NUM_ELEMENTS];
+  int ok;
+} submitter;
+
+static void *submit_rounds(void *arg) {
+  submitter *sub = (submitter *) arg;
+  sub->ok = 1;
+  for (int round = 0; round < ROUNDS; round++) {
+    for (int i = 0; i < NUM_ELEMENTS; i++) {
+      sub->args[i] = sub->base + round + i;
+    }
+    threadpool_submit(sub->pool, (unsigned char *) sub->retvals, r_mapper,
+                      (unsigned char *) sub->args, sizeof(int), NUM_ELEMENTS,
+                      sizeof(int));
+    /* Every job has to have been done, and only ours */
+    for (int i = 0; i < NUM_ELEMENTS; i++) {
+      sub->ok &= sub->retvals[i] == (sub->base + round + i) * 100;
+    }
+  }
+  return NULL;
+}
+
+START_TEST(test_threadpool_concurrent) {
+  threadpool *tp;
+  ck_assert_int_eq(threadpool_create(&tp, 3), 1);
+  ck_assert_int_eq(threadpool_size(tp), 3);
+  submitter subs[SUBMITTERS];
+  pthread_t threads[SUBMITTERS];
+  for (int s = 0; s < SUBMITTERS; s++) {
+    subs[s].pool = tp;
+    subs[s].base = s * 1000;
+    ck_assert_int_eq(pthread_create(&(threads[s]), NULL, submit_rounds,
+                                    &(subs[s])), 0);
+  }
+  for (int s = 0; s < SUBMITTERS; s++) {
+    pthread_join(threads[s], NULL);
+    ck_assert_msg(subs[s].ok, "Submitter %d got the wrong results\n", s);
+  }
+  threadpool_destroy(tp);
+}
+END_TEST
+
 Suite *threadpool_suite(void) {
   Suite *s;
   s = suite_create("threadpool");
@@ -79,7 +135,11 @@ Suite *threadpool_suite(void) {
   TCase *tc_retval = tcase_create("Retval");
   tcase_add_test(tc_retval, test_threadpool_retval_basic);
 
+  TCase *tc_concurrent = tcase_create("Concurrent");
+  tcase_add_test(tc_concurrent, test_threadpool_concurrent);
+
   suite_add_tcase(s, tc_noretval);
   suite_add_tcase(s, tc_retval);
+  suite_add_tcase(s, tc_concurrent);
   return s;
 }
@@ -0,0 +1,163 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <check.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "trace.h"
+#include "neuralnet.h"
+#include "activations.h"
+
+/**
+ * Dump the trace and read it back.
+ * @return the dump, to be freed
+ */
+static char *read_trace(void) {
+  FILE *f = tmpfile();
+  ck_assert_ptr_ne(f, NULL);
+  ck_assert_int_eq(trace_dump(f), 1);
+  long len = ftell(f);
+  rewind(f);
+  char *json = calloc(len + 1, 1);
+  ck_assert_int_eq(fread(json, 1, len, f), len);
+  fclose(f);
+  return json;
+}
+
+/**
+ * Count how many times needle turns up in haystack.
+ */
+static int count_matches(const char *haystack, const char *needle) {
+  int count = 0;
+  for (const char *p = strstr(haystack, needle); p;
+       p = strstr(p + 1, needle)) {
+    count++;
+  }
+  return count;
+}
+
+START_TEST(test_trace_training) {
+  static const int layer_sizes[2] = { 3, 1 };
+  netconfig conf = { 0 };
+  conf.layers = 2;
+  conf.layer_sizes = layer_sizes;
+  conf.dimensionality = 2;
+  conf.activation = sigmoid;
+  conf.activation_prime = sigmoid_prime;
+  conf.threads = 2;
+  conf.alpha = 0.1;
+  conf.iscale = 0.1;
+  conf.max_width = 3;
+  double inputs[4] = { 0, 1, 1, 0 };
+  double labels[2] = { 1, 0 };
+  neuralnet *net;
+  ck_assert_int_eq(neuralnet_create(&net, conf), 1);
+  ck_assert_int_eq(trace_enable(1000), 1);
+  ck_assert_int_eq(neuralnet_train(net, inputs, labels, 2), 1);
+  trace_disable();
+  ck_assert_int_eq(neuralnet_train(net, inputs, labels, 2), 1);
+  neuralnet_destroy(net);
+  char *json = read_trace();
+  ck_assert_ptr_ne(strstr(json, "{\"traceEvents\":["), NULL);
+  /* Two inputs, each going through both layers both ways */
+  ck_assert_int_eq(count_matches(json, "\"feed forward\""), 4);
+  ck_assert_int_eq(count_matches(json, "\"back propagate\""), 4);
+  ck_assert_int_eq(count_matches(json, "\"threadpool_submit\""), 8);
+  /* Each submission has one job per thread */
+  ck_assert_int_eq(count_matches(json, "\"job\""), 16);
+  free(json);
+}
+END_TEST
+
+START_TEST(test_trace_inline) {
+  /* Without a pool every job runs on the calling thread */
+  static const int layer_sizes[2] = { 3, 1 };
+  netconfig conf = { 0 };
+  conf.layers = 2;
+  conf.layer_sizes = layer_sizes;
+  conf.dimensionality = 2;
+  conf.activation = sigmoid;
+  conf.activation_prime = sigmoid_prime;
+  conf.alpha = 0.1;
+  conf.iscale = 0.1;
+  conf.max_width = 3;
+  double inputs[4] = { 0, 1, 1, 0 };
+  double labels[2] = { 1, 0 };
+  neuralnet *net;
+  ck_assert_int_eq(neuralnet_create(&net, conf), 1);
+  ck_assert_int_eq(trace_enable(1000), 1);
+  ck_assert_int_eq(neuralnet_train(net, inputs, labels, 2), 1);
+  trace_disable();
+  neuralnet_destroy(net);
+  char *json = read_trace();
+  ck_assert_int_eq(count_matches(json, "\"threadpool_submit\""), 0);
+  /* They still show up, one per layer each way for each input */
+  ck_assert_int_eq(count_matches(json, "\"job\""), 8);
+  free(json);
+  trace_reset();
+}
+END_TEST
+
+START_TEST(test_trace_disabled) {
+  ck_assert_int_eq(trace_enabled(), 0);
+  unsigned long long start = trace_begin();
+  ck_assert(start == 0);
+  trace_end("nothing", 0, start);
+  ck_assert_int_eq(trace_enable(0), 0);
+  ck_assert_int_eq(trace_enable(10), 1);
+  /* Started before tracing was on, so it doesn't count */
+  trace_end("straddling", 0, start);
+  char *json = read_trace();
+  ck_assert_int_eq(count_matches(json, "\"ph\""), 0);
+  free(json);
+}
+END_TEST
+
+START_TEST(test_trace_ring) {
+  ck_assert_int_eq(trace_enable(4), 1);
+  for (int i = 0; i < 10; i++) {
+    trace_end("event \"quoted\"", i, trace_begin());
+  }
+  char *json = read_trace();
+  /* Only the last 4 are kept */
+  ck_assert_int_eq(count_matches(json, "\"ph\""), 4);
+  ck_assert_ptr_eq(strstr(json, "\"arg\":5}"), NULL);
+  ck_assert_ptr_ne(strstr(json, "\"arg\":6}"), NULL);
+  ck_assert_ptr_ne(strstr(json, "\"arg\":9}"), NULL);
+  ck_assert_ptr_ne(strstr(json, "\"event \\\"quoted\\\"\""), NULL);
+  free(json);
+  trace_reset();
+  json = read_trace();
+  ck_assert_int_eq(count_matches(json, "\"ph\""), 0);
+  free(json);
+}
+END_TEST
+
+Suite *trace_suite(void) {
+  Suite *s;
+  s = suite_create("trace");
+
+  TCase *tc_core = tcase_create("core");
+  tcase_add_test(tc_core, test_trace_training);
+  tcase_add_test(tc_core, test_trace_inline);
+  tcase_add_test(tc_core, test_trace_disabled);
+  tcase_add_test(tc_core, test_trace_ring);
+
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
@@ -0,0 +1,145 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trainer.h"
+#include "neuralnet.h"
+#include "activations.h"
+
+/* How many epochs to make over the OR examples */
+#define TRAINER_EPOCHS 200000
+
+/* How many epochs to record visits for */
+#define VISIT_EPOCHS 5
+
+/* How many examples to record visits for */
+#define VISIT_EXAMPLES 11
+
+/**
+ * Counts how many times each example got prepared.
+ */
+static void count_prepare(void *ctx, int index, const double *input,
+                          const double *label, double *input_out,
+                          double *label_out) {
+  int *visits = (int *) ctx;
+  visits[index]++;
+  input_out[0] = input[0];
+  input_out[1] = input[1];
+  label_out[0] = label[0];
+}
+
+/**
+ * Make a net fit to learn OR with.
+ */
+static neuralnet *make_or_net(void) {
+  static const int layer_sizes[1] = { 1 };
+  netconfig conf = { 0 };
+  conf.layers = 1;
+  conf.layer_sizes = layer_sizes;
+  conf.dimensionality = 2;
+  conf.activation = sigmoid;
+  conf.activation_prime = sigmoid_prime;
+  conf.threads = 2;
+  conf.alpha = 0.1;
+  conf.iscale = 0.1;
+  conf.max_width = 2;
+  neuralnet *net;
+  ck_assert_int_eq(neuralnet_create(&net, conf), 1);
+  return net;
+}
+
+START_TEST(test_trainer_or) {
+  neuralnet *net = make_or_net();
+  double inputs[8] = { 0, 0,
+                       0, 1,
+                       1, 0,
+                       1, 1 };
+  double labels[4] = { 0, 1, 1, 1 };
+  trainconfig tconf;
+  memset(&tconf, 0, sizeof(trainconfig));
+  tconf.batch_size = 3;
+  tconf.depth = 2;
+  tconf.epochs = TRAINER_EPOCHS;
+  tconf.shuffle = 1;
+  tconf.seed = 42;
+  ck_assert_int_eq(trainer_train(net, inputs, labels, 4, tconf), 1);
+  ck_assert_int_eq(neuralnet_classify(net, inputs, labels, 4), 1);
+  ck_assert_msg(labels[0] < 0.05, "Got %f\n", labels[0]);
+  ck_assert_msg(labels[1] > 0.95, "Got %f\n", labels[1]);
+  ck_assert_msg(labels[2] > 0.95, "Got %f\n", labels[2]);
+  ck_assert_msg(labels[3] > 0.95, "Got %f\n", labels[3]);
+  neuralnet_destroy(net);
+}
+END_TEST
+
+START_TEST(test_trainer_visits_everything) {
+  neuralnet *net = make_or_net();
+  double inputs[VISIT_EXAMPLES * 2];
+  double labels[VISIT_EXAMPLES];
+  int visits[VISIT_EXAMPLES] = { 0 };
+  for (int i = 0; i < VISIT_EXAMPLES; i++) {
+    inputs[i * 2] = i % 2;
+    inputs[i * 2 + 1] = (i / 2) % 2;
+    labels[i] = inputs[i * 2] || inputs[i * 2 + 1];
+  }
+  trainconfig tconf;
+  memset(&tconf, 0, sizeof(trainconfig));
+  tconf.batch_size = 4;
+  tconf.depth = 1;
+  tconf.epochs = VISIT_EPOCHS;
+  tconf.shuffle = 1;
+  tconf.seed = 7;
+  tconf.prepare = count_prepare;
+  tconf.prepare_ctx = visits;
+  ck_assert_int_eq(trainer_train(net, inputs, labels, VISIT_EXAMPLES, tconf),
+                   1);
+  for (int i = 0; i < VISIT_EXAMPLES; i++) {
+    ck_assert_int_eq(visits[i], VISIT_EPOCHS);
+  }
+  neuralnet_destroy(net);
+}
+END_TEST
+
+START_TEST(test_trainer_bad_config) {
+  neuralnet *net = make_or_net();
+  double inputs[2] = { 0, 1 };
+  double labels[1] = { 1 };
+  trainconfig tconf;
+  memset(&tconf, 0, sizeof(trainconfig));
+  tconf.batch_size = 0;
+  tconf.depth = 1;
+  tconf.epochs = 1;
+  ck_assert_int_eq(trainer_train(net, inputs, labels, 1, tconf), 0);
+  neuralnet_destroy(net);
+}
+END_TEST
+
+Suite *trainer_suite(void) {
+  Suite *s;
+  s = suite_create("trainer");
+
+  TCase *tc_simple = tcase_create("simple");
+  tcase_add_test(tc_simple, test_trainer_or);
+  tcase_add_test(tc_simple, test_trainer_visits_everything);
+  tcase_add_test(tc_simple, test_trainer_bad_config);
+  tcase_set_timeout(tc_simple, 30);
+
+  suite_add_tcase(s, tc_simple);
+
+  return s;
+}
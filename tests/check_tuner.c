@@ -0,0 +1,150 @@
+/**
+ * This file is part of helios.
+ *
+ * helios is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * helios is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with helios.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <check.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "tuner.h"
+#include "neuralnet.h"
+#include "activations.h"
+
+/* How many parameters the tuner tests' 4-6-3 nets have: 6 * 5 + 3 * 7 */
+#define TUNER_PARAMS 51
+
+/* How many inputs to train the tuned nets on */
+#define TUNER_INPUTS 9
+
+static const int tuner_sizes[2] = { 6, 3 };
+
+static netconfig make_tuner_config(void) {
+  netconfig conf = { 0 };
+  conf.layers = 2;
+  conf.layer_sizes = tuner_sizes;
+  conf.dimensionality = 4;
+  conf.activation = sigmoid;
+  conf.activation_prime = sigmoid_prime;
+  conf.threads = 3;
+  conf.alpha = 0.2;
+  conf.iscale = 0.5;
+  conf.max_width = 6;
+  conf.seed = 5;
+  return conf;
+}
+
+/**
+ * Train a net with the plan given and get its parameters.
+ */
+static void train_planned(const int *layer_jobs, double *params) {
+  netconfig conf = make_tuner_config();
+  conf.layer_jobs = layer_jobs;
+  neuralnet *net;
+  ck_assert_int_eq(neuralnet_create(&net, conf), 1);
+  double inputs[TUNER_INPUTS * 4];
+  double labels[TUNER_INPUTS * 3] = { 0 };
+  for (int i = 0; i < TUNER_INPUTS; i++) {
+    for (int d = 0; d < 4; d++) {
+      inputs[i * 4 + d] = ((i + d) % 4) / 4.0;
+    }
+    labels[i * 3 + (i % 3)] = 1;
+  }
+  ck_assert_int_eq(neuralnet_train(net, inputs, labels, TUNER_INPUTS), 1);
+  ck_assert_int_eq(neuralnet_param_count(net), TUNER_PARAMS);
+  neuralnet_get_params(net, params);
+  neuralnet_destroy(net);
+}
+
+START_TEST(test_tuner_tune) {
+  netconfig conf = make_tuner_config();
+  int plan[2];
+  ck_assert_int_eq(tuner_tune(conf, 4, plan), 1);
+  double expected[TUNER_PARAMS];
+  double got[TUNER_PARAMS];
+  train_planned(NULL, expected);
+  for (int layer = 0; layer < 2; layer++) {
+    ck_assert(plan[layer] >= 1 && plan[layer] <= conf.threads);
+  }
+  /* However the layers get split, the net has to come out the same */
+  train_planned(plan, got);
+  ck_assert_int_eq(memcmp(expected, got, sizeof(expected)), 0);
+  int serial[2] = { 1, 1 };
+  train_planned(serial, got);
+  ck_assert_int_eq(memcmp(expected, got, sizeof(expected)), 0);
+  /* Asking for more jobs than threads gets capped */
+  int lots[2] = { 2, 50 };
+  train_planned(lots, got);
+  ck_assert_int_eq(memcmp(expected, got, sizeof(expected)), 0);
+  /* But none at all makes no sense */
+  int none[2] = { 1, 0 };
+  conf.layer_jobs = none;
+  neuralnet *net;
+  ck_assert_int_eq(neuralnet_create(&net, conf), 0);
+}
+END_TEST
+
+START_TEST(test_tuner_cache) {
+  char path[64];
+  snprintf(path, sizeof(path), "check_tuner-%d.cache", (int) getpid());
+  netconfig conf = make_tuner_config();
+  int plan[2] = { 0, 0 };
+  ck_assert_int_eq(tuner_lookup(path, &conf, 4, plan), 0);
+  int stored[2] = { 1, 3 };
+  ck_assert_int_eq(tuner_store(path, &conf, 4, stored), 1);
+  /* This comes out of the cache, there's no way tuning gets 1, 3 for
+   * sure */
+  ck_assert_int_eq(tuner_plan(path, &conf, 4, plan), 1);
+  ck_assert_int_eq(plan[0], 1);
+  ck_assert_int_eq(plan[1], 3);
+  /* The latest plan for a key wins */
+  int newer[2] = { 2, 2 };
+  ck_assert_int_eq(tuner_store(path, &conf, 4, newer), 1);
+  ck_assert_int_eq(tuner_lookup(path, &conf, 4, plan), 1);
+  ck_assert_int_eq(plan[0], 2);
+  ck_assert_int_eq(plan[1], 2);
+  /* Other batch sizes and thread counts are other keys */
+  ck_assert_int_eq(tuner_lookup(path, &conf, 8, plan), 0);
+  /* So are other activations and output sampling */
+  conf.activation = tanh;
+  conf.activation_prime = tanh_prime;
+  ck_assert_int_eq(tuner_lookup(path, &conf, 4, plan), 0);
+  conf.activation = sigmoid;
+  conf.activation_prime = sigmoid_prime;
+  conf.output_samples = 2;
+  ck_assert_int_eq(tuner_lookup(path, &conf, 4, plan), 0);
+  conf.output_samples = 0;
+  ck_assert_int_eq(tuner_lookup(path, &conf, 4, plan), 1);
+  conf.threads = 2;
+  ck_assert_int_eq(tuner_lookup(path, &conf, 4, plan), 0);
+  /* Missing plans get tuned and cached */
+  ck_assert_int_eq(tuner_plan(path, &conf, 4, plan), 1);
+  int cached[2];
+  ck_assert_int_eq(tuner_lookup(path, &conf, 4, cached), 1);
+  ck_assert_int_eq(cached[0], plan[0]);
+  ck_assert_int_eq(cached[1], plan[1]);
+  ck_assert_int_eq(remove(path), 0);
+}
+END_TEST
+
+Suite *tuner_suite(void) {
+  Suite *s = suite_create("tuner");
+  TCase *tc_tuner = tcase_create("tuner");
+  tcase_add_test(tc_tuner, test_tuner_tune);
+  tcase_add_test(tc_tuner, test_tuner_cache);
+  suite_add_tcase(s, tc_tuner);
+  return s;
+}